@@ -27,13 +27,13 @@
 #include <string>
 
 #include "assert.h"
+#include "indexwidth.h"
 
 #define NUM_CHAR 256
 
 // ============================================================================
 // CLASS ALPHABET (convert ASCII value <-> character index)
 // ============================================================================
-typedef uint32_t length_t;
 template <size_t S>  // S is the size of the alphabet (including '$')
 class Alphabet {     // e.g. S = 5 for DNA (A,C,G,T + $)
 
@@ -1,52 +1,65 @@
 #ifndef BANDMATRIX_H
 #define BANDMATRIX_H
 
+#include "indexwidth.h"
 #include "substring.h"
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 
-typedef uint32_t length_t;
-
+/**
+ * A band of an edit-distance matrix. The cells are bytes: the values that
+ * matter for a search are at most W + 1 + startValue, higher values saturate
+ * at 255. A band of W + startValue < 255 is hence computed exactly up to that
+ * value, in a quarter of the memory of full-width cells.
+ */
 class BandedMatrix {
   private:
-    std::vector<length_t> matrix;
+    std::vector<uint8_t> matrix;
     length_t W; // The off diagonal width of this bandmatrix
     length_t m; // number of rows
     length_t n; // number of columns
 
     length_t colPerRow;
 
+    /**
+     * Store a value in a cell, values above 255 saturate
+     */
+    void set(length_t i, int j, length_t value) {
+        operator()(i, j) = std::min<length_t>(value, 255);
+    }
+
     void initializeMatrix(length_t startValue) {
 
         // initialize the top row and leftmost column
         for (length_t i = 0; i <= W + 1; i++) {
-            operator()(0, i) = i + startValue;
-            operator()(i, 0) = i + startValue;
+            set(0, i, i + startValue);
+            set(i, 0, i + startValue);
         }
 
         // set max elements at sides
         // first the elements on rows [1, W]
         for (length_t i = 1; i <= W; i++) {
             // right of band
-            operator()(i, i + W + 1) = W + 1 + startValue;
+            set(i, i + W + 1, W + 1 + startValue);
         }
 
         // then the elements on rows [W + 1, x]
         for (length_t i = W + 1; i + W + 1 < n; i++) {
             // right of band
-            operator()(i, i + W + 1) = W + 1 + startValue;
+            set(i, i + W + 1, W + 1 + startValue);
             // left of band
-            operator()(i, i - (W + 1)) = W + 1 + startValue;
+            set(i, i - (W + 1), W + 1 + startValue);
         }
 
         // finally the elements on the final rows
         for (length_t i = std::max<int>((int)n - (W + 1), W + 1); i < m; i++) {
             // left of band
-            operator()(i, i - (W + 1)) = W + 1 + startValue;
+            set(i, i - (W + 1), W + 1 + startValue);
         }
     }
 
@@ -56,16 +69,35 @@ class BandedMatrix {
      * @param patternsize, the size of the pattern to match, this will
      * initialize the top row
      * @param W, the maximal width
-     * @param startValue the value in the origin
+     * @param startValue the value in the origin, W + startValue must be
+     * below 255
+     */
+    BandedMatrix(length_t patternsize, int W, int startValue) {
+        reset(patternsize, W, startValue);
+    }
+
+    /**
+     * Default constructor, call reset() before use
      */
-    BandedMatrix(length_t patternsize, int W, int startValue)
-        : W(W), n(patternsize + 1) {
+    BandedMatrix() : W(0), m(0), n(0), colPerRow(0) {
+    }
 
+    /**
+     * Initialize the matrix for a (new) pattern, the storage of the previous
+     * pattern is reused
+     * @param patternsize, the size of the pattern to match
+     * @param W, the maximal width
+     * @param startValue the value in the origin, W + startValue must be
+     * below 255
+     */
+    void reset(length_t patternsize, int W, int startValue) {
+        assert(W + startValue < 255);
+        this->W = W;
+        n = patternsize + 1;
         m = patternsize + W + 1;
         colPerRow = (2 * W + 1) + 2;
-        matrix.resize(m * colPerRow);
+        matrix.assign(m * colPerRow, 0);
         initializeMatrix(startValue);
-        return;
     }
 
     /**
@@ -84,7 +116,7 @@ class BandedMatrix {
      * @param j Column index
      * @return Reference to element at position (i, j)
      */
-    length_t& operator()(length_t i, int j) {
+    uint8_t& operator()(length_t i, int j) {
         return matrix[i * colPerRow + j - i + W];
     }
 
@@ -104,7 +136,7 @@ class BandedMatrix {
      * @param j Column index
      * @return Reference to element at position (i, j)
      */
-    length_t& at(length_t i, int j) {
+    uint8_t& at(length_t i, int j) {
         return operator()(i, j);
     }
 
@@ -144,11 +176,11 @@ class BandedMatrix {
     length_t updateMatrixCell(bool notMatch, unsigned int row,
                               unsigned int column) {
         // 6 lines of code
-        if(column==0) at(row, column) = row;
-        else if(row==0) at(row, column) = column;
+        if(column==0) set(row, column, row);
+        else if(row==0) set(row, column, column);
         else {
             int s = notMatch ? 1 : 0;
-            at(row, column) = std::min(std::min(at(row-1, column-1) + s, at(row, column-1) + 1), at(row-1, column) + 1);
+            set(row, column, std::min(std::min(at(row-1, column-1) + s, at(row, column-1) + 1), at(row-1, column) + 1));
         }
         return at(row, column);
     }
@@ -179,6 +211,22 @@ class BandedMatrix {
         return currentMin;
     }
 
+    /**
+     * Get a lower bound on the values in the final column of the rows below
+     * a row: the minimum over the band of the row of a value plus a lower
+     * bound on the edit distance of the rest of the pattern after its column
+     * @param row the row, filled in with updateMatrixRow
+     * @param rest rest[j] is a lower bound on the edit distance of the
+     * pattern after column j
+     */
+    length_t getLowerBound(length_t row,
+                           const std::vector<length_t>& rest) const {
+        length_t bound = std::numeric_limits<length_t>::max();
+        for (int j = getFirstColumn(row); j <= getLastColumn(row); j++)
+            bound = std::min<length_t>(bound, at(row, j) + rest[j]);
+        return bound;
+    }
+
     /**
      * Indicates whether the row is within the band of the matrix in the
      * final column of the matrix
@@ -201,6 +249,59 @@ class BandedMatrix {
         return operator()(row, n - 1);
     }
 
+    /**
+     * Checks if a cell lies within the band of the matrix
+     * @param i Row index
+     * @param j Column index
+     */
+    bool inBand(length_t i, length_t j) const {
+        return i <= j + W && j <= i + W;
+    }
+
+    /**
+     * Finds the operations of an optimal alignment by tracing back from
+     * (row, final column) to the origin. The rows up to row must be filled in
+     * with updateMatrixRow and the matrix must have start value 0.
+     * @param pattern the horizontal sequence (with direction correctly set)
+     * @param ref the characters of the rows 1 to row, ref[i - 1] is the
+     * character of row i
+     * @param row the row where the alignment ends
+     * @param cigar the CIGAR string of the alignment of the pattern against
+     * the rows: M for a match or mismatch, I for a character of the pattern
+     * that is not in the rows and D for a character of the rows that is not
+     * in the pattern [output]
+     */
+    void traceback(const Substring& pattern, const char* ref, length_t row,
+                   std::string& cigar) const {
+        assert(row < m && inBand(row, n - 1));
+        std::string ops; // the operations from the end to the start
+        length_t i = row, j = n - 1;
+        while (i > 0 || j > 0) {
+            length_t v = at(i, j);
+            if (i > 0 && j > 0 && inBand(i - 1, j - 1) &&
+                at(i - 1, j - 1) + (ref[i - 1] != pattern[j - 1]) == v) {
+                ops += 'M';
+                i--, j--;
+            } else if (j > 0 && inBand(i, j - 1) && at(i, j - 1) + 1 == v) {
+                ops += 'I';
+                j--;
+            } else {
+                ops += 'D';
+                i--;
+            }
+        }
+
+        // run-length encode the operations
+        cigar.clear();
+        for (size_t k = ops.size(); k > 0;) {
+            size_t run = 1;
+            while (run < k && ops[k - 1 - run] == ops[k - 1])
+                run++;
+            cigar += std::to_string(run) + ops[k - 1];
+            k -= run;
+        }
+    }
+
     void printMatrix(length_t maxRow = 500) const {
         length_t mRow = std::min<length_t>(maxRow + 1, m);
 
@@ -233,4 +334,230 @@ class BandedMatrix {
     }
 };
 
+/**
+ * The same band of an edit-distance matrix as BandedMatrix, computed with the
+ * bit-parallel algorithm of Myers (in the formulation of Hyyro). A row only
+ * stores the differences between horizontally adjacent cells, as two bit
+ * vectors: bit b of P (M) is set if the value in column b increases
+ * (decreases) by one compared to column b - 1. The next row follows from
+ * these vectors and the match vector of its character in a handful of word
+ * operations, instead of one cell at a time.
+ *
+ * The vectors follow the band: bit b of row i is column i - W + b, such that
+ * a band of 2W + 1 columns fits in one word. The columns left of the pattern
+ * (column < 0) continue the first row and the first column as if the pattern
+ * were preceded by characters that never match. The cells just outside the
+ * band get a value one higher than their neighbour in the band, i.e. at
+ * least W + 1 + startValue. Like in BandedMatrix, a cell is hence exact if
+ * its edit distance is at most W + startValue and higher than that
+ * otherwise, so the decisions of a search (minimum of a row and value in the
+ * final column compared to W + startValue) are exactly the same.
+ */
+class BitParallelMatrix {
+  private:
+    struct Row {
+        uint64_t P;     // the columns whose value is one higher
+        uint64_t M;     // the columns whose value is one lower
+        length_t first; // the value of the first column of the band (bit 0)
+    };
+
+    std::vector<Row> rows;
+    // the match vectors of A, C, G and T, interleaved per word: bit q of
+    // character c (word 4 * (q / 64) + c) is set if pattern[q - W - 1] is c,
+    // i.e. column q - W of the band matches
+    std::vector<uint64_t> match;
+    length_t W;     // the off diagonal width of the band
+    length_t n;     // the number of columns (pattern size + 1)
+    uint64_t mask;  // the 2W + 1 bits of the band
+
+    static int charIndex(char c) {
+        switch (c) {
+        case 'A':
+            return 0;
+        case 'C':
+            return 1;
+        case 'G':
+            return 2;
+        case 'T':
+            return 3;
+        default:
+            return -1;
+        }
+    }
+
+    /**
+     * Get the value in bit b of the band of a row
+     */
+    static length_t valueAt(const Row& r, length_t b) {
+        uint64_t bits = ((2ull << b) - 1) & ~1ull; // the bits 1 to b
+        return r.first + __builtin_popcountll(r.P & bits) -
+               __builtin_popcountll(r.M & bits);
+    }
+
+    /**
+     * Get the match vector of a character for the band of a row
+     */
+    uint64_t getMatchVector(int c, length_t row) const {
+        if (c < 0)
+            return 0;
+        const uint64_t* v = match.data() + 4 * (row / 64) + c;
+        length_t offset = row % 64;
+        uint64_t bits = v[0] >> offset;
+        if (offset != 0)
+            bits |= v[4] << (64 - offset);
+        return bits & mask;
+    }
+
+  public:
+    // the maximal off diagonal width, the band must fit in one word
+    static const length_t maxWidth = 31;
+
+    /**
+     * Default constructor, call reset() before use
+     */
+    BitParallelMatrix() : W(0), n(0), mask(0) {
+    }
+
+    /**
+     * Constructor
+     * @param pattern the horizontal sequence (with direction correctly set)
+     * @param W the off diagonal width, at most maxWidth
+     * @param startValue the value in the origin
+     */
+    BitParallelMatrix(const Substring& pattern, length_t W,
+                      length_t startValue) {
+        reset(pattern, W, startValue);
+    }
+
+    /**
+     * Initialize the matrix for a (new) pattern. The storage of the previous
+     * pattern is reused, such that a matrix that is reset for every part of
+     * every search does not allocate memory once it has grown to the
+     * largest part.
+     * @param pattern the horizontal sequence (with direction correctly set)
+     * @param W the off diagonal width, at most maxWidth
+     * @param startValue the value in the origin
+     */
+    void reset(const Substring& pattern, length_t W, length_t startValue) {
+        assert(W <= maxWidth);
+        this->W = W;
+        n = pattern.size() + 1;
+        mask = (2ull << (2 * W)) - 1;
+        rows.resize(n + W);
+        // the bands of all rows span the columns -W to n - 1 + 2W
+        match.assign(4 * ((n + 3 * W) / 64 + 2), 0);
+        for (length_t j = 1; j < n; j++) {
+            int c = charIndex(pattern[j - 1]);
+            if (c >= 0)
+                match[4 * ((j + W) / 64) + c] |= 1ull << ((j + W) % 64);
+        }
+
+        // the first row: startValue + |j| for columns j from -W to W
+        rows[0].P = (mask << (W + 1)) & mask;
+        rows[0].M = mask >> W;
+        rows[0].first = startValue + W;
+    }
+
+    /**
+     * Get the number of rows of the matrix
+     */
+    length_t getNumberOfRows() const {
+        return rows.size();
+    }
+
+    /**
+     * Update the matrix by calculating the elements at row within the band,
+     * the previous row must hold the row above this one
+     * @param pattern the pattern of the constructor, for compatibility with
+     * BandedMatrix
+     * @param row the row to update
+     * @param c the character associated with this row
+     * @returns minimal value found at this row (the same as BandedMatrix if it
+     * is at most W + startValue)
+     */
+    length_t updateMatrixRow(const Substring& pattern, length_t row, char c) {
+        if (row >= getNumberOfRows())
+            return std::numeric_limits<length_t>::max();
+
+        // align the previous row with this band, the column right of the
+        // previous band is one higher than its left neighbour
+        const Row& prev = rows[row - 1];
+        uint64_t Pv = (prev.P >> 1) | (1ull << (2 * W));
+        uint64_t Mv = prev.M >> 1;
+        uint64_t Eq = getMatchVector(charIndex(c), row);
+
+        // the vertical differences (this row - previous row)
+        uint64_t Xv = Eq | Mv;
+        uint64_t Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+        uint64_t Ph = Mv | ~(Xh | Pv);
+        uint64_t Mh = Pv & Xh;
+
+        Row& r = rows[row];
+        r.first = prev.first + (Pv & 1) - (Mv & 1) + (Ph & 1) - (Mh & 1);
+
+        // the cell left of the band is one higher than the cell above it
+        Ph = (Ph << 1) | 1;
+        Mh <<= 1;
+        r.P = (Mh | ~(Xv | Ph)) & mask;
+        r.M = (Ph & Xv) & mask;
+
+        // the minimum over the columns 1 to n - 1 in the band: the first of
+        // these columns or a column whose value decreases
+        int begin = std::max<int>(0, W + 1 - row);
+        int end = std::min<int>(2 * W, n - 1 + W - row);
+        if (begin > end)
+            return std::numeric_limits<length_t>::max();
+        length_t minimum = valueAt(r, begin);
+        uint64_t down = r.M & ~((2ull << begin) - 1) & ((2ull << end) - 1);
+        for (; down != 0; down &= down - 1)
+            minimum = std::min(minimum, valueAt(r, __builtin_ctzll(down)));
+        return minimum;
+    }
+
+    /**
+     * Get a lower bound on the values in the final column of the rows below
+     * a row (the same as BandedMatrix if it is at most W + startValue)
+     * @param row the row, filled in with updateMatrixRow
+     * @param rest rest[j] is a lower bound on the edit distance of the
+     * pattern after column j
+     */
+    length_t getLowerBound(length_t row,
+                           const std::vector<length_t>& rest) const {
+        const Row& r = rows[row];
+        int begin = std::max<int>(0, W + 1 - row);
+        int end = std::min<int>(2 * W, n - 1 + W - row);
+        length_t bound = std::numeric_limits<length_t>::max();
+        if (begin > end)
+            return bound;
+        // walk the band from its first column with the differences
+        length_t value = valueAt(r, begin);
+        for (int b = begin; b <= end; b++) {
+            if (b > begin)
+                value = value + ((r.P >> b) & 1) - ((r.M >> b) & 1);
+            bound = std::min(bound, value + rest[row - W + b]);
+        }
+        return bound;
+    }
+
+    /**
+     * Indicates whether the row is within the band of the matrix in the
+     * final column of the matrix
+     * @param row the row to check
+     */
+    bool inFinalColumn(length_t row) const {
+        return row + W >= n - 1;
+    }
+
+    /**
+     * Finds the value in matrix(row, finalCol). Warning: only call this
+     * function if the row is in the band for the final column
+     * @param row
+     * @returns matrix(row, final column)
+     */
+    length_t getValueInFinalColumn(length_t row) const {
+        assert(inFinalColumn(row));
+        return valueAt(rows[row], n - 1 + W - row);
+    }
+};
+
 #endif
\ No newline at end of file
@@ -1,7 +1,7 @@
 #include "bidirectionalfmindex.h"
 
 using namespace std;
-#include "bandmatrix.h"
+#include "sais.h"
 
 ostream& operator<<(ostream& os, const RangePair& r) {
     os << "RangePair(" << r.getBackwardRange() << ", " << r.getForwardRange()
@@ -10,87 +10,383 @@ ostream& operator<<(ostream& os, const RangePair& r) {
 }
 
 void BiFMIndex::read(const string& base, bool verbose) {
-    // step 1 create the rev bwt
+    // use the prebuilt index if available, it must match the text (its
+    // length and checksum) and the width of length_t
+    if (revIndexFile.open(base + ".rev.fmi")) {
+        size_t paramsSize;
+        const uint64_t* params =
+            (const uint64_t*)revIndexFile.section("PARAMS", paramsSize);
+        if (paramsSize < 3 * sizeof(uint64_t) || params[0] != textLength ||
+            params[1] != sizeof(length_t) || params[2] != textChecksum)
+            throw runtime_error(base + ".rev.fmi does not match the text or "
+                                "the index width, rebuild it with "
+                                "fmindex-build");
+        printInfo("Mapping: " + base + ".rev.fmi", verbose);
+        originalOccTable.map(revIndexFile.section("ORIGOCC"));
+        reverseOccTable.map(revIndexFile.section("REVOCC"));
+        if (revIndexFile.hasSection("REVKMER"))
+            revKmerTable.map(revIndexFile.section("REVKMER"));
+        // both index files must contain a table for the same k
+        if (revKmerTable.getK() != kmerTable.getK()) {
+            kmerTable = KmerTable();
+            revKmerTable = KmerTable();
+        }
+        printDone(verbose);
+        return;
+    }
+
+    // read the suffix array of the reversed text or construct it if it is
+    // not available
     vector<length_t> revSA;
-    readSA(base + ".rev.sa", revSA, textLength);
+    if (ifstream(base + ".rev.sa")) {
+        printInfo("Reading: " + base + ".rev.sa", verbose);
+        readSA(base + ".rev.sa", revSA, textLength);
+    } else {
+        printInfo("Constructing suffix array of reversed text", verbose);
+        string revText(text.rend() - textLength + 1, text.rend());
+        revText.push_back('$');
+        sais::constructSA(revText, revSA);
+    }
+    printDone(verbose);
+
+    createFromRevSA(revSA, verbose);
+}
+
+void BiFMIndex::createFromRevSA(const vector<length_t>& revSA, bool verbose) {
+    // step 1 create the rev bwt
+    printInfo("Creating BWT of reversed text", verbose);
     string revBWT;
     createRevBWTFromRevSA(revSA, revBWT);
+    printDone(verbose);
 
     // step 2 create the cumulative bit vectors
-    originalOccTable = CumulativeBitvectors<ALPHABET>(sigma, bwt);
+    printInfo("Create cumulative Occ tables", verbose);
+    originalOccTable =
+        CumulativeBitvectors<ALPHABET>(sigma, string(bwt, textLength));
     reverseOccTable = CumulativeBitvectors<ALPHABET>(sigma, revBWT);
+    printDone(verbose);
+}
+
+void BiFMIndex::write(const string& base) const {
+    FMIndex::write(base);
+
+    IndexFileWriter w(base + ".rev.fmi");
+    uint64_t params[3] = {textLength, sizeof(length_t), textChecksum};
+    w.writeSection("PARAMS", params, sizeof(params));
+    originalOccTable.write(w.beginSection("ORIGOCC"));
+    w.endSection();
+    reverseOccTable.write(w.beginSection("REVOCC"));
+    w.endSection();
+    if (revKmerTable.getK() > 0) {
+        revKmerTable.write(w.beginSection("REVKMER"));
+        w.endSection();
+    }
+    w.close();
+}
+
+void BiFMIndex::createKmerTable(length_t k, uint64_t maxBytes) {
+    // the forward ranges have the same width as the backward ranges, hence
+    // only their begin is stored
+    k = KmerTable::fitK(k, 3, maxBytes);
+    kmerTable = (k == 0) ? KmerTable() : KmerTable(k, 2);
+    revKmerTable = (k == 0) ? KmerTable() : KmerTable(k, 1);
+    if (k > 0)
+        fillKmerTable(RangePair(0, textLength, 0, textLength), 0, 0);
+}
+
+void BiFMIndex::fillKmerTable(const RangePair& ranges, length_t depth,
+                              uint64_t code) {
+    if (depth == kmerTable.getK()) {
+        length_t* entry = kmerTable[code];
+        entry[0] = ranges.getBackwardRange().getBegin();
+        entry[1] = ranges.getBackwardRange().getEnd();
+        revKmerTable[code][0] = ranges.getForwardRange().getBegin();
+        return;
+    }
+
+    // the k-mer is built from right to left, the character added at this
+    // depth ends up at position k - depth - 1 of the k-mer
+    RangePair newRanges;
+    for (length_t i = 1; i < ALPHABET; i++) {
+        if (addCharLeft(i, ranges, newRanges))
+            fillKmerTable(newRanges, depth + 1,
+                          code | (uint64_t)(i - 1) << (2 * depth));
+    }
 }
 
 void BiFMIndex::createRevBWTFromRevSA(const vector<length_t>& revSA,
                                       string& revBWT) {
     // 5-10 lines of code
-    std::cout << "Warning createRevBWTFromRevSA has not been implmented yet!"
-              << std::endl;
+    // the reversed text is text[0...textLength-1[ reversed followed by '$',
+    // hence revText[j - 1] == text[textLength - 1 - j] for j > 0
+    revBWT.resize(revSA.size());
+    for (size_t i = 0; i < revSA.size(); i++) {
+        revBWT[i] = revSA[i] > 0 ? text[textLength - 1 - revSA[i]] : '$';
+    }
 }
 
 bool BiFMIndex::addCharRight(length_t charIdx, const RangePair& originalRanges,
                              RangePair& newRanges) const {
     // 8 - 12 lines of code
-    throw std::runtime_error("addCharRight has not been implemented yet!");
+    const Range& f = originalRanges.getForwardRange();
+    const Range& b = originalRanges.getBackwardRange();
+
+    // the forward range is extended as in backward search over the BWT of the
+    // reversed text, the backward range is narrowed by the number of
+    // occurrences of smaller characters
+    length_t fBegin =
+        counts[charIdx] + reverseOccTable.occ(charIdx, f.getBegin());
+    length_t fEnd = counts[charIdx] + reverseOccTable.occ(charIdx, f.getEnd());
+    length_t bBegin = b.getBegin() +
+                      reverseOccTable.cumulocc(charIdx, f.getEnd()) -
+                      reverseOccTable.cumulocc(charIdx, f.getBegin());
+
+    newRanges = RangePair(bBegin, bBegin + (fEnd - fBegin), fBegin, fEnd);
+    return !newRanges.empty();
 }
 
 bool BiFMIndex::addCharLeft(length_t charIdx, const RangePair& originalRanges,
                             RangePair& newRanges) const {
 
     // 8 - 12 lines of code
-    throw std::runtime_error("addCharLeft has not been implemented yet!");
+    const Range& f = originalRanges.getForwardRange();
+    const Range& b = originalRanges.getBackwardRange();
+
+    length_t bBegin =
+        counts[charIdx] + originalOccTable.occ(charIdx, b.getBegin());
+    length_t bEnd = counts[charIdx] + originalOccTable.occ(charIdx, b.getEnd());
+    length_t fBegin = f.getBegin() +
+                      originalOccTable.cumulocc(charIdx, b.getEnd()) -
+                      originalOccTable.cumulocc(charIdx, b.getBegin());
+
+    newRanges = RangePair(bBegin, bEnd, fBegin, fBegin + (bEnd - bBegin));
+    return !newRanges.empty();
 }
 
-void BiFMIndex::extendFMPos(const RangePair& ranges, const length_t& depth,
-                            vector<BiFMPosExt>& stack) {
+template <class Stack>
+void BiFMIndex::extendFMPos(const SearchContext& ctx, const RangePair& ranges,
+                            const length_t& depth, Stack& stack) const {
     // 4 lines of code
-    throw std::runtime_error("extendFMPos has not been implemented yet!");
+    // the range in the direction of the extension is updated as in backward
+    // search, the other range is narrowed by the counts of smaller characters
+    bool forward = (ctx.getDirection() == FORWARD);
+    const Range& r = forward ? ranges.getForwardRange() : ranges.getBackwardRange();
+    const Range& o = forward ? ranges.getBackwardRange() : ranges.getForwardRange();
+    const auto& table = forward ? reverseOccTable : originalOccTable;
+
+    // cumulative counts of all characters at both bounds of the range
+    array<size_t, ALPHABET + 1> cumB, cumE;
+    table.cumuloccAll(r.getBegin(), max(r.getBegin(), r.getEnd()), cumB, cumE);
+
+    for (length_t i = 1; i < ALPHABET; i++) {
+        length_t begin = counts[i] + cumB[i + 1] - cumB[i];
+        length_t end = counts[i] + cumE[i + 1] - cumE[i];
+        if (end <= begin)
+            continue;
+        length_t oBegin = o.getBegin() + cumE[i] - cumB[i];
+        Range other(oBegin, oBegin + (end - begin));
+        RangePair newRanges = forward ? RangePair(other, Range(begin, end))
+                                      : RangePair(Range(begin, end), other);
+        stack.emplace_back(sigma.i2c(i), newRanges, depth + 1);
+    }
 }
 
+template void BiFMIndex::extendFMPos(const SearchContext& ctx,
+                                     const RangePair& ranges,
+                                     const length_t& depth,
+                                     vector<BiFMPosExt>& stack) const;
+template void BiFMIndex::extendFMPos(const SearchContext& ctx,
+                                     const RangePair& ranges,
+                                     const length_t& depth,
+                                     BiSearchStack& stack) const;
+
 RangePair BiFMIndex::matchExactBidirectionally(const Substring& str,
                                                RangePair ranges) const {
 
-    // assert that the direction of str and the BiFMIndex match, leave this line
-    // in! If your program blocks on this line it means that somewhere in your
-    // code you forgot to correctly set the direction of the index
-    assert(dir == str.getDirection());
-
     // 5 - 10 lines of code
-    throw runtime_error(
-        "matchExactBidirectionally has not been implemented yet");
+    Direction dir = str.getDirection();
+    for (length_t i = 0; i < str.size(); i++) {
+        length_t charIdx = sigma.c2i(str[i]);
+        bool notEmpty = (dir == FORWARD)
+                            ? addCharRight(charIdx, ranges, ranges)
+                            : addCharLeft(charIdx, ranges, ranges);
+        if (!notEmpty)
+            return RangePair();
+    }
+    return ranges;
+}
+
+RangePair BiFMIndex::matchExactBidirectionally(const Substring& str) const {
+    RangePair ranges(0, textLength, 0, textLength);
+    length_t k = revKmerTable.getK();
+    if (k == 0 || k != kmerTable.getK() || str.size() < k)
+        return matchExactBidirectionally(str, ranges);
+
+    // the first k characters in the direction of the search form the k-mer,
+    // in the backward direction they are visited in reverse text order
+    uint64_t code = 0;
+    for (length_t i = 0; i < k; i++) {
+        char c = (str.getDirection() == FORWARD) ? str[i] : str[k - i - 1];
+        if (!KmerTable::appendChar(c, code))
+            return matchExactBidirectionally(str, ranges);
+    }
+
+    const length_t* entry = kmerTable[code];
+    length_t width = entry[1] - entry[0];
+    if (width == 0)
+        return RangePair();
+    length_t fBegin = revKmerTable[code][0];
+    ranges = RangePair(entry[0], entry[1], fBegin, fBegin + width);
+
+    return matchExactBidirectionally(str.getSubPiece(k), ranges);
 }
 
-void BiFMIndex::recApproxMatch(const Search& s, const BiFMOcc& startOcc,
-                               vector<FMOcc>& occ,
-                               const vector<Substring>& parts, const int& idx) {
+void BiFMIndex::recApproxMatch(SearchContext& ctx, const Search& s,
+                               const BiFMOcc& startOcc, vector<FMOcc>& occ,
+                               const vector<Substring>& parts,
+                               const int& idx) const {
+
+    if (startOcc.getRanges().width() <= verifyWidth &&
+        verifyCandidates(s, parts, idx, 0)) {
+        // few candidates: continue in the text of every row
+        const Range& r = startOcc.getRange();
+        for (length_t i = r.getBegin(); i < r.getEnd(); i++)
+            verifyInText(ctx, s, Candidate(i, startOcc.getDepth()),
+                         startOcc.getDistance(), occ, parts, idx);
+        return;
+    }
 
-    // Fill in the TODO's at lines 70 and 77. You can use the provided code
-    // in function FMIndex::naiveApproxMatch in file fmindex.cpp as inspiration
-    // Afterwards fill in the while loop at line 88
+    // shortcut variables
+    const Substring& p = parts[s.getPart(idx)]; // this part
+    length_t maxED = s.getUpperBound(idx);      // maxED for this part
+
+    // create the matrix for the current part, the origin holds the distance
+    // of the start occurrence, the bit-parallel rows if the band fits in a
+    // word
+    length_t W = maxED - startOcc.getDistance();
+    if (W <= BitParallelMatrix::maxWidth) {
+        BitParallelMatrix& matrix = ctx.getMatrix(idx);
+        matrix.reset(p, W, startOcc.getDistance());
+        recApproxMatch(ctx, s, startOcc, occ, parts, idx, matrix);
+    } else {
+        BandedMatrix matrix(p.size(), W, startOcc.getDistance());
+        recApproxMatch(ctx, s, startOcc, occ, parts, idx, matrix);
+    }
+}
 
-    // TODO create the matrix for the current part, with the correct width and
-    // intialization value (4 - 5 lines)
+template <class Matrix>
+void BiFMIndex::recApproxMatch(SearchContext& ctx, const Search& s,
+                               const BiFMOcc& startOcc, vector<FMOcc>& occ,
+                               const vector<Substring>& parts, const int& idx,
+                               Matrix& matrix) const {
 
-    // Create the stack and reserve space
-    vector<BiFMPosExt> stack; // stack with positions to visit
-    stack.reserve((parts.back().end()) * ALPHABET);
+    // shortcut variables
+    const Substring& p = parts[s.getPart(idx)]; // this part
+    length_t maxED = s.getUpperBound(idx);      // maxED for this part
+    length_t minED = s.getLowerBound(idx);      // minED for this part
 
-    // TODO set the direction (1 - 3 lines)
-    // use function setDirection()
+    // Get the stack, the nodes below its current size belong to the parts
+    // of the previous indices
+    BiSearchStack& stack = ctx.getStack(); // positions to visit
+    size_t base = stack.size();
+
+    // set the direction
+    ctx.setDirection(s.getDirection(idx));
 
     // Add the children of the start occurrence to the stack, make sure
     // they have depth/row 1
-    extendFMPos(startOcc.getRanges(), 0, stack);
+    extendFMPos(ctx, startOcc.getRanges(), 0, stack);
 
     // Branch and bound algorithm
-    while (!stack.empty()) {
+    while (stack.size() > base) {
 
         // Get the final element from the stack and pop it back (= remove from
-        // the stack)
-        // Uncomment these lines
-        /* BiFMPosExt currentPos = stack.back();
-        stack.pop_back(); */
-        // 10 - 25 lines of code
-        throw runtime_error("recApproxMatch has not been implemented yet");
+        // the stack), the recursive calls reuse its slot
+        size_t top = stack.size() - 1;
+        RangePair ranges = stack.getRanges(top);
+        length_t row = stack.getRow(top);
+        char c = stack.getCharacter(top);
+        stack.pop_back();
+
+        length_t minimalEditDist = matrix.updateMatrixRow(p, row, c);
+        if (minimalEditDist > maxED)
+            continue;
+
+        if (matrix.inFinalColumn(row)) {
+            // the full part was matched
+            length_t ED = matrix.getValueInFinalColumn(row);
+            if (ED <= maxED && ED >= minED) {
+                BiFMOcc newOcc(ranges, ED, startOcc.getDepth() + row);
+                if (s.isEnd(idx)) {
+                    occ.push_back(newOcc);
+                } else {
+                    recApproxMatch(ctx, s, newOcc, occ, parts, idx + 1);
+                    // the recursive call changed the direction
+                    ctx.setDirection(s.getDirection(idx));
+                }
+            }
+        }
+
+        if (ranges.width() <= verifyWidth &&
+            verifyCandidates(s, parts, idx, row)) {
+            // few candidates: continue in the text of every row
+            const Range& r = ranges.getBackwardRange();
+            length_t depth = startOcc.getDepth() + row;
+            for (length_t i = r.getBegin(); i < r.getEnd(); i++)
+                verifyInText(ctx, s, Candidate(i, depth), row, matrix, occ,
+                             parts, idx);
+        } else {
+            extendFMPos(ctx, ranges, row, stack);
+        }
+    }
+}
+
+void BiFMIndex::verifyInText(SearchContext& ctx, const Search& s,
+                             const Candidate& cand, length_t startED,
+                             vector<FMOcc>& occ, const vector<Substring>& parts,
+                             const int& idx) const {
+    // the matrix of the part, as in recApproxMatch
+    const Substring& p = parts[s.getPart(idx)];
+    length_t W = s.getUpperBound(idx) - startED;
+    if (W <= BitParallelMatrix::maxWidth) {
+        BitParallelMatrix& matrix = ctx.getMatrix(idx);
+        matrix.reset(p, W, startED);
+        verifyInText(ctx, s, cand, 0, matrix, occ, parts, idx);
+    } else {
+        BandedMatrix matrix(p.size(), W, startED);
+        verifyInText(ctx, s, cand, 0, matrix, occ, parts, idx);
+    }
+}
+
+template <class Matrix>
+void BiFMIndex::verifyInText(SearchContext& ctx, const Search& s,
+                             Candidate cand, length_t row, Matrix& matrix,
+                             vector<FMOcc>& occ, const vector<Substring>& parts,
+                             const int& idx) const {
+
+    // shortcut variables
+    const Substring& p = parts[s.getPart(idx)]; // this part
+    length_t maxED = s.getUpperBound(idx);      // maxED for this part
+    length_t minED = s.getLowerBound(idx);      // minED for this part
+    bool forward = s.getDirection(idx) == FORWARD;
+
+    // extend the matched string with the characters of the text
+    char c;
+    while (forward ? extendRight(cand, c) : extendLeft(cand, c)) {
+        row++;
+        if (matrix.updateMatrixRow(p, row, c) > maxED)
+            return;
+
+        if (matrix.inFinalColumn(row)) {
+            // the full part was matched
+            length_t ED = matrix.getValueInFinalColumn(row);
+            if (ED <= maxED && ED >= minED) {
+                if (s.isEnd(idx)) {
+                    occ.push_back(makeOcc(cand, ED));
+                } else {
+                    verifyInText(ctx, s, cand, ED, occ, parts, idx + 1);
+                }
+            }
+        }
     }
 }
@@ -1,8 +1,12 @@
 #ifndef BIDIRECTIONALFMINDEX_H
 #define BIDIRECTIONALFMINDEX_H
 
+#include "bandmatrix.h"
 #include "cumulativebitvec.h"
 #include "fmindex.h"
+#include "searchstack.h"
+
+#include <deque>
 
 // ============================================================================
 // CLASS RANGEPAIR: PROVIDED STEP 3
@@ -111,6 +115,35 @@ class BiFMPosExt : public FMPosExt {
     }
 };
 
+/**
+ * A SearchStack of nodes with a pair of ranges. Both ranges have the same
+ * width, so only the begin of the forward range is stored.
+ */
+class BiSearchStack : public SearchStack {
+  public:
+    BiSearchStack() : SearchStack(4) {
+    }
+
+    /**
+     * Push a node
+     * @param c the character of the node
+     * @param ranges the ranges over the suffix arrays
+     * @param row the row of the node in the alignment matrix = its depth
+     */
+    void emplace_back(char c, const RangePair& ranges, length_t row) {
+        size_t i = push(c, ranges.getBackwardRange(), row);
+        values(3)[i] = ranges.getForwardRange().getBegin();
+    }
+
+    /**
+     * Get the ranges of node i
+     */
+    RangePair getRanges(size_t i) const {
+        length_t b = values(0)[i], e = values(1)[i], f = values(3)[i];
+        return RangePair(b, e, f, f + (e - b));
+    }
+};
+
 class BiFMOcc : public FMOcc {
   private:
     Range forwardRange;
@@ -309,22 +342,172 @@ class Search {
     }
 };
 
+// ============================================================================
+// CLASS SEARCHCONTEXT
+// ============================================================================
+
+// the ranges of an exact match of a part of the pattern
+struct PartRanges {
+    unsigned int begin, end; // the part of the pattern
+    RangePair ranges;        // the ranges of its exact match
+};
+
+/**
+ * The state of the searches of a pattern and the workspace of the searches.
+ * The matrices of the parts, the stack of the search, the parts themselves
+ * and their exact matches keep their storage between searches, such that a
+ * context that is reused for many patterns (e.g. one per thread) does not
+ * allocate memory once it has grown to the largest pattern.
+ */
+class SearchContext {
+  private:
+    Direction dir; // the direction in which the pattern is extended
+
+    // the matrix of every index in a search, a deque such that the deeper
+    // indices can be added while the others are in use
+    std::deque<BitParallelMatrix> matrices;
+    BiSearchStack stack; // the nodes to visit of all indices in a search
+
+    std::vector<Substring> parts;           // the parts of the pattern
+    std::vector<RangePair> exactMatchRanges; // the exact matches of the parts
+    std::vector<PartRanges> partRanges; // the exact matches of the parts of
+                                        // all strata of a best-stratum search
+
+  public:
+    /**
+     * Constructor
+     * @param dir the initial search direction
+     */
+    SearchContext(Direction dir = FORWARD) : dir(dir) {
+    }
+
+    /**
+     * Sets the search direction
+     * @param d the direction to search in, either FORWARD or BACKWARD
+     */
+    void setDirection(Direction d) {
+        dir = d;
+    }
+
+    Direction getDirection() const {
+        return dir;
+    }
+
+    /**
+     * Get the matrix for the part at an index in a search
+     */
+    BitParallelMatrix& getMatrix(length_t idx) {
+        while (matrices.size() <= idx)
+            matrices.emplace_back();
+        return matrices[idx];
+    }
+
+    /**
+     * Get the stack of the search, shared by the parts: the part at an index
+     * only visits the nodes above the size of the stack at its start
+     */
+    BiSearchStack& getStack() {
+        return stack;
+    }
+
+    /**
+     * Get the parts of the pattern
+     */
+    std::vector<Substring>& getParts() {
+        return parts;
+    }
+
+    /**
+     * Get the ranges of the exact matches of the parts of the pattern
+     */
+    std::vector<RangePair>& getExactMatchRanges() {
+        return exactMatchRanges;
+    }
+
+    /**
+     * Get the exact matches of the parts of all strata of a search for the
+     * best stratum
+     */
+    std::vector<PartRanges>& getPartRanges() {
+        return partRanges;
+    }
+};
+
 class BiFMIndex : public FMIndex {
   private:
     CumulativeBitvectors<ALPHABET> reverseOccTable;
     CumulativeBitvectors<ALPHABET> originalOccTable;
 
-    // search direction variables
-    Direction dir;
+    KmerTable revKmerTable; // the begin of the range over the SA of the
+                            // reversed text of every k-mer (if any)
+
+    MappedIndexFile revIndexFile; // the memory-mapped index file (if any)
 
+    /**
+     * Helper function for constructor, maps the index file <base>.rev.fmi if
+     * present. Otherwise, reads the suffix array of the reversed text and
+     * creates the cumulative occurrence tables.
+     */
     void read(const std::string& base, bool verbose);
 
+    /**
+     * Helper function for constructor, creates the BWT of the reversed text
+     * and the cumulative occurrence tables
+     * @param revSA the (dense) suffix array of the reversed text
+     */
+    void createFromRevSA(const std::vector<length_t>& revSA, bool verbose);
+
+    /**
+     * Helper function for createKmerTable, stores the ranges of all k-mers
+     * that end with the string that corresponds to ranges
+     * @param ranges the ranges of the current string
+     * @param depth the length of the current string
+     * @param code the code of the current string
+     */
+    void fillKmerTable(const RangePair& ranges, length_t depth, uint64_t code);
+
   public:
-    BiFMIndex(const std::string& base, int sa_sparse = 1, bool verbose = true)
-        : FMIndex(base, sa_sparse, verbose) {
+    BiFMIndex(const std::string& base, int sa_sparse = 1, bool verbose = true,
+              OccTableLayout layout = BITVECTORS,
+              SASampling sampling = SAMPLE_SA_INDEX)
+        : FMIndex(base, sa_sparse, verbose, layout, sampling) {
         read(base, verbose);
     }
 
+    /**
+     * Constructor, creates the index from already constructed suffix arrays
+     * instead of reading the suffix array files or the index files
+     * @param base the base name of the index, <base>.txt is read
+     * @param sa the (dense) suffix array of the text
+     * @param revSA the (dense) suffix array of the reversed text
+     * @param layout the layout of the occurrence table
+     * @param sampling the sampling strategy of the sparse suffix array
+     */
+    BiFMIndex(const std::string& base, const std::vector<length_t>& sa,
+              const std::vector<length_t>& revSA, int sa_sparse = 1,
+              bool verbose = true, OccTableLayout layout = BITVECTORS,
+              SASampling sampling = SAMPLE_SA_INDEX)
+        : FMIndex(base, sa, sa_sparse, verbose, layout, sampling) {
+        createFromRevSA(revSA, verbose);
+    }
+
+    /**
+     * Write the index files <base>.fmi and <base>.rev.fmi, the latter contains
+     * the cumulative occurrence tables of the text and the reversed text
+     * @param base the base name of the index
+     */
+    void write(const std::string& base) const;
+
+    /**
+     * Create the lookup table with the ranges of every k-mer in both
+     * directions, such that matchExactBidirectionally can skip the first k
+     * steps. The table is written to the index files by write().
+     * @param k the length of the k-mers
+     * @param maxBytes the memory budget of the table, k is lowered until the
+     * table fits (no table is created if even k = 1 does not fit)
+     */
+    void createKmerTable(length_t k, uint64_t maxBytes);
+
     /**
      * Create the BWT of the reverse text from the SA of the reverse text and
      * the text
@@ -365,25 +548,31 @@ class BiFMIndex : public FMIndex {
     /**
      * Creates all child positions of the position and pushes them on the
      * stack
+     * @param ctx, the search context with the direction of the extension
      * @param range, the range of the position to get the children of
      * @param depth, the depth of the position to get the children of
-     * @param stack, the stack to push the children on
+     * @param stack, the stack to push the children on, a vector of
+     * BiFMPosExt or a BiSearchStack
      */
-    void extendFMPos(const RangePair& ranges, const length_t& depth,
-                     std::vector<BiFMPosExt>& stack);
+    template <class Stack>
+    void extendFMPos(const SearchContext& ctx, const RangePair& ranges,
+                     const length_t& depth, Stack& stack) const;
 
     /**
      * Creates all child positions of the position and pushes them on the stack
+     * @param ctx, the search context with the direction of the extension
      * @param pos, the position to get the children of
      * @param stack, the stack to push the children on
      */
-    void extendFMPos(const BiFMPosExt& pos, std::vector<BiFMPosExt>& stack) {
-        extendFMPos(pos.getRanges(), pos.getDepth(), stack);
+    void extendFMPos(const SearchContext& ctx, const BiFMPosExt& pos,
+                     std::vector<BiFMPosExt>& stack) const {
+        extendFMPos(ctx, pos.getRanges(), pos.getDepth(), stack);
     }
 
     /**
      * This function matches a string exactly starting form startRange while
-     * keeping track of the ranges in both directions
+     * keeping track of the ranges in both directions. The string is matched
+     * in its own direction.
      * @param string the string to match
      * @param ranges, the start ranges to search, if
      * this range is empty the procedure must search in the whole index
@@ -394,22 +583,12 @@ class BiFMIndex : public FMIndex {
 
     /**
      * This function matches a string exactly starting from the empty string,
-     * while keeping track of the ranges in both directions
+     * while keeping track of the ranges in both directions. If a k-mer table
+     * is present, the first k characters are looked up in the table.
      * @param string the string to match
      * @returns the pair of ranges that matches string
      */
-    RangePair matchExactBidirectionally(const Substring& str) const {
-        return matchExactBidirectionally(
-            str, RangePair(0, textLength, 0, textLength));
-    }
-
-    /**
-     * Sets the search direction of the fm-index
-     * @param d the direction to search in, either FORWARD or BACKWARD
-     */
-    void setDirection(Direction d) {
-        dir = d;
-    }
+    RangePair matchExactBidirectionally(const Substring& str) const;
 
     // ============================================================================
     // INTEGRATION
@@ -418,6 +597,7 @@ class BiFMIndex : public FMIndex {
      * Matches a search recursively with a depth first approach (each branch
      * of the tree is fully examined until the backtracking condition is
      * met) using edit distance metric
+     * @param ctx, the context of this search, its direction is updated
      * @param s, the search to follow
      * @param startOcc, the approximate occurrence found for all previous parts
      * of the search
@@ -426,8 +606,77 @@ class BiFMIndex : public FMIndex {
      * @param parts the parts of the pattern, with correct direction
      * @param idx, the index of the part to match
      */
-    void recApproxMatch(const Search& s, const BiFMOcc& startOcc,
-                        std::vector<FMOcc>& occ,
-                        const std::vector<Substring>& parts, const int& idx);
+    void recApproxMatch(SearchContext& ctx, const Search& s,
+                        const BiFMOcc& startOcc, std::vector<FMOcc>& occ,
+                        const std::vector<Substring>& parts,
+                        const int& idx) const;
+
+  private:
+    /**
+     * The branch and bound search of recApproxMatch for one part
+     * @param matrix a BandedMatrix or BitParallelMatrix of the part, its
+     * origin holds the distance of the start occurrence
+     */
+    template <class Matrix>
+    void recApproxMatch(SearchContext& ctx, const Search& s,
+                        const BiFMOcc& startOcc, std::vector<FMOcc>& occ,
+                        const std::vector<Substring>& parts, const int& idx,
+                        Matrix& matrix) const;
+
+    /**
+     * Checks whether the candidates of a narrow node are verified in the
+     * text. A candidate that is extended to the right is located first,
+     * which takes up to the sparseness factor of LF steps, so if the current
+     * part or a later one is matched to the right, the candidates are only
+     * verified if at least that many characters of the pattern are left.
+     * @param s the search
+     * @param parts the parts of the pattern
+     * @param idx the index of the current part
+     * @param row the number of characters of the current part that are
+     * matched
+     */
+    bool verifyCandidates(const Search& s, const std::vector<Substring>& parts,
+                          int idx, length_t row) const {
+        length_t left = 0;
+        bool right = false;
+        for (int j = idx; j < (int)s.getNumParts(); j++) {
+            length_t size = parts[s.getPart(j)].size();
+            left += (j == idx) ? size - std::min(row, size) : size;
+            right |= s.getDirection(j) == FORWARD;
+        }
+        return !right || left >= sparseSA.getSparseness();
+    }
+
+    /**
+     * Continue a search in the text of a single candidate instead of the
+     * index (see FMIndex::setVerificationWidth), starting at the part at
+     * an index. The rows of the matrices are those of recApproxMatch along
+     * the single path of the text.
+     * @param ctx, the context of this search
+     * @param s, the search to follow
+     * @param cand the candidate of the matched string
+     * @param startED the distance of the matched string
+     * @param occ, the occurrences of the complete search are appended
+     * [output]
+     * @param parts the parts of the pattern, with correct direction
+     * @param idx, the index of the part to match
+     */
+    void verifyInText(SearchContext& ctx, const Search& s,
+                      const Candidate& cand, length_t startED,
+                      std::vector<FMOcc>& occ,
+                      const std::vector<Substring>& parts,
+                      const int& idx) const;
+
+    /**
+     * Continue the part at an index in the text
+     * @param row the row of the matrix of the last character of the
+     * candidate, the rows up to row are those of the matched string
+     * @param matrix a BandedMatrix or BitParallelMatrix of the part
+     */
+    template <class Matrix>
+    void verifyInText(SearchContext& ctx, const Search& s, Candidate cand,
+                      length_t row, Matrix& matrix, std::vector<FMOcc>& occ,
+                      const std::vector<Substring>& parts,
+                      const int& idx) const;
 };
 #endif
\ No newline at end of file
@@ -93,6 +93,11 @@ class Bitvec {
     std::vector<uint64_t> bv;     // actual bitvector
     std::vector<uint64_t> counts; // interleaved 1st and 2nd level counts
 
+    // The bits and counts are accessed through these pointers. They either
+    // point to the vectors above or into a memory-mapped index file.
+    const uint64_t* bvData;
+    const uint64_t* countsData;
+
   public:
     /**
      * Get a bit at a certain position
@@ -103,7 +108,7 @@ class Bitvec {
         assert(p < N);
         uint64_t w = p / 64;
         uint64_t b = p % 64;
-        return (bv[w] & (1ull << b)) != 0;
+        return (bvData[w] & (1ull << b)) != 0;
     }
 
     /**
@@ -136,6 +141,9 @@ class Bitvec {
                 countL2 += __builtin_popcountll(bv[w]);
             }
         }
+
+        bvData = bv.data();
+        countsData = counts.data();
     }
 
     /**
@@ -148,12 +156,31 @@ class Bitvec {
         return firstLevelCounts(p/64)+secondLevelCounts(p/64)+popcount(p/64, p);
     }
 
+    /**
+     * Get the number of 1-bits preceding two positions b <= e at once. When
+     * both positions fall in the same word, the counts are only looked up once.
+     * @param b First position
+     * @param e Second position
+     * @param rb rank(b) [output]
+     * @param re rank(e) [output]
+     */
+    void rankPair(uint64_t b, uint64_t e, uint64_t& rb, uint64_t& re) const {
+        assert(b <= e && e < N);
+        rb = rank(b);
+        if (b / 64 == e / 64) {
+            uint64_t bits = bvData[b / 64] >> (b % 64);
+            re = rb + __builtin_popcountll(bits & ((1ull << (e - b)) - 1));
+        } else {
+            re = rank(e);
+        }
+    }
+
     /**
      * Get the first level count
      * @param w the word index to get the first level count of
      */
     uint64_t firstLevelCounts(uint64_t w) const {
-        return counts[(w / 8) * 2];
+        return countsData[(w / 8) * 2];
     }
 
     /**
@@ -163,7 +190,7 @@ class Bitvec {
     uint64_t secondLevelCounts(uint64_t w) const {
         uint64_t q = (w / 8) * 2; // counts index
         int64_t t = (w % 8) - 1;
-        return counts[q + 1] >> (t + (t >> 60 & 8)) * 9 & 0x1FF;
+        return countsData[q + 1] >> (t + (t >> 60 & 8)) * 9 & 0x1FF;
     }
 
     /**
@@ -172,7 +199,7 @@ class Bitvec {
      * @param b the bit offset
      */
     uint64_t popcount(uint64_t w, uint64_t b) const {
-        return __builtin_popcountll((bv[w] << 1) << (63 - b));
+        return __builtin_popcountll((bvData[w] << 1) << (63 - b));
     }
 
     /**
@@ -181,8 +208,8 @@ class Bitvec {
      */
     void write(std::ofstream& ofs) const {
         ofs.write((char*)&N, sizeof(N));
-        ofs.write((char*)bv.data(), bv.size() * sizeof(uint64_t));
-        ofs.write((char*)counts.data(), counts.size() * sizeof(uint64_t));
+        ofs.write((char*)bvData, numWords() * sizeof(uint64_t));
+        ofs.write((char*)countsData, numCounts() * sizeof(uint64_t));
     }
 
     /**
@@ -197,6 +224,28 @@ class Bitvec {
 
         counts.resize((bv.size() + 7) / 4);
         ifs.read((char*)counts.data(), counts.size() * sizeof(uint64_t));
+
+        bvData = bv.data();
+        countsData = counts.data();
+    }
+
+    /**
+     * Let the bitvector point to a memory region that was written by write().
+     * No data is copied, the memory region must outlive the bitvector.
+     * @param ptr Pointer to the serialized bitvector, on return it points
+     * past the bitvector
+     */
+    void map(const char*& ptr) {
+        N = *(const uint64_t*)ptr;
+        ptr += sizeof(N);
+
+        bv.clear();
+        counts.clear();
+
+        bvData = (const uint64_t*)ptr;
+        ptr += numWords() * sizeof(uint64_t);
+        countsData = (const uint64_t*)ptr;
+        ptr += numCounts() * sizeof(uint64_t);
     }
 
     /**
@@ -207,10 +256,24 @@ class Bitvec {
         return N;
     }
 
+    /**
+     * Return the number of 64-bit words used to store the bits
+     */
+    uint64_t numWords() const {
+        return (N + 63) / 64;
+    }
+
+    /**
+     * Return the number of 64-bit words used to store the rank counts
+     */
+    uint64_t numCounts() const {
+        return (numWords() + 7) / 4;
+    }
+
     /**
      * Default constructor, move constructor and move assignment operator
      */
-    Bitvec() : N(0){};
+    Bitvec() : N(0), bvData(nullptr), countsData(nullptr){};
     Bitvec(Bitvec&& rhs) = default;
     Bitvec& operator=(Bitvec&& rhs) = default;
 
@@ -224,7 +287,9 @@ class Bitvec {
      * Constructor
      * @param N Number of bits in the bitvector
      */
-    Bitvec(uint64_t N) : N(N), bv((N + 63) / 64, 0ull) {
+    Bitvec(uint64_t N)
+        : N(N), bv((N + 63) / 64, 0ull), bvData(bv.data()),
+          countsData(nullptr) {
     }
 };
 
@@ -0,0 +1,98 @@
+#include "bidirectionalfmindex.h"
+#include "sais.h"
+#include <chrono>
+
+using namespace std;
+
+void showUsage() {
+    cout << "Usage: fmindex-build <base> [sa_sparse] [layout] [kmer_k] "
+            "[kmer_mb] [sampling]\n\n";
+    cout << "Constructs the suffix arrays of <base>.txt and of its reverse and "
+            "writes the\nindex files <base>.fmi and <base>.rev.fmi. If "
+            "<base>.txt does not exist, the\nsequences of the multi-FASTA "
+            "file <base>.fasta are concatenated into <base>.txt\nand their "
+            "names and lengths are written to <base>.contigs\n\n";
+    cout << "  sa_sparse  sparseness factor of the suffix array (default 32)\n";
+    cout << "  layout     layout of the occurrence table: bitvectors (default) "
+            "or\n             interleaved\n";
+    cout << "  kmer_k     length of the k-mers in the k-mer lookup table, 0 "
+            "for no table\n             (default 0)\n";
+    cout << "  kmer_mb    memory budget of the k-mer lookup table in MiB, k is "
+            "lowered\n             until the table fits (default 1024)\n";
+    cout << "  sampling   sampling of the suffix array: index (default, every "
+            "sa_sparse'th\n             row) or text (every sa_sparse'th text "
+            "position, bounds the\n             cost of a locate)"
+         << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 7) {
+        showUsage();
+        return EXIT_FAILURE;
+    }
+
+    string base = argv[1];
+    int saSparse = (argc >= 3) ? atoi(argv[2]) : 32;
+    string layoutName = (argc >= 4) ? argv[3] : "bitvectors";
+    int kmerK = (argc >= 5) ? atoi(argv[4]) : 0;
+    int kmerMB = (argc >= 6) ? atoi(argv[5]) : 1024;
+    string samplingName = (argc >= 7) ? argv[6] : "index";
+    if (saSparse <= 0 || kmerK < 0 || kmerK > 16 || kmerMB < 0 ||
+        (layoutName != "bitvectors" && layoutName != "interleaved") ||
+        (samplingName != "index" && samplingName != "text")) {
+        showUsage();
+        return EXIT_FAILURE;
+    }
+    OccTableLayout layout =
+        (layoutName == "interleaved") ? INTERLEAVED : BITVECTORS;
+    SASampling sampling =
+        (samplingName == "text") ? SAMPLE_TEXT_POSITION : SAMPLE_SA_INDEX;
+
+    auto start = chrono::high_resolution_clock::now();
+
+    string text;
+    if (!readText(base + ".txt", text)) {
+        ifstream ifs(base + ".fasta");
+        if (!ifs)
+            throw runtime_error("Problem reading: " + base + ".txt or " +
+                                base + ".fasta");
+        printInfo("Reading: " + base + ".fasta", true);
+        ContigTable contigs;
+        ContigTable::parseFasta(ifs, text, contigs);
+        printDone(true);
+        cout << "Number of contigs: " << contigs.size() << endl;
+
+        ofstream ofs(base + ".txt");
+        ofs << text;
+        if (!ofs || !contigs.write(base + ".contigs"))
+            throw runtime_error("Problem writing: " + base + ".txt or " +
+                                base + ".contigs");
+    }
+    if (!text.empty() && text.back() == '\n')
+        text.pop_back();
+    if (text.empty() || text.back() != '$')
+        throw runtime_error(base + ".txt should end with '$'");
+
+    printInfo("Constructing suffix arrays", true);
+    vector<length_t> sa, revSA;
+    sais::constructSAs(text, sa, revSA);
+    printDone(true);
+
+    BiFMIndex index(base, sa, revSA, saSparse, true, layout, sampling);
+
+    if (kmerK > 0) {
+        printInfo("Creating k-mer lookup table", true);
+        index.createKmerTable(kmerK, (uint64_t)kmerMB << 20);
+        printDone(true);
+        cout << "k-mer lookup table: k = " << index.getKmerTable().getK()
+             << endl;
+    }
+
+    printInfo("Writing: " + base + ".fmi and " + base + ".rev.fmi", true);
+    index.write(base);
+    printDone(true);
+
+    auto finish = chrono::high_resolution_clock::now();
+    chrono::duration<double> elapsed = finish - start;
+    cout << "Total duration: " << fixed << elapsed.count() << "s\n";
+}
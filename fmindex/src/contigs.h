@@ -0,0 +1,204 @@
+#ifndef CONTIGS_H
+#define CONTIGS_H
+
+/**
+ * The sequences (contigs) of a multi-sequence reference. The contigs are
+ * concatenated into a single text (followed by '$'), the contig table stores
+ * the name and start position of every contig and maps a text position to
+ * (contig, offset) in constant time.
+ *
+ * The mapping uses a directory with one entry per bucket of 2^shift text
+ * positions, holding the contig that contains the first position of the
+ * bucket. The bucket size is chosen such that there are about as many buckets
+ * as contigs, so a lookup only has to skip the (on average at most one)
+ * contig starts inside a bucket.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+
+class ContigTable {
+  private:
+    std::vector<std::string> names; // the name of each contig
+    std::vector<length_t> starts;   // the start of each contig (+ total)
+    length_t shift;                 // log2 of the bucket size
+    std::vector<length_t> directory; // the contig of each bucket start
+
+  public:
+    /**
+     * Default constructor, no contigs
+     */
+    ContigTable() : starts(1, 0), shift(0) {
+    }
+
+    /**
+     * Append a contig to the end of the concatenated text. Call index()
+     * after the last contig is added.
+     * @param name the name of the contig
+     * @param length the length of the contig
+     */
+    void add(const std::string& name, length_t length) {
+        names.push_back(name);
+        starts.push_back(starts.back() + length);
+    }
+
+    /**
+     * Build the directory for findContig()
+     */
+    void index() {
+        length_t total = getTotalLength();
+        shift = 0;
+        while ((total >> shift) > size())
+            shift++;
+
+        directory.resize((total >> shift) + 1);
+        length_t j = 0;
+        for (length_t b = 0; b < directory.size(); b++) {
+            while (j + 1 < size() && starts[j + 1] <= (b << shift))
+                j++;
+            directory[b] = j;
+        }
+    }
+
+    /**
+     * Get the number of contigs
+     */
+    length_t size() const {
+        return names.size();
+    }
+
+    /**
+     * Get the total length of the contigs (without the '$')
+     */
+    length_t getTotalLength() const {
+        return starts.back();
+    }
+
+    const std::string& getName(length_t id) const {
+        return names[id];
+    }
+
+    length_t getStart(length_t id) const {
+        return starts[id];
+    }
+
+    length_t getLength(length_t id) const {
+        return starts[id + 1] - starts[id];
+    }
+
+    /**
+     * Get the contig that contains a text position
+     * @param pos the position in the text, smaller than getTotalLength()
+     * @returns the index of the contig
+     */
+    length_t findContig(length_t pos) const {
+        assert(pos < getTotalLength());
+        length_t j = directory[pos >> shift];
+        while (starts[j + 1] <= pos)
+            j++;
+        return j;
+    }
+
+    /**
+     * Check if a range of the text lies within a single contig
+     * @param begin the begin of the range
+     * @param end the end of the range (non-inclusive)
+     * @returns true if the range is not empty and lies within one contig
+     */
+    bool inSingleContig(length_t begin, length_t end) const {
+        if (begin >= end || end > getTotalLength())
+            return false;
+        return end <= starts[findContig(begin) + 1];
+    }
+
+    /**
+     * Write the contig table to a file, one "name<TAB>length" line per contig
+     * @param filename the name of the file
+     * @returns true if successful
+     */
+    bool write(const std::string& filename) const {
+        std::ofstream ofs(filename);
+        if (!ofs)
+            return false;
+        for (length_t i = 0; i < size(); i++)
+            ofs << names[i] << '\t' << getLength(i) << '\n';
+        return (bool)ofs;
+    }
+
+    /**
+     * Read a contig table that was written by write()
+     * @param filename the name of the file
+     * @returns false if the file does not exist
+     */
+    bool read(const std::string& filename) {
+        std::ifstream ifs(filename);
+        if (!ifs)
+            return false;
+
+        *this = ContigTable();
+        std::string line;
+        while (std::getline(ifs, line)) {
+            size_t tab = line.rfind('\t');
+            if (line.empty() || tab == std::string::npos)
+                continue;
+            add(line.substr(0, tab), std::stoul(line.substr(tab + 1)));
+        }
+        index();
+        return true;
+    }
+
+    /**
+     * Read a multi-FASTA file and concatenate its sequences. Lowercase
+     * characters are converted to uppercase and characters other than A, C,
+     * G and T (e.g. N) are replaced by a pseudo-random base, such that they
+     * do not create long artificial repeats.
+     * @param is the input stream with the FASTA records
+     * @param text the concatenated sequences, followed by '$' [output]
+     * @param contigs the contig table of the sequences [output]
+     */
+    static void parseFasta(std::istream& is, std::string& text,
+                           ContigTable& contigs) {
+        static const char bases[] = "ACGT";
+        std::minstd_rand rng(0);
+
+        contigs = ContigTable();
+        text.clear();
+        std::string line, name;
+        length_t begin = 0;
+        bool inRecord = false;
+        while (std::getline(is, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty() && line[0] == '>') {
+                if (inRecord)
+                    contigs.add(name, text.size() - begin);
+                // the name is the first word of the header
+                name = line.substr(1, line.find_first_of(" \t") - 1);
+                begin = text.size();
+                inRecord = true;
+                continue;
+            }
+            if (!inRecord)
+                continue;
+            for (char c : line) {
+                c = toupper(c);
+                if (c != 'A' && c != 'C' && c != 'G' && c != 'T')
+                    c = bases[rng() & 3];
+                text.push_back(c);
+            }
+        }
+        if (inRecord)
+            contigs.add(name, text.size() - begin);
+
+        text.push_back('$');
+        contigs.index();
+    }
+};
+
+#endif
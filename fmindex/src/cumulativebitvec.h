@@ -76,6 +76,29 @@ class CumulativeBitvectors { // e.g. S = 5 for DNA (A,C,G,T + $)
             bv.index();
     }
 
+    /**
+     * Write the bitvectors to an open filestream
+     * @param ofs Open output filestream
+     */
+    void write(std::ofstream& ofs) const {
+        uint64_t dp = dollarPos;
+        ofs.write((char*)&dp, sizeof(dp));
+        for (const auto& bv : bvs)
+            bv.write(ofs);
+    }
+
+    /**
+     * Let the bitvectors point to a memory region that was written by
+     * write(). No data is copied, the memory region must outlive this object.
+     * @param ptr Pointer to the serialized bitvectors
+     */
+    void map(const char* ptr) {
+        dollarPos = *(const uint64_t*)ptr;
+        ptr += sizeof(uint64_t);
+        for (auto& bv : bvs)
+            bv.map(ptr);
+    }
+
     /**
      * Get occurrence count of character c in the range BWT[0...j[
      * @param cIdx Character index
@@ -87,7 +110,10 @@ class CumulativeBitvectors { // e.g. S = 5 for DNA (A,C,G,T + $)
         // Hence, use index cIdx-1 in the bitvector.
 
         // 3 - 6 lines of code
-        throw std::runtime_error("occ has not been implemented yet!");
+        if (cIdx == 0)
+            return (j > dollarPos) ? 1 : 0;
+        size_t r = bvs[cIdx - 1].rank(j);
+        return (cIdx == 1) ? r : r - bvs[cIdx - 2].rank(j);
     }
 
     /**
@@ -102,7 +128,35 @@ class CumulativeBitvectors { // e.g. S = 5 for DNA (A,C,G,T + $)
         // Hence, use index cIdx-1 in the bitvector.
 
         // 3 - 6 lines of code
-        throw std::runtime_error("cumulocc has not been implemented yet!");
+        if (cIdx == 0)
+            return 0;
+        size_t r = (j > dollarPos) ? 1 : 0;
+        return (cIdx == 1) ? r : r + bvs[cIdx - 2].rank(j);
+    }
+
+    /**
+     * Get the cumulative occurrence counts of all characters at two positions
+     * b <= e at once. cumB[c] equals cumulocc(c, b) for c < S and
+     * cumB[S] equals b (idem for cumE and e). Hence, occ(c, b) equals
+     * cumB[c + 1] - cumB[c].
+     * @param b First position
+     * @param e Second position
+     * @param cumB cumulative counts at b [output]
+     * @param cumE cumulative counts at e [output]
+     */
+    void cumuloccAll(size_t b, size_t e, std::array<size_t, S + 1>& cumB,
+                     std::array<size_t, S + 1>& cumE) const {
+        cumB[0] = cumE[0] = 0;
+        size_t dollarB = (b > dollarPos) ? 1 : 0;
+        size_t dollarE = (e > dollarPos) ? 1 : 0;
+        for (size_t cIdx = 1; cIdx < S; cIdx++) {
+            uint64_t rb, re;
+            bvs[cIdx - 1].rankPair(b, e, rb, re);
+            cumB[cIdx + 1] = rb + dollarB;
+            cumE[cIdx + 1] = re + dollarE;
+        }
+        cumB[1] = dollarB;
+        cumE[1] = dollarE;
     }
 };
 
@@ -1,71 +1,57 @@
 #include "bandmatrix.h"
 #include "bidirectionalfmindex.h"
+#include "fastxreader.h"
 #include "searchscheme.h"
 #include <chrono>
 
 using namespace std;
 
-vector<pair<string, string>> getPairedReads(const string& base) {
-    ifstream ifs(base + ".reads.fasta");
-    if (!ifs)
-        throw runtime_error("Problem reading: " + base + ".reads.fasta");
-
-    string line;
-    bool first = true;
-    vector<pair<string, string>> pairedReads;
-
-    while (getline(ifs, line)) {
-        if (line[0] == '>')
-            continue;
-        if (first)
-            pairedReads.emplace_back(line, "");
-        else
-            pairedReads.back().second = line;
-        first = !first;
-    }
-
-    return pairedReads;
-}
-
 int main(int argc, char* argv[]) {
 
     string base = "../testset/CP001363";
     BiFMIndex bifmindex = BiFMIndex(base, 32, true);
     string text = bifmindex.getText();
 
-    const auto reads = getPairedReads(base + "errors");
+    // the paired reads are interleaved in <base>errors.reads.fasta, they are
+    // streamed in batches of 1024 pairs
+    ReadInput reads(base + "errors.reads.fasta", true);
+    ReadBatch batch;
+    string read;
 
     length_t i = 0;
 
     auto start = chrono::high_resolution_clock::now();
 
-    for (const auto& read : reads) {
-
-        if (i % 16 == 0) {
-            cout << "Progress: " << i << "/" << reads.size() * 2 << "\r";
-            cout.flush();
+    while (reads.nextBatch(batch, 1024)) {
+        for (length_t j = 0; j < batch.size(); j++) {
+            if (i % 16 == 0) {
+                cout << "Progress: " << i << "\r";
+                cout.flush();
+            }
+            ReadRecord r = batch[j];
+            read.assign(r.seq, r.seqLength);
+            bifmindex.naiveApproxMatch(read, 4);
+
+            i++;
         }
-        bifmindex.naiveApproxMatch(read.first, 4);
-        bifmindex.naiveApproxMatch(read.second, 4);
-
-        i += 2;
     }
 
     /*   SearchScheme ss(bifmindex, "../search_schemes/pigeon/", 4);
-      for (const auto& read : reads) {
-
-          if (i % 16 == 0) {
-              cout << "Progress: " << i << "/" << reads.size() * 2 << "\r";
-              cout.flush();
+      while (reads.nextBatch(batch, 1024)) {
+          for (length_t j = 0; j < batch.size(); j++) {
+              if (i % 16 == 0) {
+                  cout << "Progress: " << i << "\r";
+                  cout.flush();
+              }
+              ReadRecord r = batch[j];
+              ss.matchApprox(string(r.seq, r.seqLength));
+
+              i++;
           }
-          ss.matchApprox(read.first);
-          ss.matchApprox(read.second);
-
-          i += 2;
       } */
 
     auto finish = chrono::high_resolution_clock::now();
     chrono::duration<double> elapsed = finish - start;
-    cout << "Progress: " << reads.size() * 2 << "/" << reads.size() * 2 << "\n";
+    cout << "Progress: " << i << "/" << i << "\n";
     cout << "Total duration: " << fixed << elapsed.count() << "s\n";
 }
@@ -0,0 +1,383 @@
+#ifndef FASTXREADER_H
+#define FASTXREADER_H
+
+/**
+ * Streaming reader for FASTA and FASTQ read files. The input is read in
+ * large chunks into a reusable buffer and parsed in place. Records are copied
+ * into a ReadBatch, which holds a fixed number of records in one reusable
+ * character array and hands them out as lightweight views (ReadRecord). A
+ * batch that is refilled does not allocate once it has grown to the size of
+ * the largest batch, so the memory usage does not depend on the size of the
+ * input.
+ *
+ * Paired-end reads are read from two files (one per mate) or from a single
+ * interleaved file, the mates of a pair are consecutive records in a batch.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+
+/**
+ * A view of a record in a ReadBatch. The pointers are valid until the batch
+ * is cleared or refilled.
+ */
+struct ReadRecord {
+    const char* name;    // the first word of the header
+    length_t nameLength; // the length of the name
+    const char* seq;     // the sequence
+    length_t seqLength;  // the length of the sequence
+    const char* qual;    // the qualities (FASTQ only)
+    length_t qualLength; // the length of the qualities, 0 for FASTA
+
+    std::string getName() const {
+        return std::string(name, nameLength);
+    }
+
+    std::string getSequence() const {
+        return std::string(seq, seqLength);
+    }
+
+    std::string getQualities() const {
+        return std::string(qual, qualLength);
+    }
+};
+
+/**
+ * A batch of records that share one character array
+ */
+class ReadBatch {
+  private:
+    // the offsets of a record in data
+    struct Offsets {
+        size_t name, nameLength, seq, seqLength, qual, qualLength;
+    };
+
+    std::vector<char> data;       // the names, sequences and qualities
+    std::vector<Offsets> records; // the records in the batch
+    size_t id;                    // the index of the batch in the input
+    bool paired;                  // records 2i and 2i + 1 are mates
+
+    friend class FastxReader;
+
+  public:
+    ReadBatch() : id(0), paired(false) {
+    }
+
+    /**
+     * Remove all records, the memory is kept for the next batch
+     */
+    void clear() {
+        data.clear();
+        records.clear();
+    }
+
+    /**
+     * Get the number of records (twice the number of pairs for paired
+     * reads)
+     */
+    size_t size() const {
+        return records.size();
+    }
+
+    bool empty() const {
+        return records.empty();
+    }
+
+    size_t getID() const {
+        return id;
+    }
+
+    void setID(size_t id) {
+        this->id = id;
+    }
+
+    bool isPaired() const {
+        return paired;
+    }
+
+    void setPaired(bool paired) {
+        this->paired = paired;
+    }
+
+    /**
+     * Get a view of a record
+     * @param i the index of the record
+     */
+    ReadRecord operator[](size_t i) const {
+        const Offsets& o = records[i];
+        const char* d = data.data();
+        return ReadRecord{d + o.name, (length_t)o.nameLength,
+                          d + o.seq,  (length_t)o.seqLength,
+                          d + o.qual, (length_t)o.qualLength};
+    }
+};
+
+/**
+ * Reader for a single FASTA or FASTQ file. The format is detected per record
+ * from the first character of the header ('>' or '@'). FASTA sequences can
+ * span multiple lines, FASTQ records have the sequence and the qualities on
+ * a single line.
+ */
+class FastxReader {
+  private:
+    std::unique_ptr<std::istream> owned; // the stream if opened by the reader
+    std::istream* is;                    // the input stream
+    std::string source;                  // the name of the input for errors
+
+    std::vector<char> buffer; // the buffer with the unparsed input
+    size_t begin, end;        // the unparsed part of the buffer
+    bool eof;                 // true if the whole input is in the buffer
+
+    /**
+     * Move the unparsed input to the start of the buffer and read the next
+     * chunk of the input after it. The buffer is doubled if it is full.
+     * @returns false if no more input could be read
+     */
+    bool fill() {
+        if (eof)
+            return false;
+        if (begin > 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (end == buffer.size())
+            buffer.resize(2 * buffer.size());
+
+        is->read(buffer.data() + end, buffer.size() - end);
+        size_t n = is->gcount();
+        end += n;
+        if (!*is) {
+            if (!is->eof())
+                throw std::runtime_error("Problem reading: " + source);
+            eof = true;
+        }
+        return n > 0;
+    }
+
+    /**
+     * Get the next line of the input, without the line ending. The view is
+     * valid until the next call.
+     * @param line the start of the line [output]
+     * @param length the length of the line [output]
+     * @returns false if the end of the input is reached
+     */
+    bool nextLine(const char*& line, size_t& length) {
+        size_t searched = begin;
+        while (true) {
+            const char* nl = (const char*)std::memchr(
+                buffer.data() + searched, '\n', end - searched);
+            if (nl != nullptr) {
+                line = buffer.data() + begin;
+                length = nl - line;
+                begin = nl - buffer.data() + 1;
+                break;
+            }
+            // fill() moves the unparsed input to the start of the buffer
+            size_t scanned = end - begin;
+            if (!fill()) {
+                // the last line of the input has no line ending
+                if (begin == end)
+                    return false;
+                line = buffer.data() + begin;
+                length = end - begin;
+                begin = end;
+                break;
+            }
+            searched = begin + scanned;
+        }
+        if (length > 0 && line[length - 1] == '\r')
+            length--;
+        return true;
+    }
+
+    /**
+     * Get the next character of the input without consuming it
+     * @returns the character, or EOF at the end of the input
+     */
+    int peek() {
+        if (begin == end && !fill())
+            return EOF;
+        return buffer[begin];
+    }
+
+    /**
+     * Append characters to the data of a batch
+     * @returns the offset of the characters in the data
+     */
+    static size_t append(ReadBatch& batch, const char* s, size_t length) {
+        size_t offset = batch.data.size();
+        batch.data.insert(batch.data.end(), s, s + length);
+        return offset;
+    }
+
+  public:
+    /**
+     * Constructor, opens a file
+     * @param filename the name of the file
+     * @param bufferSize the initial size of the input buffer in bytes
+     */
+    FastxReader(const std::string& filename, size_t bufferSize = 1 << 22)
+        : owned(new std::ifstream(filename, std::ios::binary)),
+          is(owned.get()), source(filename), buffer(bufferSize), begin(0),
+          end(0), eof(false) {
+        if (!*is)
+            throw std::runtime_error("Problem reading: " + filename);
+    }
+
+    /**
+     * Constructor, reads from a stream that outlives the reader
+     * @param is the input stream
+     * @param bufferSize the initial size of the input buffer in bytes
+     */
+    FastxReader(std::istream& is, size_t bufferSize = 1 << 22)
+        : is(&is), source("input stream"),
+          buffer(std::max<size_t>(bufferSize, 1)), begin(0), end(0),
+          eof(false) {
+    }
+
+    /**
+     * Read the next record and append it to a batch
+     * @param batch the batch [output]
+     * @returns false if there are no more records
+     * @throws runtime_error if the input is not valid FASTA or FASTQ
+     */
+    bool read(ReadBatch& batch) {
+        const char* line;
+        size_t length;
+        do {
+            if (!nextLine(line, length))
+                return false;
+        } while (length == 0);
+
+        if (line[0] != '>' && line[0] != '@')
+            throw std::runtime_error("Expected a FASTA or FASTQ header in " +
+                                     source + ": " +
+                                     std::string(line, length));
+        bool fastq = (line[0] == '@');
+
+        ReadBatch::Offsets o;
+        size_t nameLength = 1;
+        while (nameLength < length && line[nameLength] != ' ' &&
+               line[nameLength] != '\t')
+            nameLength++;
+        o.name = append(batch, line + 1, nameLength - 1);
+        o.nameLength = nameLength - 1;
+
+        o.seq = batch.data.size();
+        if (fastq) {
+            if (!nextLine(line, length))
+                throw std::runtime_error("Truncated FASTQ record in " +
+                                         source);
+            append(batch, line, length);
+            o.seqLength = length;
+
+            if (!nextLine(line, length) || length == 0 || line[0] != '+')
+                throw std::runtime_error("Expected '+' in FASTQ record in " +
+                                         source);
+            if (!nextLine(line, length) || length != o.seqLength)
+                throw std::runtime_error("Qualities and sequence have a "
+                                         "different length in " +
+                                         source);
+            o.qual = append(batch, line, length);
+            o.qualLength = length;
+        } else {
+            // the sequence ends at the next header
+            while (peek() != '>' && peek() != '@' && peek() != EOF) {
+                nextLine(line, length);
+                append(batch, line, length);
+            }
+            o.seqLength = batch.data.size() - o.seq;
+            o.qual = batch.data.size();
+            o.qualLength = 0;
+        }
+
+        batch.records.push_back(o);
+        return true;
+    }
+};
+
+/**
+ * The read input of a mapper: single-end reads from one file, or paired-end
+ * reads from two files or from one interleaved file
+ */
+class ReadInput {
+  private:
+    FastxReader first;                   // the (first mates of the) reads
+    std::unique_ptr<FastxReader> second; // the second mates (two files)
+    bool paired;                         // paired-end input
+    size_t nextID;                       // the index of the next batch
+
+  public:
+    /**
+     * Constructor for single-end or interleaved paired-end reads
+     * @param filename the FASTA or FASTQ file
+     * @param interleaved true if the mates of a pair are consecutive records
+     */
+    ReadInput(const std::string& filename, bool interleaved = false)
+        : first(filename), paired(interleaved), nextID(0) {
+    }
+
+    /**
+     * Constructor for paired-end reads in two files
+     * @param filename1 the FASTA or FASTQ file with the first mates
+     * @param filename2 the FASTA or FASTQ file with the second mates
+     */
+    ReadInput(const std::string& filename1, const std::string& filename2)
+        : first(filename1), second(new FastxReader(filename2)), paired(true),
+          nextID(0) {
+    }
+
+    /**
+     * Constructor for single-end or interleaved paired-end reads from a
+     * stream that outlives the input
+     */
+    ReadInput(std::istream& is, bool interleaved = false,
+              size_t bufferSize = 1 << 22)
+        : first(is, bufferSize), paired(interleaved), nextID(0) {
+    }
+
+    bool isPaired() const {
+        return paired;
+    }
+
+    /**
+     * Refill a batch with the next reads or pairs of the input. The batches
+     * are numbered consecutively.
+     * @param batch the batch, its previous records are removed [output]
+     * @param maxReads the maximal number of reads (pairs for paired input)
+     * @returns false if there are no more reads
+     * @throws runtime_error if the input is not valid or a mate is missing
+     */
+    bool nextBatch(ReadBatch& batch, size_t maxReads) {
+        batch.clear();
+        batch.setPaired(paired);
+        for (size_t i = 0; i < maxReads; i++) {
+            if (!first.read(batch))
+                break;
+            if (!paired)
+                continue;
+            FastxReader& mates = second ? *second : first;
+            if (!mates.read(batch))
+                throw std::runtime_error("Missing mate of the last pair");
+        }
+        if (second && batch.size() < 2 * maxReads && second->read(batch))
+            throw std::runtime_error("Missing mate of the last pair");
+
+        if (batch.empty())
+            return false;
+        batch.setID(nextID++);
+        return true;
+    }
+};
+
+#endif
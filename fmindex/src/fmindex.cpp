@@ -1,6 +1,10 @@
 #include "fmindex.h"
 
 #include "bandmatrix.h"
+#include "pairing.h"
+#include "sais.h"
+#include "searchstack.h"
+#include <cstring>
 #include <fstream>
 
 using namespace std;
@@ -24,7 +28,8 @@ ostream& operator<<(ostream& os, const FMPos& p) {
 }
 
 ostream& operator<<(ostream& os, const FMOcc& o) {
-    os << "FMOcc(" << o.pos << ", " << o.distance << ")";
+    os << "FMOcc(" << o.pos << ", " << o.distance
+       << (o.located ? ", located" : "") << ")";
     return os;
 }
 // ============================================================================
@@ -80,6 +85,13 @@ void readSA(const string& filename, vector<length_t>& sa, size_t saSizeHint) {
         sa.resize(ifs.tellg() / sizeof(length_t));
         ifs.seekg(0, ios::beg);
         ifs.read((char*)sa.data(), sa.size() * sizeof(length_t));
+    } else if (sizeof(length_t) != sizeof(uint32_t) &&
+               (size_t)ifs.tellg() == saSizeHint * sizeof(uint32_t)) {
+        // binary file with 32-bit entries, widen them
+        vector<uint32_t> narrow(saSizeHint);
+        ifs.seekg(0, ios::beg);
+        ifs.read((char*)narrow.data(), narrow.size() * sizeof(uint32_t));
+        sa.assign(narrow.begin(), narrow.end());
     } else { // try to read SA in text mode
         readSATextMode(filename, sa, saSizeHint);
     }
@@ -91,10 +103,23 @@ void readSA(const string& filename, vector<length_t>& sa, size_t saSizeHint) {
 
 void FMIndex::createBWTFromSA(const vector<length_t>& sa) {
     // 5-10 lines of code
-    bwt.resize(sa.size());
+    bwtStorage.resize(sa.size());
     for (size_t i=0; i<sa.size(); i++){
-        bwt[i] = sa[i] > 0 ? text[sa[i]-1] : '$';
+        bwtStorage[i] = sa[i] > 0 ? text[sa[i]-1] : '$';
+    }
+    bwt = bwtStorage.data();
+}
+
+uint64_t FMIndex::checksum(const char* data, size_t n) {
+    // multiply-xorshift over 8 bytes at a time, the tail is zero padded
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    for (size_t i = 0; i < n; i += 8) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, min<size_t>(8, n - i));
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
     }
+    return h;
 }
 
 void FMIndex::createCounts() {
@@ -118,8 +143,7 @@ void printDone(bool verbose) {
         cout << "done" << endl;
 }
 
-void FMIndex::read(const string& base, bool verbose) {
-    // read the text
+void FMIndex::readTextFile(const string& base, bool verbose) {
     printInfo("Reading: " + base + ".txt", verbose);
 
     if (!readText(base + ".txt", text))
@@ -127,16 +151,48 @@ void FMIndex::read(const string& base, bool verbose) {
 
     textLength =
         (text[text.size() - 1] == '\n') ? text.size() - 1 : text.size();
+    textChecksum = checksum(text.data(), textLength);
 
     printDone(verbose);
 
-    // read the suffix array
-    printInfo("Reading: " + base + ".sa", verbose);
+    if (contigs.read(base + ".contigs")) {
+        if (contigs.getTotalLength() + 1 != textLength)
+            throw runtime_error(base + ".contigs does not match " + base +
+                                ".txt");
+    } else {
+        contigs = ContigTable();
+        contigs.add(base.substr(base.find_last_of('/') + 1), textLength - 1);
+        contigs.index();
+    }
+}
+
+void FMIndex::read(const string& base, bool verbose) {
+    // read the text
+    readTextFile(base, verbose);
+
+    // use the prebuilt index if available
+    if (readIndexFile(base + ".fmi", verbose)) {
+        printInfo("FMIndex construction successful", verbose);
+        if (verbose)
+            cout << endl;
+        return;
+    }
 
+    // read the suffix array or construct it if it is not available
     vector<length_t> SA;
-    readSA(base + ".sa", SA, textLength);
+    if (ifstream(base + ".sa")) {
+        printInfo("Reading: " + base + ".sa", verbose);
+        readSA(base + ".sa", SA, textLength);
+    } else {
+        printInfo("Constructing suffix array", verbose);
+        sais::constructSA(text.substr(0, textLength), SA);
+    }
     printDone(verbose);
 
+    createFromSA(SA, verbose);
+}
+
+void FMIndex::createFromSA(const vector<length_t>& SA, bool verbose) {
     printInfo("Creating sparse suffix array", verbose);
     sparseSA.createSparseSA(SA);
     printDone(verbose);
@@ -145,7 +201,7 @@ void FMIndex::read(const string& base, bool verbose) {
     createBWTFromSA(SA);
     printDone(verbose);
 
-    dollarPos = distance(bwt.begin(), find(bwt.begin(), bwt.end(), '$'));
+    dollarPos = find(bwt, bwt + textLength, '$') - bwt;
 
     // create ALPHABET from text
     sigma = Alphabet<ALPHABET>(text);
@@ -159,23 +215,28 @@ void FMIndex::read(const string& base, bool verbose) {
     printDone(verbose);
 
     // create the occTable
-    // Initialize the bitvectors with size BWT.size()
     printInfo("Create Occ table", verbose);
-    occTable.resize(ALPHABET - 1);
-
-    for (auto& bv : occTable)
-        bv = Bitvec(textLength + 1);
-
-    for (size_t i = 0; i < bwt.size(); i++) {
-        char c = bwt[i];
-        if (c != '$') {
-            occTable[sigma.c2i(c) - 1][i] = true;
+    if (layout == INTERLEAVED) {
+        interleavedOccTable =
+            InterleavedOccTable(sigma, string(bwt, textLength));
+    } else {
+        // Initialize the bitvectors with size BWT.size()
+        occTable.resize(ALPHABET - 1);
+
+        for (auto& bv : occTable)
+            bv = Bitvec(textLength + 1);
+
+        for (size_t i = 0; i < textLength; i++) {
+            char c = bwt[i];
+            if (c != '$') {
+                occTable[sigma.c2i(c) - 1][i] = true;
+            }
         }
-    }
 
-    // index the bitvectors
-    for (auto& bv : occTable)
-        bv.index();
+        // index the bitvectors
+        for (auto& bv : occTable)
+            bv.index();
+    }
 
     printDone(verbose);
     printInfo("FMIndex construction successful", verbose);
@@ -183,6 +244,130 @@ void FMIndex::read(const string& base, bool verbose) {
         cout << endl;
 }
 
+bool FMIndex::readIndexFile(const string& filename, bool verbose) {
+    if (!indexFile.open(filename))
+        return false;
+
+    printInfo("Mapping: " + filename, verbose);
+
+    // the index file must match the text (its length and checksum, files
+    // without a checksum are rejected), the alphabet and the width of
+    // length_t (files without a width are 32 bit)
+    size_t paramsSize;
+    const uint64_t* params =
+        (const uint64_t*)indexFile.section("PARAMS", paramsSize);
+    uint64_t width = (paramsSize >= 5 * sizeof(uint64_t)) ? params[4] : 4;
+    bool sameText = paramsSize >= 6 * sizeof(uint64_t) &&
+                    params[1] == textLength && params[5] == textChecksum;
+    if (params[0] != ALPHABET || !sameText || width != sizeof(length_t))
+        throw runtime_error(filename + " does not match the text, the "
+                            "alphabet or the index width, rebuild it with "
+                            "fmindex-build");
+
+    // the layout of the occurrence table and the sparseness and sampling of
+    // the suffix array are those of the file, not those of the constructor
+    layout = indexFile.hasSection("IOCC") ? INTERLEAVED : BITVECTORS;
+    SASampling sampling = indexFile.hasSection("TSSA") ? SAMPLE_TEXT_POSITION
+                                                       : SAMPLE_SA_INDEX;
+    dollarPos = params[2];
+
+    // alphabet and counts
+    const char* chars = indexFile.section("ALPHA");
+    vector<length_t> charCounts(NUM_CHAR, 0);
+    for (size_t i = 0; i < ALPHABET; i++)
+        charCounts[(unsigned char)chars[i]] = 1;
+    sigma = Alphabet<ALPHABET>(charCounts);
+
+    memcpy(counts.data(), indexFile.section("COUNTS"), sizeof(counts));
+
+    // the BWT, occTable and sparse suffix array point into the mapped file
+    bwtStorage.clear();
+    bwt = indexFile.section("BWT");
+
+    if (layout == INTERLEAVED) {
+        interleavedOccTable.map(indexFile.section("IOCC"));
+    } else {
+        const char* ptr = indexFile.section("OCC");
+        occTable.resize(ALPHABET - 1);
+        for (auto& bv : occTable)
+            bv.map(ptr);
+    }
+
+    sparseSA.map(indexFile.section(
+                     sampling == SAMPLE_TEXT_POSITION ? "TSSA" : "SSA"),
+                 sampling);
+
+    if (indexFile.hasSection("KMER"))
+        kmerTable.map(indexFile.section("KMER"));
+
+    printDone(verbose);
+    return true;
+}
+
+void FMIndex::write(const string& base) const {
+    IndexFileWriter w(base + ".fmi");
+
+    uint64_t params[6] = {ALPHABET,         textLength,
+                          dollarPos,        sparseSA.getSparseness(),
+                          sizeof(length_t), textChecksum};
+    w.writeSection("PARAMS", params, sizeof(params));
+
+    char chars[ALPHABET];
+    for (size_t i = 0; i < ALPHABET; i++)
+        chars[i] = sigma.i2c(i);
+    w.writeSection("ALPHA", chars, sizeof(chars));
+    w.writeSection("COUNTS", counts.data(), sizeof(counts));
+    w.writeSection("BWT", bwt, textLength);
+
+    if (layout == INTERLEAVED) {
+        interleavedOccTable.write(w.beginSection("IOCC"));
+    } else {
+        ofstream& ofs = w.beginSection("OCC");
+        for (const auto& bv : occTable)
+            bv.write(ofs);
+    }
+    w.endSection();
+
+    bool textSampled = sparseSA.getSampling() == SAMPLE_TEXT_POSITION;
+    sparseSA.write(w.beginSection(textSampled ? "TSSA" : "SSA"));
+    w.endSection();
+
+    if (kmerTable.getK() > 0) {
+        kmerTable.write(w.beginSection("KMER"));
+        w.endSection();
+    }
+
+    w.close();
+}
+
+void FMIndex::createKmerTable(length_t k, uint64_t maxBytes) {
+    k = KmerTable::fitK(k, 2, maxBytes);
+    kmerTable = (k == 0) ? KmerTable() : KmerTable(k, 2);
+    if (k > 0)
+        fillKmerTable(Range(0, textLength), 0, 0);
+}
+
+void FMIndex::fillKmerTable(const Range& range, length_t depth,
+                            uint64_t code) {
+    if (depth == kmerTable.getK()) {
+        length_t* entry = kmerTable[code];
+        entry[0] = range.getBegin();
+        entry[1] = range.getEnd();
+        return;
+    }
+
+    // the k-mer is built from right to left, the character added at this
+    // depth ends up at position k - depth - 1 of the k-mer
+    array<length_t, ALPHABET> occBegin, occEnd;
+    occAll(range, occBegin, occEnd);
+    for (length_t i = 1; i < ALPHABET; i++) {
+        Range r(counts[i] + occBegin[i], counts[i] + occEnd[i]);
+        // the entries of absent k-mers remain the empty range
+        if (!r.empty())
+            fillKmerTable(r, depth + 1, code | (uint64_t)(i - 1) << (2 * depth));
+    }
+}
+
 // ============================================================================
 // FMIndex functionality:  week 1
 // ============================================================================
@@ -190,11 +375,35 @@ void FMIndex::read(const string& base, bool verbose) {
 length_t FMIndex::occ(const length_t& charIdx, const length_t& index) const {
     // 2 - 4 lines of code
     if(charIdx == 0) return index<=dollarPos ? 0 : 1;
+    if(layout == INTERLEAVED) return interleavedOccTable.occ(charIdx-1, index);
     length_t occ = 0;
     occ = occTable[charIdx-1].rank(index);
     return occ;
 }
 
+void FMIndex::occAll(const Range& range, array<length_t, ALPHABET>& occBegin,
+                     array<length_t, ALPHABET>& occEnd) const {
+    length_t b = range.getBegin(), e = max(range.getBegin(), range.getEnd());
+    occBegin[0] = (b > dollarPos) ? 1 : 0;
+    occEnd[0] = (e > dollarPos) ? 1 : 0;
+
+    if (layout == INTERLEAVED) {
+        uint64_t occB[4], occE[4];
+        interleavedOccTable.occAllPair(b, e, occB, occE);
+        for (length_t i = 1; i < ALPHABET; i++) {
+            occBegin[i] = occB[i - 1];
+            occEnd[i] = occE[i - 1];
+        }
+    } else {
+        for (length_t i = 1; i < ALPHABET; i++) {
+            uint64_t rb, re;
+            occTable[i - 1].rankPair(b, e, rb, re);
+            occBegin[i] = rb;
+            occEnd[i] = re;
+        }
+    }
+}
+
 length_t FMIndex::findLF(length_t k) const {
     // 1 - 2 lines of code
     return counts[sigma.c2i(bwt[k])] + occ(sigma.c2i(bwt[k]), k);
@@ -209,7 +418,8 @@ length_t FMIndex::findSA(length_t k) const {
           k = findLF(k);
           i++;
           if(sparseSA.hasStored(k)){
-              return ((sparseSA[k]+i) < 0) || ((sparseSA[k]+i) >= text.size()) ? 0 : sparseSA[k]+i;
+              // the walk wraps around the '$' for rows sampled by SA index
+              return (sparseSA[k]+i) % textLength;
           }
       }
     }
@@ -230,71 +440,177 @@ bool FMIndex::addCharLeft(length_t charIdx, const Range& originalRange,
 using namespace std;
 #include <string>
 
-vector<length_t> FMIndex::matchExact(const string& str) const {
+vector<length_t> FMIndex::matchExact(const string& str,
+                                     length_t& numOcc) const {
     // 8 - 12 lines of code
     vector<length_t> result;
+    numOcc = 0;
     bool matchLeft = false;
     Range range = Range(0, text.size());
-    for (int i = (str.size()-1); i >= 0; i--) {
+    int end = str.size();
+
+    // look up the range of the final k-mer to skip the first k steps
+    length_t k = kmerTable.getK();
+    uint64_t code = 0;
+    if (k > 0 && str.size() >= k) {
+        length_t i = str.size() - k;
+        while (i < str.size() && KmerTable::appendChar(str[i], code))
+            i++;
+        if (i == str.size()) {
+            range = Range(kmerTable[code][0], kmerTable[code][1]);
+            if (range.empty()) return result;
+            end -= k;
+        }
+    }
+
+    for (int i = end-1; i >= 0; i--) {
+      if (range.width() <= verifyWidth) {
+          // few candidates: compare the rest str[0, i] with the text
+          for (length_t j = range.getBegin(); j < range.getEnd(); j++) {
+              Candidate cand(j, str.size() - i - 1);
+              int l = i;
+              char c;
+              while (l >= 0 && extendLeft(cand, c) && c == str[l])
+                  l--;
+              if (l >= 0)
+                  continue;
+              length_t pos = cand.located ? cand.begin : findSA(cand.row);
+              if (contigs.inSingleContig(pos, pos + str.size()))
+                  result.push_back(pos);
+          }
+          numOcc = result.size();
+          return result;
+      }
       matchLeft = addCharLeft(sigma.c2i(str[i]), range, range);
       if(!matchLeft) return result;
     }
-    for (length_t i = range.getBegin(); i < range.getEnd(); i++) result.push_back(findSA(i));
+    numOcc = range.width();
+    if (maxOcc > 0 && numOcc > maxOcc) {
+        // only locate rows spread evenly over the range
+        for (length_t j = 0; j < numSamples; j++) {
+            length_t pos = findSA(range.getBegin() +
+                                  (uint64_t)j * numOcc / numSamples);
+            if (contigs.inSingleContig(pos, pos + str.size()))
+                result.push_back(pos);
+        }
+        return result;
+    }
+    for (length_t i = range.getBegin(); i < range.getEnd(); i++) {
+        length_t pos = findSA(i);
+        if (contigs.inSingleContig(pos, pos + str.size()))
+            result.push_back(pos);
+    }
+    numOcc = result.size();
     return result;
 }
 
-#include <cmath>
+/**
+ * Get the exact occurrences of a string as text occurrences, sorted on their
+ * position
+ */
+static vector<TextOcc> exactTextOcc(const FMIndex& index,
+                                    const string& str) {
+    vector<length_t> pos = index.matchExact(str);
+    sort(pos.begin(), pos.end());
+    vector<TextOcc> occ;
+    occ.reserve(pos.size());
+    for (length_t p : pos)
+        occ.emplace_back(Range(p, p + str.size()), 0,
+                         index.getContigs().findContig(p));
+    return occ;
+}
 
 tuple<length_t, length_t, bool>
 FMIndex::bestPairedMatch(const pair<string, string>& reads,
                          const length_t& meanInsSize) const {
-    // 15 - 25 lines of code
-    vector<length_t> matchesRead1 = matchExact(reads.first), matchesRead2 = matchExact(reads.second), matchesRead1Rev = matchExact(revCompl(reads.first)), matchesRead2Rev = matchExact(revCompl(reads.second));
-    int currentBestInsert = text.size();
-    length_t currentBestRead1, currentBestRead2;
-    bool is2Rev = false;
-
-    for (size_t i = 0; i < matchesRead1.size(); i++) {
-      for (size_t j = 0; j < matchesRead2Rev.size(); j++) {
-        if(currentBestInsert >= abs(abs((int)(matchesRead2Rev[j] + reads.second.size() - matchesRead1[i]))-(int)meanInsSize)){
-          currentBestInsert = abs(abs((int)(matchesRead2Rev[j] + reads.second.size() - matchesRead1[i]))-(int)meanInsSize);
-          currentBestRead1 = matchesRead1[i];
-          currentBestRead2 = matchesRead2Rev[j];
-          is2Rev = 1;
-        }
-      }
-    }
-    for (size_t i = 0; i < matchesRead2.size(); i++) {
-      for (size_t j = 0; j < matchesRead1Rev.size(); j++) {
-        if(currentBestInsert >= abs(abs((int)(matchesRead1Rev[j] + reads.first.size() - matchesRead2[i]))-(int)meanInsSize)){
-          currentBestInsert = abs(abs((int)(matchesRead1Rev[j] + reads.first.size() - matchesRead2[i]))-(int)meanInsSize);
-          currentBestRead2 = matchesRead2[i];
-          currentBestRead1 = matchesRead1Rev[j];
-          is2Rev = 0;
-        }
-      }
-    }
-
-    return make_tuple(currentBestRead1,currentBestRead2,is2Rev);
+    PairFinder finder;
+    PairedMatch best = finder.findBestPair(
+        exactTextOcc(*this, reads.first),
+        exactTextOcc(*this, revCompl(reads.first)),
+        exactTextOcc(*this, reads.second),
+        exactTextOcc(*this, revCompl(reads.second)),
+        InsertSizeDistribution(meanInsSize));
+    if (!best.valid)
+        return make_tuple(0, 0, false);
+    return make_tuple(best.first.begin(), best.second.begin(),
+                      best.secondRev);
 }
 
 // ============================================================================
 // FMIndex functionality:  week 2
 // ============================================================================
+template <class Stack>
 void FMIndex::extendFMPos(const Range& range, const length_t& depth,
-                          std::vector<FMPosExt>& stack) const {
+                          Stack& stack) const {
     // 4 lines of code
-    Range r=range;
+    array<length_t, ALPHABET> occBegin, occEnd;
+    occAll(range, occBegin, occEnd);
     for (length_t i=1; i<sigma.size(); i++){
-        if(addCharLeft(i, range, r)) stack.push_back(FMPosExt(sigma.i2c(i), r, depth+1));
+        Range r(counts[i] + occBegin[i], counts[i] + occEnd[i]);
+        if(!r.empty()) stack.emplace_back(sigma.i2c(i), r, depth+1);
     }
 }
 
+template void FMIndex::extendFMPos(const Range& range, const length_t& depth,
+                                   vector<FMPosExt>& stack) const;
+template void FMIndex::extendFMPos(const Range& range, const length_t& depth,
+                                   SearchStack& stack) const;
+
 void FMIndex::convertFMOccToTextOcc(const FMOcc& fmocc,
                                     std::vector<TextOcc>& textOcc) const {
     // 3 - 4 lines of code
     for(length_t i=fmocc.getRange().getBegin(); i<fmocc.getRange().getEnd(); i++ ){
-        textOcc.push_back(TextOcc(Range(findSA(i), findSA(i)+fmocc.getDepth()), fmocc.getDistance()));
+        length_t pos = fmocc.isLocated() ? i : findSA(i);
+        if (!contigs.inSingleContig(pos, pos + fmocc.getDepth())) continue;
+        textOcc.push_back(TextOcc(Range(pos, pos+fmocc.getDepth()), fmocc.getDistance(), contigs.findContig(pos)));
+    }
+}
+
+void FMIndex::locateRanges(const vector<Range>& ranges,
+                           vector<length_t>& positions) const {
+    // collect the distinct rows
+    vector<length_t> rows;
+    for (const auto& r : ranges)
+        for (length_t i = r.getBegin(); i < r.getEnd(); i++)
+            rows.push_back(i);
+    sort(rows.begin(), rows.end());
+    rows.erase(unique(rows.begin(), rows.end()), rows.end());
+
+    // walk the LF mapping of up to LOCATE_BATCH rows in lockstep, a finished
+    // walk is replaced by the walk of the next row
+    vector<length_t> rowPos(rows.size());
+    length_t cur[LOCATE_BATCH], steps[LOCATE_BATCH];
+    size_t idx[LOCATE_BATCH], numActive = 0, next = 0;
+
+    while (numActive > 0 || next < rows.size()) {
+        while (numActive < LOCATE_BATCH && next < rows.size()) {
+            cur[numActive] = rows[next];
+            steps[numActive] = 0;
+            idx[numActive++] = next++;
+        }
+        for (size_t j = 0; j < numActive;) {
+            if (sparseSA.hasStored(cur[j])) {
+                // the walk wraps around the '$' for rows sampled by SA index
+                rowPos[idx[j]] = (sparseSA[cur[j]] + steps[j]) % textLength;
+                numActive--;
+                cur[j] = cur[numActive];
+                steps[j] = steps[numActive];
+                idx[j] = idx[numActive];
+            } else {
+                cur[j] = findLF(cur[j]);
+                steps[j]++;
+                j++;
+            }
+        }
+    }
+
+    // the rows of each range are consecutive in the sorted distinct rows
+    positions.clear();
+    for (const auto& r : ranges) {
+        size_t j = lower_bound(rows.begin(), rows.end(), r.getBegin()) -
+                   rows.begin();
+        for (length_t i = r.getBegin(); i < r.getEnd(); i++)
+            positions.push_back(rowPos[j++]);
     }
 }
 
@@ -303,55 +619,285 @@ void FMIndex::convertFMOccToTextOcc(const FMOcc& fmocc,
 // ============================================================================
 
 vector<TextOcc> FMIndex::naiveApproxMatch(const string& pattern,
-                                          length_t k) const {
+                                          length_t k,
+                                          length_t& numOcc) const {
 
     // create the occurrences vector (to which an FMOcc is pushed)
     vector<FMOcc> occ;
+    naiveApproxSearch(pattern, k, occ);
 
-    // create the stack and reserve space
-    vector<FMPosExt> stack;
-    stack.reserve((pattern.size() + k + 1) * (sigma.size() - 1));
+    return filterRedundantMatches(occ, k, numOcc);
+}
 
-    // Create the matrix for this pattern and edit distance value
-    BandedMatrix matrix(pattern.size(), k, 0);
+bool FMIndex::occurs(const string& str, length_t begin, length_t end) const {
+    Range range(0, text.size());
+    for (length_t i = end; i-- > begin;) {
+        if (!sigma.inAlphabet(str[i]) || str[i] == '$' ||
+            !addCharLeft(sigma.c2i(str[i]), range, range))
+            return false;
+    }
+    return true;
+}
 
-    // Create the first 4 entries in the stack, corresponding to the "A",
-    // "C", "G" and "T" strings with depth 1
-    extendFMPos(Range(0, text.size()), 0, stack);
+void FMIndex::computeLowerBounds(const string& pattern,
+                                 vector<length_t>& rest) const {
+    length_t m = pattern.size();
+    rest.assign(m + 1, 0);
+
+    // first the number of pieces that end at or before each prefix length
+    length_t pieces = 0, begin = 0;
+    while (begin < m) {
+        // the shortest piece [begin, end[ that does not occur, a piece that
+        // does not occur does not occur either if it is extended: double its
+        // length until it does not occur, then bisect
+        length_t lo = begin, hi, length = 1;
+        while (true) {
+            hi = min(begin + length, m);
+            if (!occurs(pattern, begin, hi))
+                break;
+            lo = hi;
+            if (hi == m)
+                break;
+            length *= 2;
+        }
+        if (lo == hi)
+            break; // the rest of the pattern occurs
+        while (hi - lo > 1) {
+            length_t mid = lo + (hi - lo) / 2;
+            if (occurs(pattern, begin, mid))
+                lo = mid;
+            else
+                hi = mid;
+        }
+        rest[hi] = ++pieces;
+        begin = hi;
+    }
+    for (length_t i = 1; i <= m; i++)
+        rest[i] = max(rest[i], rest[i - 1]);
+
+    // column j of a backward search leaves the prefix of length m - j
+    reverse(rest.begin(), rest.end());
+}
+
+length_t FMIndex::naiveSearch(const string& pattern, length_t k,
+                              bool bestFirst, length_t extraStrata,
+                              vector<FMOcc>& occ) const {
 
     // Create a substring from pattern with backward direction (1 line)
     Substring p(pattern, BACKWARD);
 
+    // the stack, the bounds and the matrices of the thread keep their
+    // memory between searches
+    static thread_local SearchStack stack;
+    static thread_local vector<length_t> rest;
+    static thread_local BitParallelMatrix bitMatrix;
+    static thread_local BandedMatrix bandedMatrix;
+    stack.clear();
+    computeLowerBounds(pattern, rest);
+
+    // Initialize the matrix for this pattern and edit distance value, the
+    // bit-parallel rows if the band fits in a word
+    if (k <= BitParallelMatrix::maxWidth) {
+        bitMatrix.reset(p, k, 0);
+        return naiveApproxSearch(p, k, bitMatrix, stack, rest, bestFirst,
+                                 extraStrata, occ);
+    } else {
+        bandedMatrix.reset(pattern.size(), k, 0);
+        return naiveApproxSearch(p, k, bandedMatrix, stack, rest, bestFirst,
+                                 extraStrata, occ);
+    }
+}
+
+template <class Matrix>
+length_t FMIndex::naiveApproxSearch(const Substring& p, length_t k,
+                                    Matrix& matrix, SearchStack& stack,
+                                    const vector<length_t>& rest,
+                                    bool bestFirst, length_t extraStrata,
+                                    vector<FMOcc>& occ) const {
+    // the maximal distance that is searched, lowered by a best-first search
+    // once occurrences are found
+    length_t limit = k, best = k + 1;
+    size_t initial = occ.size();
+
+    // Create the first 4 entries in the stack, corresponding to the "A",
+    // "C", "G" and "T" strings with depth 1
+    extendFMPos(Range(0, text.size()), 0, stack);
+    if (bestFirst)
+        orderByBound(p, limit, matrix, stack, 0, rest);
+
     while (!stack.empty()) {
 
         // Get the final element from the stack and pop it back (= remove from
         // the stack)
-        FMPosExt currentPos = stack.back();
+        size_t top = stack.size() - 1;
+        Range range = stack.getRange(top);
+        length_t row = stack.getRow(top);
+        char c = stack.getCharacter(top);
         stack.pop_back();
 
-        // 7 - 15 lines of code
-        length_t minimalEditDist = matrix.updateMatrixRow(p, currentPos.getRow(), currentPos.getCharacter());
-        if(minimalEditDist<k) extendFMPos(currentPos.getRange(), currentPos.getDepth(), stack);
-        if(matrix.inFinalColumn(currentPos.getRow())) {
-            length_t matrixValueFinalCol = matrix.getValueInFinalColumn(currentPos.getRow());
-            if(matrixValueFinalCol<=k) occ.push_back(FMOcc(currentPos, matrixValueFinalCol));
-        }      
+        length_t minimalEditDist = matrix.updateMatrixRow(p, row, c);
+        if (minimalEditDist > limit ||
+            matrix.getLowerBound(row, rest) > limit)
+            continue;
+        size_t found = occ.size();
+        if (range.width() <= verifyWidth) {
+            // few candidates: continue in the text of every row
+            for (length_t i = range.getBegin(); i < range.getEnd(); i++)
+                verifyInText(p, limit, Candidate(i, row), matrix, rest, occ);
+        } else {
+            size_t base = stack.size();
+            extendFMPos(range, row, stack);
+            if (bestFirst)
+                orderByBound(p, limit, matrix, stack, base, rest);
+        }
+        if (matrix.inFinalColumn(row)) {
+            length_t ED = matrix.getValueInFinalColumn(row);
+            if (ED <= limit)
+                occ.push_back(FMOcc(range, ED, row));
+        }
+        for (size_t i = found; i < occ.size(); i++)
+            best = min(best, occ[i].getDistance());
+        if (bestFirst)
+            limit = min(k, best + extraStrata);
+    }
+
+    if (bestFirst) {
+        // the occurrences that were found before the limit was lowered
+        occ.erase(remove_if(occ.begin() + initial, occ.end(),
+                            [limit](const FMOcc& o) {
+                                return o.getDistance() > limit;
+                            }),
+                  occ.end());
+    }
+    return best;
+}
+
+template <class Matrix>
+void FMIndex::orderByBound(const Substring& p, length_t limit,
+                           Matrix& matrix, SearchStack& stack, size_t base,
+                           const vector<length_t>& rest) const {
+    length_t bound[ALPHABET]; // the bounds of the children
+    for (size_t i = base; i < stack.size();) {
+        length_t row = stack.getRow(i);
+        length_t b = matrix.updateMatrixRow(p, row, stack.getCharacter(i));
+        if (b <= limit)
+            b = matrix.getLowerBound(row, rest);
+        if (b > limit) {
+            // replace the child with the top of the stack
+            stack.swap(i, stack.size() - 1);
+            stack.pop_back();
+        } else {
+            bound[i++ - base] = b;
+        }
     }
 
-    return filterRedundantMatches(occ, k);
+    // insertion sort of the few children, the lowest bound on top
+    for (size_t i = base + 1; i < stack.size(); i++) {
+        for (size_t j = i; j > base && bound[j - base] > bound[j - 1 - base];
+             j--) {
+            stack.swap(j, j - 1);
+            swap(bound[j - base], bound[j - 1 - base]);
+        }
+    }
+}
+
+template <class Matrix>
+void FMIndex::verifyInText(const Substring& p, length_t k, Candidate cand,
+                           Matrix& matrix, const vector<length_t>& rest,
+                           vector<FMOcc>& occ) const {
+    // the same rows as in the search tree of the index, along the single
+    // path of the text before the candidate
+    char c;
+    while (extendLeft(cand, c)) {
+        length_t row = cand.depth;
+        if (matrix.updateMatrixRow(p, row, c) > k ||
+            matrix.getLowerBound(row, rest) > k)
+            return;
+        if (matrix.inFinalColumn(row)) {
+            length_t ED = matrix.getValueInFinalColumn(row);
+            if (ED <= k)
+                occ.push_back(makeOcc(cand, ED));
+        }
+    }
+}
+
+uint64_t FMIndex::bestWidth(const std::vector<FMOcc>& fmocc,
+                            length_t& best) const {
+    best = ~(length_t)0;
+    for (const auto& f : fmocc)
+        best = std::min(best, f.getDistance());
+    uint64_t width = 0;
+    for (const auto& f : fmocc)
+        if (f.getDistance() == best)
+            width += f.getWidth();
+    return width;
+}
+
+void FMIndex::sampleOccurrences(std::vector<FMOcc>& fmocc, length_t best,
+                                uint64_t width) const {
+    // the rows j * width / numSamples of the concatenated ranges
+    std::vector<FMOcc> samples;
+    uint64_t offset = 0; // the rows before the current range
+    length_t j = 0;
+    for (const auto& f : fmocc) {
+        if (f.getDistance() != best)
+            continue;
+        uint64_t row;
+        while (j < numSamples &&
+               (row = j * width / numSamples) < offset + f.getWidth()) {
+            length_t b = f.getRange().getBegin() + (row - offset);
+            if (f.isLocated())
+                samples.push_back(f);
+            else
+                samples.emplace_back(Range(b, b + 1), best, f.getDepth());
+            j++;
+        }
+        offset += f.getWidth();
+    }
+    fmocc.swap(samples);
 }
 
 std::vector<TextOcc> FMIndex::filterRedundantMatches(std::vector<FMOcc>& fmocc,
-                                                     const length_t& k) const {
+                                                     const length_t& k,
+                                                     length_t& numOcc) const {
 
     // A) remove doubles in the fmoccurrences
     std::sort(fmocc.begin(), fmocc.end());
     fmocc.erase(std::unique(fmocc.begin(), fmocc.end()), fmocc.end());
 
-    // B) convert fmoccurrences to occurrences in text
+    // repetitive patterns: only locate a sample of the occurrences. Only the
+    // rows with the lowest distance are counted, the ranges with a higher
+    // distance mostly hold redundant alignments of the same loci.
+    length_t best;
+    uint64_t width = bestWidth(fmocc, best);
+    bool capped = maxOcc > 0 && width > maxOcc;
+    numOcc = capped ? std::min<uint64_t>(width, ~(length_t)0) : 0;
+    if (capped)
+        sampleOccurrences(fmocc, best, width);
+
+    // B) convert fmoccurrences to occurrences in text, all ranges are
+    // located at once. Occurrences that span two contigs are discarded.
+    std::vector<Range> ranges;
+    ranges.reserve(fmocc.size());
+    for (const auto& f : fmocc) {
+        if (!f.isLocated())
+            ranges.push_back(f.getRange());
+    }
+    std::vector<length_t> positions;
+    locateRanges(ranges, positions);
+
     std::vector<TextOcc> textocc;
+    textocc.reserve(positions.size());
+    size_t p = 0;
     for (const auto& f : fmocc) {
-        convertFMOccToTextOcc(f, textocc);
+        for (length_t i = 0; i < f.getWidth(); i++) {
+            length_t pos = f.isLocated() ? f.getRange().getBegin()
+                                         : positions[p++];
+            if (!contigs.inSingleContig(pos, pos + f.getDepth()))
+                continue;
+            textocc.emplace_back(Range(pos, pos + f.getDepth()),
+                                 f.getDistance(), contigs.findContig(pos));
+        }
     }
 
     // C) erase doubles from textocc
@@ -376,7 +922,7 @@ std::vector<TextOcc> FMIndex::filterRedundantMatches(std::vector<FMOcc>& fmocc,
         if (diff == 0) {
             continue;
         }
-        if (diff <= maxDiff) {
+        if (diff <= maxDiff && o.getContig() == r.back().getContig()) {
             // check if this later occurrence is better than the
             // previous one
             if (o.getDistance() > prevED) {
@@ -395,5 +941,7 @@ std::vector<TextOcc> FMIndex::filterRedundantMatches(std::vector<FMOcc>& fmocc,
     }
 
     // D) return the occurrences
+    if (!capped)
+        numOcc = r.size();
     return r;
 }
@@ -6,9 +6,15 @@
 #include <vector>
 
 #include "alphabet.h"
+#include "contigs.h"
+#include "indexfile.h"
+#include "interleavedocc.h"
+#include "kmertable.h"
 #include "substring.h"
 #include "suffixarray.h"
 
+class SearchStack;
+
 // ============================================================================
 // IO helper functions
 // ============================================================================
@@ -25,6 +31,19 @@ bool readArray(const std::string& filename, std::vector<length_t>& array);
 void readSA(const std::string& filename, std::vector<length_t>& sa,
             size_t saSizeHint);
 
+/**
+ * Print progress information (if verbose)
+ * @param info The information to print
+ * @param verbose Whether to print
+ */
+void printInfo(const std::string& info, bool verbose);
+
+/**
+ * Print "done" to finish a progress message (if verbose)
+ * @param verbose Whether to print
+ */
+void printDone(bool verbose);
+
 // ============================================================================
 // CLASS RANGE
 // ============================================================================
@@ -147,12 +166,15 @@ class FMPos {
 // ============================================================================
 
 /**
- * An occurrence (match) in the  FM-index
+ * An occurrence (match) in the  FM-index. An occurrence that was verified in
+ * the text instead of the index is located already: its range is [p, p + 1[
+ * with p its begin position in the text.
  */
 class FMOcc {
   protected:
     FMPos pos;         // The FM position of this occurrence
     length_t distance; // the edit distance
+    bool located = false; // true if the range is a position in the text
 
   public:
     FMOcc() : pos(), distance(0) {
@@ -176,6 +198,20 @@ class FMOcc {
     FMOcc(FMPos pos, length_t distance) : pos(pos), distance(distance) {
     }
 
+    /**
+     * Make an approximate match that is located in the text
+     * @param begin the begin position of the match in the text
+     * @param distance the (edit or hamming) distance of this approximate
+     * match
+     * @param depth the depth (=length) of this approximate match
+     */
+    static FMOcc makeLocated(length_t begin, length_t distance,
+                             length_t depth) {
+        FMOcc occ(Range(begin, begin + 1), distance, depth);
+        occ.located = true;
+        return occ;
+    }
+
     const Range& getRange() const {
         return pos.getRange();
     }
@@ -195,6 +231,14 @@ class FMOcc {
         return pos.getRange().width();
     }
 
+    /**
+     * @returns true if the begin of the range is a position in the text
+     * rather than a row in the suffix array
+     */
+    bool isLocated() const {
+        return located;
+    }
+
     /**
      * @returns true if the position is valid, false otherwise
      */
@@ -218,15 +262,20 @@ class FMOcc {
             return distance < rhs.getDistance();
         }
         // shorter read is smaller...
-        return getDepth() < rhs.getDepth();
+        if (getDepth() != rhs.getDepth()) {
+            return getDepth() < rhs.getDepth();
+        }
+        return located < rhs.isLocated();
     }
     /**
      * Operatoroverloading
      * Two FMocc are equal if their ranges, distance and depth are all equal
+     * and both are located or not
      * @param returns true if this is equal to rhs
      */
     bool operator==(const FMOcc& rhs) {
-        return pos == rhs.getFMPos() && distance == rhs.getDistance();
+        return pos == rhs.getFMPos() && distance == rhs.getDistance() &&
+               located == rhs.isLocated();
     }
 
     /**
@@ -301,6 +350,7 @@ class TextOcc {
   private:
     Range range;       // the range in the text
     length_t distance; // the distance to this range (edit or hamming)
+    length_t contig;   // the contig that contains this range
 
   public:
     /**
@@ -309,13 +359,14 @@ class TextOcc {
      * @param distance, the (edit or hamming) distance to the mapped read of
      * this occurrence
      */
-    TextOcc(Range range, length_t distance) : range(range), distance(distance) {
+    TextOcc(Range range, length_t distance, length_t contig = 0)
+        : range(range), distance(distance), contig(contig) {
     }
 
     /**
      * Constructor for an invalid text occurrence (empty range)
      */
-    TextOcc() : range(0, 0) {
+    TextOcc() : range(0, 0), contig(0) {
     }
 
     const Range getRange() const {
@@ -325,6 +376,14 @@ class TextOcc {
         return distance;
     }
 
+    /**
+     * Get the contig that contains this occurrence, the begin of the range
+     * within the contig is begin() - ContigTable::getStart(getContig())
+     */
+    length_t getContig() const {
+        return contig;
+    }
+
     /**
      * Operator overloading for sorting the occurrences.
      * Occurrences are first sorted on their begin position, then on their
@@ -366,44 +425,336 @@ class TextOcc {
     friend std::ostream& operator<<(std::ostream& os, const TextOcc& r);
 };
 
+// ============================================================================
+// ENUM OCCTABLELAYOUT
+// ============================================================================
+
+/**
+ * The layout of the occurrence table. BITVECTORS uses one rank9 bitvector per
+ * character, INTERLEAVED stores the counts of all characters together with
+ * the BWT in 64-byte blocks (see interleavedocc.h).
+ */
+enum OccTableLayout { BITVECTORS, INTERLEAVED };
+
 // ============================================================================
 // CLASS FMINDEX: PROVIDED STEP 1/2/3 (ADAPATED FOR EACH VERSION)
 // ============================================================================
 
+#define LOCATE_BATCH 32 // number of interleaved LF walks in locateRanges
+
 class FMIndex {
   protected:
-    std::string bwt;                       // the bwt of the text
-    std::string text;                      // the original text
-    length_t textLength;                   // the length of the text
+    std::vector<char> bwtStorage; // the bwt of the text, if created in memory
+    const char* bwt = nullptr;    // the bwt of the text, points to bwtStorage
+                                  // or into the mapped index file
+    std::string text;             // the original text
+    length_t textLength;          // the length of the text
+    uint64_t textChecksum = 0;    // the checksum of the text (see checksum)
     std::array<length_t, ALPHABET> counts; // the counts array
     SparseSuffixArray sparseSA; // the suffix array of the reference genome
     Alphabet<ALPHABET> sigma;   // the alphabet
 
-    std::vector<Bitvec> occTable; // the occurrence table
-    length_t dollarPos;           // the position of the dollar in the BWT
+    OccTableLayout layout;        // the layout of the occurrence table
+    std::vector<Bitvec> occTable; // the occurrence table (BITVECTORS)
+    InterleavedOccTable interleavedOccTable; // the occurrence table
+                                             // (INTERLEAVED)
+    length_t dollarPos; // the position of the dollar in the BWT
+
+    KmerTable kmerTable; // the SA range [begin, end[ of every k-mer (if any)
+    ContigTable contigs; // the contigs that are concatenated in the text
+
+    length_t maxOcc = 0;     // the maximal number of located occurrences of
+                             // a search, 0 for no limit
+    length_t numSamples = 3; // the number of occurrences that are located
+                             // if a search has more than maxOcc
+    length_t verifyWidth = 0; // the maximal width of a range whose rows are
+                              // verified in the text, 0 for none
+
+    MappedIndexFile indexFile; // the memory-mapped index file (if any)
 
     // ============================================================================
     // FM Index Construction
     // ============================================================================
 
     /**
-     * Helper function for constructor, reads in the text and suffix array and
-     * creates a sparse suffix array, the occTable, the BWT and the counts
+     * Helper function for constructor, reads in the text <base>.txt and the
+     * contig table <base>.contigs. If there is no contig table, the text is
+     * a single contig.
+     */
+    void readTextFile(const std::string& base, bool verbose);
+
+    /**
+     * Helper function for constructor, reads in the text and the index file
+     * <base>.fmi if present. Otherwise, reads the suffix array (or constructs
+     * it if <base>.sa does not exist) and creates the index from it
      */
     void read(const std::string& base, bool verbose);
 
+    /**
+     * Helper function for constructor, creates the sparse suffix array, the
+     * occTable, the BWT and the counts from the (dense) suffix array
+     * @param sa the (dense) suffix array of the text
+     */
+    void createFromSA(const std::vector<length_t>& sa, bool verbose);
+
+    /**
+     * Load the BWT, counts, alphabet, occTable and sparse suffix array from
+     * a memory-mapped index file. The bitvectors and the sparse suffix array
+     * are not copied but point into the mapped file. The layout of the
+     * occurrence table and the sparseness and sampling of the suffix array
+     * are taken from the file.
+     * @param filename the name of the index file
+     * @returns true if successful, false if the file does not exist
+     * @throws runtime_error if the file does not match the text, the alphabet
+     * or the width of length_t
+     */
+    bool readIndexFile(const std::string& filename, bool verbose);
+
+    /**
+     * Helper function for createKmerTable, stores the ranges of all k-mers
+     * that end with the string that corresponds to range
+     * @param range the range over the SA of the current string
+     * @param depth the length of the current string
+     * @param code the code of the current string
+     */
+    void fillKmerTable(const Range& range, length_t depth, uint64_t code);
+
+    /**
+     * Get the number of rows in the SA of the occurrences with the lowest
+     * distance
+     * @param fmocc the occurrences
+     * @param best the lowest distance [output]
+     */
+    uint64_t bestWidth(const std::vector<FMOcc>& fmocc, length_t& best) const;
+
+    /**
+     * Replace the occurrences of a search with more than maxOcc rows with
+     * the lowest distance by numSamples of these rows, spread evenly over
+     * the ranges with the lowest distance
+     * @param fmocc the occurrences, sorted [input/output]
+     * @param best the lowest distance
+     * @param width the number of rows with the lowest distance
+     */
+    void sampleOccurrences(std::vector<FMOcc>& fmocc, length_t best,
+                           uint64_t width) const;
+
+    /**
+     * Checks whether a substring of a string occurs in the text
+     * @param str the string
+     * @param begin the begin of the substring
+     * @param end the end of the substring
+     */
+    bool occurs(const std::string& str, length_t begin, length_t end) const;
+
+    /**
+     * Computes lower bounds on the edit distance of the prefixes of a
+     * pattern to any substring of the text, like the D array of BWA. The
+     * pattern is cut from left to right into pieces that do not occur in the
+     * text, each piece ends at the first character at which it no longer
+     * occurs. An alignment of a prefix with fewer errors than the number of
+     * pieces in it would match one of these pieces exactly.
+     * @param pattern the pattern
+     * @param rest rest[j] is the lower bound of the prefix of length
+     * |pattern| - j, i.e. of the pattern that is left after column j of
+     * the matrix of a backward search [output]
+     */
+    void computeLowerBounds(const std::string& pattern,
+                            std::vector<length_t>& rest) const;
+
+    /**
+     * The search of naiveApproxSearch and naiveBestSearch
+     * @param pattern the pattern
+     * @param k the maximum edit distance
+     * @param bestFirst true for the search of naiveBestSearch
+     * @param extraStrata the strata after the best one (if bestFirst)
+     * @param occ the occurrences in the FM-index are appended [output]
+     * @returns the lowest distance of the occurrences, k + 1 if none
+     */
+    length_t naiveSearch(const std::string& pattern, length_t k,
+                         bool bestFirst, length_t extraStrata,
+                         std::vector<FMOcc>& occ) const;
+
+    /**
+     * The depth-first search of naiveSearch. A node is pruned if its row
+     * plus the lower bounds of the rest of the pattern exceeds the maximal
+     * distance. In a best-first search, the children of a node are visited
+     * in the order of their lower bound and the maximal distance is lowered
+     * to the best distance found so far plus extraStrata.
+     * @param p the pattern (in backward direction)
+     * @param k the maximum edit distance
+     * @param matrix a BandedMatrix or BitParallelMatrix of p with width k
+     * @param stack the (empty) stack of the nodes to visit
+     * @param rest the lower bounds of the pattern after each column
+     * @param bestFirst true for a best-first search
+     * @param extraStrata the strata after the best one (if bestFirst)
+     * @param occ the occurrences in the FM-index are appended [output]
+     * @returns the lowest distance of the occurrences, k + 1 if none
+     */
+    template <class Matrix>
+    length_t naiveApproxSearch(const Substring& p, length_t k,
+                               Matrix& matrix, SearchStack& stack,
+                               const std::vector<length_t>& rest,
+                               bool bestFirst, length_t extraStrata,
+                               std::vector<FMOcc>& occ) const;
+
+    /**
+     * Orders the children of a node of a best-first search: children whose
+     * lower bound exceeds the maximal distance are removed, the others are
+     * sorted such that the child with the lowest bound is on top
+     * @param p the pattern (in backward direction)
+     * @param limit the maximal distance
+     * @param matrix the matrix of p, the row above the children is filled in
+     * (the row of the children is overwritten)
+     * @param stack the stack [input/output]
+     * @param base the index of the first child on the stack
+     * @param rest the lower bounds of the pattern after each column
+     */
+    template <class Matrix>
+    void orderByBound(const Substring& p, length_t limit, Matrix& matrix,
+                      SearchStack& stack, size_t base,
+                      const std::vector<length_t>& rest) const;
+
+    /**
+     * A single row of a search that is verified in the text instead of the
+     * index (see setVerificationWidth): the matched string is
+     * T[begin, begin + depth[. Locating the row walks the LF mapping, which
+     * reads the characters before the matched string from the BWT, so the
+     * candidate is extended to the left with those characters until the walk
+     * reaches a sampled row of the SA. Most candidates are pruned before
+     * then and are never located.
+     */
+    struct Candidate {
+        length_t row;   // the row in the SA of the matched string
+        length_t begin; // the begin of the matched string, if located
+        length_t depth; // the length of the matched string
+        bool located;   // true if begin is known
+
+        Candidate(length_t row, length_t depth)
+            : row(row), begin(0), depth(depth), located(false) {
+        }
+    };
+
+    /**
+     * Extend a candidate with the character before it in the text
+     * @param cand the candidate [input/output]
+     * @param c the character [output]
+     * @returns false if the candidate is a prefix of the text
+     */
+    bool extendLeft(Candidate& cand, char& c) const {
+        if (!cand.located && sparseSA.hasStored(cand.row)) {
+            cand.begin = sparseSA[cand.row];
+            cand.located = true;
+        }
+        if (cand.located) {
+            if (cand.begin == 0)
+                return false;
+            c = text[--cand.begin];
+        } else {
+            c = bwt[cand.row];
+            if (c == '$')
+                return false;
+            cand.row = findLF(cand.row);
+        }
+        cand.depth++;
+        return true;
+    }
+
+    /**
+     * Extend a candidate with the character after it in the text, the
+     * candidate is located first
+     * @param cand the candidate [input/output]
+     * @param c the character [output]
+     * @returns false if the candidate is a suffix of the text (without '$')
+     */
+    bool extendRight(Candidate& cand, char& c) const {
+        if (!cand.located) {
+            cand.begin = findSA(cand.row);
+            cand.located = true;
+        }
+        if (cand.begin + cand.depth + 1 >= textLength)
+            return false;
+        c = text[cand.begin + cand.depth++];
+        return true;
+    }
+
+    /**
+     * Get the occurrence of a candidate, located if its begin is known
+     */
+    static FMOcc makeOcc(const Candidate& cand, length_t distance) {
+        if (cand.located)
+            return FMOcc::makeLocated(cand.begin, distance, cand.depth);
+        return FMOcc(Range(cand.row, cand.row + 1), distance, cand.depth);
+    }
+
+    /**
+     * Continue the search of naiveApproxSearch in the text instead of the
+     * index: the pattern is extended to the left with the characters before
+     * the candidate
+     * @param p the pattern (in backward direction)
+     * @param k the maximum edit distance
+     * @param cand the candidate, its depth is the row of the matrix of its
+     * last character
+     * @param matrix the matrix of p, its rows up to the depth of cand are
+     * those of the matched string
+     * @param rest the lower bounds of the pattern after each column
+     * @param occ the occurrences are appended [output]
+     */
+    template <class Matrix>
+    void verifyInText(const Substring& p, length_t k, Candidate cand,
+                      Matrix& matrix, const std::vector<length_t>& rest,
+                      std::vector<FMOcc>& occ) const;
+
   public:
     // ============================================================================
     // FM Index Construction
     // ============================================================================
     /**
      * Constructor
+     * @param layout the layout of the occurrence table
+     * @param sampling the sampling strategy of the sparse suffix array
      */
-    FMIndex(const std::string& base, int sa_sparse = 1, bool verbose = true)
-        : sparseSA(sa_sparse) {
+    FMIndex(const std::string& base, int sa_sparse = 1, bool verbose = true,
+            OccTableLayout layout = BITVECTORS,
+            SASampling sampling = SAMPLE_SA_INDEX)
+        : sparseSA(sa_sparse, sampling), layout(layout) {
         read(base, verbose);
     }
 
+    /**
+     * Constructor, creates the index from an already constructed suffix
+     * array instead of reading <base>.sa or <base>.fmi
+     * @param base the base name of the index, <base>.txt is read
+     * @param sa the (dense) suffix array of the text
+     * @param layout the layout of the occurrence table
+     * @param sampling the sampling strategy of the sparse suffix array
+     */
+    FMIndex(const std::string& base, const std::vector<length_t>& sa,
+            int sa_sparse = 1, bool verbose = true,
+            OccTableLayout layout = BITVECTORS,
+            SASampling sampling = SAMPLE_SA_INDEX)
+        : sparseSA(sa_sparse, sampling), layout(layout) {
+        readTextFile(base, verbose);
+        createFromSA(sa, verbose);
+    }
+
+    /**
+     * Write the BWT, counts, alphabet, occTable and sparse suffix array to
+     * the index file <base>.fmi, such that subsequent constructions of the
+     * index can skip reading the suffix array
+     * @param base the base name of the index
+     */
+    void write(const std::string& base) const;
+
+    /**
+     * Create the lookup table with the range over the SA of every k-mer, such
+     * that exact matching can skip the first k backward search steps. The
+     * table is written to the index file by write().
+     * @param k the length of the k-mers
+     * @param maxBytes the memory budget of the table, k is lowered until the
+     * table fits (no table is created if even k = 1 does not fit)
+     */
+    void createKmerTable(length_t k, uint64_t maxBytes);
+
     /**
      * Create the BWT from the SA and the text
      * @param sa the (dense) suffix array
@@ -435,14 +786,85 @@ class FMIndex {
         return text.substr(occ.getRange().getBegin(), occ.getRange().width());
     }
 
-    const std::string& getBWT() const {
-        return bwt;
+    /**
+     * Get a copy of the BWT, the index itself may point into the mapped
+     * index file
+     */
+    std::string getBWT() const {
+        return std::string(bwt, textLength);
     }
 
+    /**
+     * Computes the checksum of a text, which is stored in the index files to
+     * detect that they belong to a different text of the same length
+     * @param data the text
+     * @param n the length of the text
+     */
+    static uint64_t checksum(const char* data, size_t n);
+
     const std::array<length_t, ALPHABET>& getCounts() const {
         return counts;
     };
 
+    OccTableLayout getOccTableLayout() const {
+        return layout;
+    }
+
+    const SparseSuffixArray& getSparseSA() const {
+        return sparseSA;
+    }
+
+    const KmerTable& getKmerTable() const {
+        return kmerTable;
+    }
+
+    const ContigTable& getContigs() const {
+        return contigs;
+    }
+
+    /**
+     * Limit the number of occurrences that are located. If a search has more
+     * than maxOcc occurrences (rows in the SA), e.g. for a read in a repeat,
+     * only the count and numSamples occurrences are reported, which saves
+     * locating all rows of the ranges. Applies to matchExact,
+     * naiveApproxMatch, filterRedundantMatches and hence
+     * SearchScheme::matchApprox. Set the cap before the index is shared by
+     * multiple threads.
+     * @param maxOcc the maximal number of located occurrences, 0 for no limit
+     * @param numSamples the number of occurrences that are located for a
+     * search with more than maxOcc occurrences
+     */
+    void setOccurrenceCap(length_t maxOcc, length_t numSamples = 3) {
+        this->maxOcc = maxOcc;
+        this->numSamples = std::max<length_t>(1, numSamples);
+    }
+
+    length_t getOccurrenceCap() const {
+        return maxOcc;
+    }
+
+    /**
+     * Switch from the index to the text when a search has few candidates
+     * left. Once the range of a node in the search tree of matchExact,
+     * naiveApproxMatch or BiFMIndex::recApproxMatch has at most width rows,
+     * the rows are located and the rest of the pattern is verified against
+     * the text, which is far cheaper than extending the ranges with rank
+     * queries. The occurrences are the same, but approximate occurrences
+     * that were verified in the text are located already: their range is a
+     * text position instead of suffix array rows (see FMOcc::isLocated), so
+     * callers that use the rows must keep the width at 0.
+     * Set the width before the index is shared by multiple threads.
+     * @param width the maximal width of the range of a node whose rows are
+     * verified in the text, 0 to search the index only (default 0)
+     */
+    void setVerificationWidth(length_t width) {
+        verifyWidth = width;
+    }
+
+    length_t getVerificationWidth() const {
+        return verifyWidth;
+    }
+
     /**
      * Takes the reverse complement
      * @param s the string to take the reverse complement of
@@ -468,6 +890,17 @@ class FMIndex {
      * @param index the index for the occ query
      */
     length_t occ(const length_t& charIdx, const length_t& index) const;
+    /**
+     * Fused occ function, gets the occurrence counts of all characters at
+     * both bounds of a range in a single call. Work is shared when both
+     * bounds fall in the same block of the occurrence table.
+     * @param range the range [b, e[ for the occ queries
+     * @param occBegin occ(c, b) for every character index c [output]
+     * @param occEnd occ(c, e) for every character index c [output]
+     */
+    void occAll(const Range& range, std::array<length_t, ALPHABET>& occBegin,
+                std::array<length_t, ALPHABET>& occEnd) const;
+
     /**
      * Finds the LF mapping of the character at index k in the bwt string
      * @param k the index to find the LF mapping off
@@ -476,7 +909,8 @@ class FMIndex {
     length_t findLF(length_t k) const;
 
     /**
-     * Finds the entry in the suffix array of this index.
+     * Finds the entry in the suffix array of this index. With the
+     * SAMPLE_TEXT_POSITION sampling, at most s - 1 LF steps are needed.
      * @param k the index to find the entry in the SA off
      * @returns the entry in the SA of the index
      */
@@ -497,19 +931,41 @@ class FMIndex {
     // ============================================================================
 
     /**
-     * This function matches a string exactly
+     * This function matches a string exactly, matches that span the boundary
+     * of two contigs are discarded
+     * @param str the string to match
+     * @returns the start positions of the exact matches of str in the text
+     */
+    std::vector<length_t> matchExact(const std::string& str) const {
+        length_t numOcc;
+        return matchExact(str, numOcc);
+    }
+
+    /**
+     * Matches a string exactly like matchExact(str), and counts its
+     * occurrences. If there are more than the occurrence cap (see
+     * setOccurrenceCap), only a sample of them is located.
      * @param str the string to match
-     * @returns the sorted start positions of the exact matches of str in the
-     * text
+     * @param numOcc the number of occurrences, including those that span
+     * two contigs [output]
+     * @returns the start positions of the (sampled) exact matches of str
      */
-    std::vector<length_t> matchExact(const std::string& str) const;
+    std::vector<length_t> matchExact(const std::string& str,
+                                     length_t& numOcc) const;
 
     /**
      * Finds the best paired match of a pair of reads, given the insertion size.
+     * Both reads of the pair must lie in the same contig, the forward read
+     * upstream of the reverse complement of the other read. The exact
+     * matches are paired with a PairFinder (see pairing.h), use that class
+     * directly for approximate matches or a bounded insert-size window.
      * @param reads  a pair of reads to be matched, one against the forward
      * strand and one against the backward strand.
      * @param meanInsSize the average distance between the two extreme ends of
      * the reads closest together.
+     * @returns the positions of the first and second read and whether the
+     * second read is the reverse complement, (0, 0, false) if the reads do
+     * not form a pair
      */
     std::tuple<length_t, length_t, bool>
     bestPairedMatch(const std::pair<std::string, std::string>& reads,
@@ -533,14 +989,28 @@ class FMIndex {
      * Creates all child positions of the position and pushes them on the stack
      * @param range, the range of the position to get the children of
      * @param depth, the depth of the position to get the children of
-     * @param stack, the stack to push the children on
+     * @param stack, the stack to push the children on, a vector of FMPosExt
+     * or a SearchStack
      */
+    template <class Stack>
     void extendFMPos(const Range& range, const length_t& depth,
-                     std::vector<FMPosExt>& stack) const;
+                     Stack& stack) const;
 
     void convertFMOccToTextOcc(const FMOcc& fmocc,
                                std::vector<TextOcc>& textOcc) const;
 
+    /**
+     * Finds the entries in the suffix array of all rows of a number of ranges.
+     * Every distinct row is located once, and the LF walks of up to
+     * LOCATE_BATCH rows are interleaved such that their memory accesses
+     * overlap.
+     * @param ranges the ranges over the SA to locate
+     * @param positions the entries in the SA of the rows of all ranges, in
+     * the order of the ranges [output]
+     */
+    void locateRanges(const std::vector<Range>& ranges,
+                      std::vector<length_t>& positions) const;
+
     // ============================================================================
     // INTEGRATION WEEK 2
     // ============================================================================
@@ -553,16 +1023,78 @@ class FMIndex {
      * @returns a vector with occurrences in the text
      */
     std::vector<TextOcc> naiveApproxMatch(const std::string& pattern,
-                                          length_t k) const;
+                                          length_t k) const {
+        length_t numOcc;
+        return naiveApproxMatch(pattern, k, numOcc);
+    }
+
+    /**
+     * Matches the pattern approximately like naiveApproxMatch(pattern, k)
+     * and counts the occurrences (see filterRedundantMatches)
+     * @param numOcc the number of occurrences [output]
+     */
+    std::vector<TextOcc> naiveApproxMatch(const std::string& pattern,
+                                          length_t k, length_t& numOcc) const;
+
+    /**
+     * Searches the pattern approximately like naiveApproxMatch, without
+     * locating the occurrences in the text (see filterRedundantMatches)
+     * @param pattern the pattern to match
+     * @param k the maximum edit distance
+     * @param occ the occurrences in the FM-index are appended [output]
+     */
+    void naiveApproxSearch(const std::string& pattern, length_t k,
+                           std::vector<FMOcc>& occ) const {
+        naiveSearch(pattern, k, false, 0, occ);
+    }
+
+    /**
+     * Searches only the best stratum of the pattern like
+     * SearchScheme::searchBestStratum, with the search of naiveApproxSearch
+     * in a single pass: the children of a node are visited in the order of
+     * their lower bound, such that the best occurrences tend to be found
+     * early, and then only the nodes that may still reach the best distance
+     * plus extraStrata are visited.
+     * @param pattern the pattern to match
+     * @param k the maximum edit distance
+     * @param occ the occurrences with at most the best distance plus
+     * extraStrata are appended [output]
+     * @param extraStrata the number of strata after the best one
+     * @returns the edit distance of the best stratum, k + 1 if the pattern
+     * does not occur with at most k errors
+     */
+    length_t naiveBestSearch(const std::string& pattern, length_t k,
+                             std::vector<FMOcc>& occ,
+                             length_t extraStrata = 0) const {
+        return naiveSearch(pattern, k, true, extraStrata, occ);
+    }
 
     /**
-     * Helper function wich filters out redundant matches
+     * Helper function wich filters out redundant matches and matches that
+     * span the boundary of two contigs
      * @param fmocc a vector with occurrences in the fmindex
      * @param k the maximal allowed edit distance
-     * @returns a vector with all non-redundant occurrence in the text
+     * @returns a vector with all non-redundant occurrence in the text, with
+     * their contig
+     */
+    std::vector<TextOcc> filterRedundantMatches(std::vector<FMOcc>& fmocc,
+                                                const length_t& k) const {
+        length_t numOcc;
+        return filterRedundantMatches(fmocc, k, numOcc);
+    }
+
+    /**
+     * Filters out redundant matches like filterRedundantMatches(fmocc, k)
+     * and counts the occurrences. If the ranges with the lowest distance
+     * have more rows than the occurrence cap (see setOccurrenceCap), only a
+     * sample of these rows is located.
+     * @param numOcc the number of returned occurrences, or the number of
+     * rows with the lowest distance if they exceed the occurrence cap
+     * [output]
      */
     std::vector<TextOcc> filterRedundantMatches(std::vector<FMOcc>& fmocc,
-                                                const length_t& k) const;
+                                                const length_t& k,
+                                                length_t& numOcc) const;
 };
 
 #endif
@@ -0,0 +1,290 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+/**
+ * Versioned on-disk container for the FM-index data structures. A file
+ * consists of a fixed header, a number of 64-byte aligned sections and a
+ * section table at the end of the file. Each section is identified by a short
+ * tag. The file is opened with mmap such that the bitvectors and the sparse
+ * suffix array can point directly into the mapped memory (zero-copy).
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define INDEXFILE_VERSION 1
+
+// ============================================================================
+// STRUCT INDEXFILEHEADER / INDEXFILESECTION
+// ============================================================================
+
+struct IndexFileHeader {
+    char magic[8];        // "FMINDEX" followed by a zero byte
+    uint32_t version;     // INDEXFILE_VERSION
+    uint32_t numSections; // the number of sections in the file
+    uint64_t tableOffset; // offset of the section table in the file
+};
+
+struct IndexFileSection {
+    char tag[8];     // the tag of the section (zero padded)
+    uint64_t offset; // offset of the section in the file
+    uint64_t size;   // size of the section in bytes
+};
+
+// ============================================================================
+// CLASS INDEXFILEWRITER
+// ============================================================================
+
+class IndexFileWriter {
+  private:
+    std::string filename;                   // the name of the file
+    std::ofstream ofs;                      // the output filestream
+    std::vector<IndexFileSection> sections; // the sections written so far
+    uint64_t sectionBegin;                  // begin of the open section
+
+    /**
+     * Pad the output filestream with zeros up to a multiple of 64 bytes
+     */
+    void align() {
+        static const char zeros[64] = {};
+        uint64_t pos = ofs.tellp();
+        if (pos % 64 != 0)
+            ofs.write(zeros, 64 - pos % 64);
+    }
+
+  public:
+    /**
+     * Constructor, creates a temporary file and reserves space for the
+     * header. The temporary file replaces the target file on close(), such
+     * that an index that is currently mapped from the target file can safely
+     * be written.
+     * @param filename Name of the file to create
+     */
+    IndexFileWriter(const std::string& filename)
+        : filename(filename), ofs(filename + ".tmp", std::ios::binary),
+          sectionBegin(0) {
+        if (!ofs)
+            throw std::runtime_error("Cannot open file: " + filename + ".tmp");
+        IndexFileHeader header = {};
+        ofs.write((char*)&header, sizeof(header));
+    }
+
+    /**
+     * Start a new section, everything written to the stream until the next
+     * call to endSection() belongs to this section
+     * @param tag Tag of the section (at most 7 characters)
+     * @returns the output filestream
+     */
+    std::ofstream& beginSection(const std::string& tag) {
+        assert(tag.size() < 8);
+        align();
+        IndexFileSection s = {};
+        strncpy(s.tag, tag.c_str(), sizeof(s.tag) - 1);
+        s.offset = sectionBegin = ofs.tellp();
+        sections.push_back(s);
+        return ofs;
+    }
+
+    /**
+     * Close the current section
+     */
+    void endSection() {
+        sections.back().size = (uint64_t)ofs.tellp() - sectionBegin;
+    }
+
+    /**
+     * Write a complete section that consists of a single memory region
+     * @param tag Tag of the section
+     * @param data Pointer to the data
+     * @param size Size of the data in bytes
+     */
+    void writeSection(const std::string& tag, const void* data, size_t size) {
+        beginSection(tag).write((const char*)data, size);
+        endSection();
+    }
+
+    /**
+     * Write the section table and the header and close the file
+     */
+    void close() {
+        align();
+        IndexFileHeader header = {};
+        strncpy(header.magic, "FMINDEX", sizeof(header.magic));
+        header.version = INDEXFILE_VERSION;
+        header.numSections = sections.size();
+        header.tableOffset = ofs.tellp();
+
+        ofs.write((char*)sections.data(),
+                  sections.size() * sizeof(IndexFileSection));
+        ofs.seekp(0, std::ios::beg);
+        ofs.write((char*)&header, sizeof(header));
+        ofs.close();
+        if (!ofs || rename((filename + ".tmp").c_str(), filename.c_str()) != 0)
+            throw std::runtime_error("Problem writing: " + filename);
+    }
+};
+
+// ============================================================================
+// CLASS MAPPEDINDEXFILE
+// ============================================================================
+
+class MappedIndexFile {
+  private:
+    const char* data;                       // start of the mapping
+    size_t size;                            // size of the mapping
+    std::vector<IndexFileSection> sections; // the section table
+
+    void unmap() {
+        if (data != nullptr)
+            munmap((void*)data, size);
+        data = nullptr;
+        size = 0;
+        sections.clear();
+    }
+
+  public:
+    /**
+     * Default constructor, nothing is mapped
+     */
+    MappedIndexFile() : data(nullptr), size(0) {
+    }
+
+    /**
+     * Move constructor and move assignment operator, the mapping itself
+     * does not move, so views into it remain valid
+     */
+    MappedIndexFile(MappedIndexFile&& rhs)
+        : data(rhs.data), size(rhs.size), sections(std::move(rhs.sections)) {
+        rhs.data = nullptr;
+        rhs.size = 0;
+    }
+
+    MappedIndexFile& operator=(MappedIndexFile&& rhs) {
+        if (this != &rhs) {
+            unmap();
+            data = rhs.data;
+            size = rhs.size;
+            sections = std::move(rhs.sections);
+            rhs.data = nullptr;
+            rhs.size = 0;
+        }
+        return *this;
+    }
+
+    MappedIndexFile(const MappedIndexFile&) = delete;
+    MappedIndexFile& operator=(const MappedIndexFile&) = delete;
+
+    ~MappedIndexFile() {
+        unmap();
+    }
+
+    /**
+     * Map an index file into memory and validate its header
+     * @param filename Name of the file
+     * @returns True if successful, false if the file does not exist, has
+     * an incompatible version or a section table that does not fit the file
+     */
+    bool open(const std::string& filename) {
+        unmap();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+            (size_t)st.st_size < sizeof(IndexFileHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED)
+            return false;
+
+        data = (const char*)ptr;
+        size = st.st_size;
+
+        const IndexFileHeader* header = (const IndexFileHeader*)data;
+        if (strncmp(header->magic, "FMINDEX", sizeof(header->magic)) != 0 ||
+            header->version != INDEXFILE_VERSION ||
+            header->tableOffset > size ||
+            header->numSections >
+                (size - header->tableOffset) / sizeof(IndexFileSection)) {
+            unmap();
+            return false;
+        }
+
+        const IndexFileSection* table =
+            (const IndexFileSection*)(data + header->tableOffset);
+        sections.assign(table, table + header->numSections);
+
+        // every section must lie within the file
+        for (const auto& s : sections) {
+            if (s.offset > size || s.size > size - s.offset) {
+                unmap();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Check whether a file is mapped
+     */
+    bool isOpen() const {
+        return data != nullptr;
+    }
+
+    /**
+     * Check whether the mapped file contains a section
+     * @param tag Tag of the section
+     */
+    bool hasSection(const std::string& tag) const {
+        for (const auto& s : sections)
+            if (strncmp(s.tag, tag.c_str(), sizeof(s.tag)) == 0)
+                return true;
+        return false;
+    }
+
+    /**
+     * Get a pointer to a section in the mapped file
+     * @param tag Tag of the section
+     * @param sectionSize Size of the section in bytes [output]
+     * @returns Pointer to the start of the section
+     */
+    const char* section(const std::string& tag, size_t& sectionSize) const {
+        for (const auto& s : sections) {
+            if (strncmp(s.tag, tag.c_str(), sizeof(s.tag)) == 0) {
+                sectionSize = s.size;
+                return data + s.offset;
+            }
+        }
+        throw std::runtime_error("Index file does not contain section " +
+                                 tag);
+    }
+
+    /**
+     * Get a pointer to a section in the mapped file
+     * @param tag Tag of the section
+     * @returns Pointer to the start of the section
+     */
+    const char* section(const std::string& tag) const {
+        size_t sectionSize;
+        return section(tag, sectionSize);
+    }
+};
+
+#endif
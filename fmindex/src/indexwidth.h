@@ -0,0 +1,21 @@
+#ifndef INDEXWIDTH_H
+#define INDEXWIDTH_H
+
+/**
+ * The integer type of positions in the text and entries of the suffix array.
+ * By default 32 bit, which supports texts of up to 2^32 - 1 characters.
+ * Compile with -DINDEX_64BIT (the *64 targets) to index larger texts, at the
+ * cost of twice the memory for the suffix array samples, counts and k-mer
+ * tables. Index files record the width and are only mapped by a build of the
+ * same width.
+ */
+
+#include <cstdint>
+
+#ifdef INDEX_64BIT
+typedef uint64_t length_t;
+#else
+typedef uint32_t length_t;
+#endif
+
+#endif
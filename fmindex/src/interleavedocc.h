@@ -0,0 +1,257 @@
+#ifndef INTERLEAVEDOCC_H
+#define INTERLEAVEDOCC_H
+
+/**
+ * Cache-line-interleaved occurrence table for the DNA alphabet. The BWT is
+ * divided in blocks of 192 characters. Each block occupies exactly one 64-byte
+ * cache line and contains the occurrence counts of A, C, G and T before the
+ * block (4 x 32 bit) followed by the 2-bit codes of the 192 characters of the
+ * block, stored as two bit planes of 3 words each. An occ query for any
+ * character at any position hence touches a single cache line.
+ *
+ * The '$' character is stored with the code of 'A' and corrected for at query
+ * time using the position of the '$' in the BWT.
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+
+#define INTERLEAVED_BLOCK_CHARS 192 // number of characters per block
+#define INTERLEAVED_BLOCK_WORDS 8   // number of 64-bit words per block
+
+class InterleavedOccTable {
+  private:
+    uint64_t N;                // number of characters in the BWT
+    uint64_t dollarPos;        // position of the '$' in the BWT
+    uint64_t numBlocks;        // number of blocks
+    std::vector<uint64_t> mem; // storage (with room for alignment)
+    const uint64_t* blocks;    // 64-byte aligned blocks (in mem or mapped)
+
+    /**
+     * Get the occurrence count of code c before the block
+     * @param block pointer to the block
+     * @param c the 2-bit code of the character
+     */
+    static uint64_t blockCount(const uint64_t* block, int c) {
+        return (block[c / 2] >> (32 * (c % 2))) & 0xFFFFFFFFull;
+    }
+
+    /**
+     * Get a bitmask of the positions in a word of the block that contain c
+     * @param block pointer to the block
+     * @param w the word index within the block (0, 1 or 2)
+     * @param c the 2-bit code of the character
+     */
+    static uint64_t matchMask(const uint64_t* block, int w, int c) {
+        uint64_t loPattern = -(uint64_t)(c & 1);
+        uint64_t hiPattern = -(uint64_t)(c >> 1);
+        return ~(block[2 + w] ^ loPattern) & ~(block[5 + w] ^ hiPattern);
+    }
+
+    /**
+     * Get a bitmask that selects the positions before r in a word of a block
+     * @param r the position within the block
+     * @param w the word index within the block (0, 1 or 2)
+     */
+    static uint64_t prefixMask(uint64_t r, int w) {
+        if (r <= 64ull * w)
+            return 0ull;
+        if (r >= 64ull * (w + 1))
+            return ~0ull;
+        return (1ull << (r % 64)) - 1;
+    }
+
+    /**
+     * Add the occurrence counts of all characters at positions [0, r[ within
+     * a block. All four counts are derived from three popcounts per word.
+     * These are scalar POPCNT instructions: a block has only three words per
+     * bit plane, too few for a SIMD popcount to pay off.
+     * @param block pointer to the block
+     * @param r the position within the block
+     * @param occs the counts to add to (indexed by 2-bit code)
+     */
+    static void addBlockCounts(const uint64_t* block, uint64_t r,
+                               uint64_t occs[4]) {
+        uint64_t c1 = 0, c2 = 0, c3 = 0;
+        for (int w = 0; w < 3; w++) {
+            uint64_t mask = prefixMask(r, w);
+            uint64_t lo = block[2 + w] & mask, hi = block[5 + w] & mask;
+            c1 += __builtin_popcountll(lo & ~hi);
+            c2 += __builtin_popcountll(hi & ~lo);
+            c3 += __builtin_popcountll(lo & hi);
+        }
+        occs[0] += r - c1 - c2 - c3;
+        occs[1] += c1;
+        occs[2] += c2;
+        occs[3] += c3;
+    }
+
+  public:
+    /**
+     * Default constructor, empty table
+     */
+    InterleavedOccTable()
+        : N(0), dollarPos(0), numBlocks(0), blocks(nullptr) {
+    }
+
+    /**
+     * Move constructor and move assignment operator, the blocks do not move
+     */
+    InterleavedOccTable(InterleavedOccTable&& rhs) = default;
+    InterleavedOccTable& operator=(InterleavedOccTable&& rhs) = default;
+
+    /**
+     * Deleted copy constructor and copy assignment operator
+     */
+    InterleavedOccTable(const InterleavedOccTable&) = delete;
+    InterleavedOccTable& operator=(const InterleavedOccTable&) = delete;
+
+    /**
+     * Constructor
+     * @param sigma Alphabet ('$' + 4 characters)
+     * @param bwt the Burrows-Wheeler transform
+     */
+    template <size_t S>
+    InterleavedOccTable(const Alphabet<S>& sigma, const std::string& bwt)
+        : N(bwt.size()), dollarPos(bwt.size()),
+          numBlocks(bwt.size() / INTERLEAVED_BLOCK_CHARS + 1) {
+        static_assert(S == 5, "InterleavedOccTable requires a DNA alphabet");
+        // the counts before each block are stored with 32 bits
+        if (N > 0xFFFFFFFFull)
+            throw std::runtime_error("The interleaved occurrence table "
+                                     "supports at most 2^32 - 1 characters");
+        // allocate one extra block to be able to align to 64 bytes
+        mem.assign((numBlocks + 1) * INTERLEAVED_BLOCK_WORDS, 0ull);
+        uint64_t* b = mem.data();
+        while (((uintptr_t)b) % 64 != 0)
+            b++;
+        blocks = b;
+
+        uint64_t cnt[4] = {0, 0, 0, 0};
+        for (uint64_t i = 0; i < N; i++) {
+            uint64_t* block = b + (i / INTERLEAVED_BLOCK_CHARS) *
+                                      INTERLEAVED_BLOCK_WORDS;
+            uint64_t r = i % INTERLEAVED_BLOCK_CHARS;
+            if (r == 0) {
+                block[0] = cnt[0] | (cnt[1] << 32);
+                block[1] = cnt[2] | (cnt[3] << 32);
+            }
+
+            int c = 0;
+            if (bwt[i] == '$')
+                dollarPos = i;
+            else
+                c = sigma.c2i(bwt[i]) - 1;
+
+            block[2 + r / 64] |= (uint64_t)(c & 1) << (r % 64);
+            block[5 + r / 64] |= (uint64_t)(c >> 1) << (r % 64);
+            cnt[c]++;
+        }
+
+        // counts of the final block if it is empty
+        if (N % INTERLEAVED_BLOCK_CHARS == 0) {
+            uint64_t* block = b + (numBlocks - 1) * INTERLEAVED_BLOCK_WORDS;
+            block[0] = cnt[0] | (cnt[1] << 32);
+            block[1] = cnt[2] | (cnt[3] << 32);
+        }
+    }
+
+    /**
+     * Get the number of occurrences of a character in BWT[0...i[
+     * @param c the 2-bit code of the character (character index minus one)
+     * @param i the position (0 <= i <= N)
+     */
+    uint64_t occ(int c, uint64_t i) const {
+        assert(i <= N);
+        const uint64_t* block =
+            blocks + (i / INTERLEAVED_BLOCK_CHARS) * INTERLEAVED_BLOCK_WORDS;
+        uint64_t r = i % INTERLEAVED_BLOCK_CHARS;
+
+        uint64_t result = blockCount(block, c);
+        for (int w = 0; w < 3; w++)
+            result += __builtin_popcountll(matchMask(block, w, c) &
+                                           prefixMask(r, w));
+
+        // the '$' is stored as an 'A'
+        if (c == 0 && i > dollarPos)
+            result--;
+        return result;
+    }
+
+    /**
+     * Get the number of occurrences of all characters in BWT[0...b[ and in
+     * BWT[0...e[. If b and e fall in the same block, the block is only
+     * visited once.
+     * @param b the first position (b <= e)
+     * @param e the second position (e <= N)
+     * @param occB occ(c, b) for every 2-bit code c [output]
+     * @param occE occ(c, e) for every 2-bit code c [output]
+     */
+    void occAllPair(uint64_t b, uint64_t e, uint64_t occB[4],
+                    uint64_t occE[4]) const {
+        assert(b <= e && e <= N);
+        const uint64_t* blockB =
+            blocks + (b / INTERLEAVED_BLOCK_CHARS) * INTERLEAVED_BLOCK_WORDS;
+        for (int c = 0; c < 4; c++)
+            occB[c] = blockCount(blockB, c);
+
+        if (b / INTERLEAVED_BLOCK_CHARS == e / INTERLEAVED_BLOCK_CHARS) {
+            for (int c = 0; c < 4; c++)
+                occE[c] = occB[c];
+            addBlockCounts(blockB, e % INTERLEAVED_BLOCK_CHARS, occE);
+        } else {
+            const uint64_t* blockE = blocks + (e / INTERLEAVED_BLOCK_CHARS) *
+                                                  INTERLEAVED_BLOCK_WORDS;
+            for (int c = 0; c < 4; c++)
+                occE[c] = blockCount(blockE, c);
+            addBlockCounts(blockE, e % INTERLEAVED_BLOCK_CHARS, occE);
+        }
+        addBlockCounts(blockB, b % INTERLEAVED_BLOCK_CHARS, occB);
+
+        // the '$' is stored as an 'A'
+        occB[0] -= (b > dollarPos) ? 1 : 0;
+        occE[0] -= (e > dollarPos) ? 1 : 0;
+    }
+
+    /**
+     * Write the table to an open filestream
+     * @param ofs Open output filestream
+     */
+    void write(std::ofstream& ofs) const {
+        uint64_t header[8] = {N, dollarPos, numBlocks, 0, 0, 0, 0, 0};
+        ofs.write((char*)header, sizeof(header));
+        ofs.write((char*)blocks,
+                  numBlocks * INTERLEAVED_BLOCK_WORDS * sizeof(uint64_t));
+    }
+
+    /**
+     * Let the table point to a memory region that was written by write().
+     * No data is copied, the region must be 64-byte aligned and must outlive
+     * this object.
+     * @param ptr Pointer to the serialized table
+     */
+    void map(const char* ptr) {
+        const uint64_t* header = (const uint64_t*)ptr;
+        N = header[0];
+        dollarPos = header[1];
+        numBlocks = header[2];
+        mem.clear();
+        blocks = header + 8;
+        assert(((uintptr_t)blocks) % 64 == 0);
+    }
+
+    /**
+     * Get the number of bytes used by the table
+     */
+    uint64_t memoryUsage() const {
+        return numBlocks * INTERLEAVED_BLOCK_WORDS * sizeof(uint64_t);
+    }
+};
+
+#endif
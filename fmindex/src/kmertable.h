@@ -0,0 +1,164 @@
+#ifndef KMERTABLE_H
+#define KMERTABLE_H
+
+/**
+ * Lookup table that stores a fixed number of values (fields) for every k-mer
+ * over the DNA alphabet {A, C, G, T}. The FM-index stores the range over the
+ * suffix array of each k-mer, such that exact matching can start at depth k
+ * instead of performing the first k backward search steps.
+ *
+ * A k-mer is encoded with 2 bits per character, the first character in the
+ * most significant bits. The codes hence follow the lexicographic order.
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "alphabet.h"
+
+class KmerTable {
+  private:
+    length_t k;                // the length of the k-mers (0 = no table)
+    length_t fields;           // the number of values per k-mer
+    std::vector<length_t> mem; // storage (if not mapped)
+    const length_t* entries;   // the values (in mem or mapped)
+
+  public:
+    /**
+     * Default constructor, empty table
+     */
+    KmerTable() : k(0), fields(0), entries(nullptr) {
+    }
+
+    /**
+     * Constructor, all values are initialized to zero
+     * @param k the length of the k-mers
+     * @param fields the number of values per k-mer
+     */
+    KmerTable(length_t k, length_t fields)
+        : k(k), fields(fields), mem(numKmers(k) * fields, 0) {
+        entries = mem.data();
+    }
+
+    /**
+     * Move constructor and move assignment operator, the entries do not move
+     */
+    KmerTable(KmerTable&& rhs) = default;
+    KmerTable& operator=(KmerTable&& rhs) = default;
+
+    /**
+     * Deleted copy constructor and copy assignment operator
+     */
+    KmerTable(const KmerTable&) = delete;
+    KmerTable& operator=(const KmerTable&) = delete;
+
+    /**
+     * Get the number of k-mers
+     * @param k the length of the k-mers
+     */
+    static uint64_t numKmers(length_t k) {
+        return 1ull << (2 * k);
+    }
+
+    /**
+     * Get the largest k <= maxK for which a table fits in a memory budget
+     * @param maxK the maximal length of the k-mers
+     * @param fields the number of values per k-mer
+     * @param maxBytes the memory budget in bytes
+     * @returns the length of the k-mers, 0 if not even 1-mers fit
+     */
+    static length_t fitK(length_t maxK, length_t fields, uint64_t maxBytes) {
+        length_t k = maxK;
+        while (k > 0 && numKmers(k) * fields * sizeof(length_t) > maxBytes)
+            k--;
+        return k;
+    }
+
+    /**
+     * Append a character to the code of a k-mer
+     * @param c the character to append
+     * @param code the code of the k-mer [input/output]
+     * @returns false if c is not one of A, C, G or T
+     */
+    static bool appendChar(char c, uint64_t& code) {
+        uint64_t v;
+        switch (c) {
+        case 'A':
+            v = 0;
+            break;
+        case 'C':
+            v = 1;
+            break;
+        case 'G':
+            v = 2;
+            break;
+        case 'T':
+            v = 3;
+            break;
+        default:
+            return false;
+        }
+        code = (code << 2) | v;
+        return true;
+    }
+
+    /**
+     * Get the length of the k-mers, 0 if the table is empty
+     */
+    length_t getK() const {
+        return k;
+    }
+
+    /**
+     * Get the values of a k-mer
+     * @param code the code of the k-mer
+     */
+    const length_t* operator[](uint64_t code) const {
+        assert(code < numKmers(k));
+        return entries + code * fields;
+    }
+
+    /**
+     * Get the values of a k-mer for writing. Only call this method on a table
+     * that is not mapped.
+     * @param code the code of the k-mer
+     */
+    length_t* operator[](uint64_t code) {
+        assert(code < numKmers(k) && !mem.empty());
+        return mem.data() + code * fields;
+    }
+
+    /**
+     * Write the table to an open filestream
+     * @param ofs Open output filestream
+     */
+    void write(std::ofstream& ofs) const {
+        uint64_t header[2] = {k, fields};
+        ofs.write((char*)header, sizeof(header));
+        ofs.write((char*)entries, numKmers(k) * fields * sizeof(length_t));
+    }
+
+    /**
+     * Let the table point to a memory region that was written by write().
+     * No data is copied, the memory region must outlive this object.
+     * @param ptr Pointer to the serialized table
+     */
+    void map(const char* ptr) {
+        const uint64_t* header = (const uint64_t*)ptr;
+        k = header[0];
+        fields = header[1];
+        mem.clear();
+        entries = (const length_t*)(header + 2);
+    }
+
+    /**
+     * Get the number of bytes used by the table
+     */
+    uint64_t memoryUsage() const {
+        return (k == 0) ? 0 : numKmers(k) * fields * sizeof(length_t);
+    }
+};
+
+#endif
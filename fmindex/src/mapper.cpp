@@ -0,0 +1,458 @@
+#include "bidirectionalfmindex.h"
+#include "fastxreader.h"
+#include "pipeline.h"
+#include "readcache.h"
+#include "samwriter.h"
+#include "searchscheme.h"
+#include <chrono>
+#include <iomanip>
+
+using namespace std;
+
+void showUsage() {
+    cout << "Usage: fmindex-map [options] <base> <reads> [<mates>]\n\n";
+    cout << "Maps the reads of a FASTA or FASTQ file and their reverse "
+            "complements\napproximately to the index <base> with a search "
+            "scheme. Parsing, searching,\nlocating and writing the "
+            "occurrences are pipelined stages that run on their\nown "
+            "threads. Paired-end reads are given as two files (<reads> and "
+            "<mates>) or\nas one interleaved file.\n\n";
+    cout << "  -t <threads>  number of search threads (default: number of "
+            "cores)\n";
+    cout << "  -l <threads>  number of locate threads (default 1)\n";
+    cout << "  -w <threads>  number of output threads (default 1)\n";
+    cout << "  -e <max_ed>   maximal edit distance, 1 to 4 (default 4)\n";
+    cout << "  -s <scheme>   directory of the search scheme (default\n"
+            "                search_schemes/kuch_k+1/)\n";
+    cout << "  -B <strata>   only report the best stratum of occurrences "
+            "and the next\n                <strata> strata (default: all "
+            "occurrences up to <max_ed>)\n";
+    cout << "  -c <max_occ>  only locate a sample of the occurrences of "
+            "reads with more\n                than <max_occ> occurrences "
+            "(default 0: no limit)\n";
+    cout << "  -C <size>     cache the occurrences of duplicate reads, at "
+            "most <size>\n                occurrences (default 0: off)\n";
+    cout << "  -v <width>    verify the candidates in the text once a search "
+            "has at most\n                <width> of them (default 4, 0: "
+            "off)\n";
+    cout << "  -p <sparse>   sparseness factor of the suffix array if "
+            "<base>.fmi is\n                missing (default 32)\n";
+    cout << "  -b <batch>    number of reads (pairs) per batch (default "
+            "1024)\n";
+    cout << "  -i            <reads> contains interleaved paired-end reads\n";
+    cout << "  -I <mean>     mean insert size of the pairs (default 500)\n";
+    cout << "  -S <stddev>   standard deviation of the insert size, 0 for no "
+            "limit\n                (default 100)\n";
+    cout << "  -r <max_ed>   rescue unmapped mates of uniquely mapped reads "
+            "with at most\n                <max_ed> errors in the insert-size "
+            "window (default 0: off)\n";
+    cout << "  -o <file>     write the alignments to a SAM file" << endl;
+}
+
+/**
+ * A batch of reads and the results of every stage for that batch. The
+ * batches are recycled, such that the number of batches in the pipeline and
+ * hence the memory usage is bounded.
+ */
+struct MappingBatch {
+    ReadBatch reads;
+    // the occurrences in the FM-index of the read (2i) and its reverse
+    // complement (2i + 1) of record i
+    vector<vector<FMOcc>> fmOcc;
+    // the located occurrences of the read and its reverse complement
+    vector<vector<TextOcc>> textOcc;
+    // the number of occurrences (rows in the SA if capped)
+    vector<length_t> numOcc;
+    // whether the occurrences of record i were found in the cache
+    vector<bool> cached;
+    string output; // the SAM records of the batch
+};
+
+// the counters of a thread, on separate cache lines to avoid false sharing
+struct alignas(64) ThreadStats {
+    length_t reads = 0;       // the number of reads
+    length_t mapped = 0;      // the number of reads with an occurrence
+    uint64_t occurrences = 0; // the number of occurrences
+    length_t pairs = 0;       // the number of proper pairs
+    length_t rescued = 0;     // the number of rescued mates
+    length_t capped = 0;      // the number of reads with sampled occurrences
+    double busy = 0;          // the time spent on work (in seconds)
+};
+
+/**
+ * Adds the time until it goes out of scope to the busy time of a thread
+ */
+class BusyTimer {
+  private:
+    ThreadStats& stats;
+    chrono::high_resolution_clock::time_point start;
+
+  public:
+    BusyTimer(ThreadStats& stats)
+        : stats(stats), start(chrono::high_resolution_clock::now()) {
+    }
+
+    ~BusyTimer() {
+        chrono::duration<double> t =
+            chrono::high_resolution_clock::now() - start;
+        stats.busy += t.count();
+    }
+};
+
+int main(int argc, char* argv[]) {
+    int searchThreads = thread::hardware_concurrency();
+    int locateThreads = 1;
+    int outputThreads = 1;
+    int maxED = 4;
+    int extraStrata = -1; // -1: report all occurrences up to maxED
+    int maxOcc = 0;
+    int cacheSize = 0;
+    int verifyWidth = 4;
+    string scheme = "search_schemes/kuch_k+1/";
+    int saSparse = 32;
+    int batchSize = 1024;
+    bool interleaved = false;
+    int insertMean = 500;
+    int insertStdDev = 100;
+    int rescueED = 0;
+    string outputFile;
+    bool valid = true;
+    vector<string> files;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-i") {
+            interleaved = true;
+        } else if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+            string value = argv[++i];
+            if (arg == "-t")
+                searchThreads = atoi(value.c_str());
+            else if (arg == "-l")
+                locateThreads = atoi(value.c_str());
+            else if (arg == "-w")
+                outputThreads = atoi(value.c_str());
+            else if (arg == "-e")
+                maxED = atoi(value.c_str());
+            else if (arg == "-B")
+                extraStrata = atoi(value.c_str());
+            else if (arg == "-c")
+                maxOcc = atoi(value.c_str());
+            else if (arg == "-C")
+                cacheSize = atoi(value.c_str());
+            else if (arg == "-v")
+                verifyWidth = atoi(value.c_str());
+            else if (arg == "-s")
+                scheme = value;
+            else if (arg == "-p")
+                saSparse = atoi(value.c_str());
+            else if (arg == "-b")
+                batchSize = atoi(value.c_str());
+            else if (arg == "-I")
+                insertMean = atoi(value.c_str());
+            else if (arg == "-S")
+                insertStdDev = atoi(value.c_str());
+            else if (arg == "-r")
+                rescueED = atoi(value.c_str());
+            else if (arg == "-o")
+                outputFile = value;
+            else
+                valid = false;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (searchThreads <= 0)
+        searchThreads = 1;
+    if (!valid || files.size() < 2 || files.size() > 3 ||
+        (interleaved && files.size() == 3) || locateThreads <= 0 ||
+        outputThreads <= 0 || maxED < 1 || maxED > 4 || saSparse <= 0 ||
+        batchSize <= 0 || maxOcc < 0 || cacheSize < 0 || verifyWidth < 0 ||
+        insertMean <= 0 || insertStdDev < 0 || rescueED < 0 ||
+        (rescueED > 0 && insertStdDev == 0)) {
+        showUsage();
+        return EXIT_FAILURE;
+    }
+    if (scheme.back() != '/')
+        scheme += '/';
+
+    BiFMIndex index(files[0], saSparse, true);
+    index.setOccurrenceCap(maxOcc);
+    index.setVerificationWidth(verifyWidth);
+    SearchScheme ss(index, scheme, maxED);
+    unique_ptr<ReadCache> cache;
+    if (cacheSize > 0)
+        cache.reset(new ReadCache(cacheSize));
+
+    unique_ptr<ReadInput> input((files.size() == 3)
+                                    ? new ReadInput(files[1], files[2])
+                                    : new ReadInput(files[1], interleaved));
+
+    unique_ptr<SamWriter> writer;
+    if (!outputFile.empty()) {
+        string commandLine = argv[0];
+        for (int i = 1; i < argc; i++)
+            commandLine += string(" ") + argv[i];
+        writer.reset(new SamWriter(
+            outputFile,
+            SamFormatter::header(index.getContigs(), commandLine)));
+    }
+    vector<SamFormatter> formatters(outputThreads, SamFormatter(index));
+    vector<PairFinder> pairFinders(outputThreads);
+    InsertSizeDistribution insertSize(insertMean, insertStdDev);
+
+    // enough batches to keep every thread and every queue busy
+    int numThreads = 1 + searchThreads + locateThreads + outputThreads;
+    vector<unique_ptr<MappingBatch>> batches;
+    for (int i = 0; i < 2 * numThreads; i++)
+        batches.emplace_back(new MappingBatch());
+
+    BoundedQueue<MappingBatch*> freeQueue(batches.size());
+    BoundedQueue<MappingBatch*> searchQueue(batches.size());
+    BoundedQueue<MappingBatch*> locateQueue(batches.size());
+    BoundedQueue<MappingBatch*> outputQueue(batches.size());
+    for (const auto& b : batches)
+        freeQueue.push(b.get());
+
+    vector<ThreadStats> parseStats(1), searchStats(searchThreads),
+        locateStats(locateThreads), outputStats(outputThreads);
+
+    auto start = chrono::high_resolution_clock::now();
+    {
+        Pipeline pipeline;
+        pipeline.addQueue(freeQueue);
+        pipeline.addQueue(searchQueue);
+        pipeline.addQueue(locateQueue);
+        pipeline.addQueue(outputQueue);
+
+        // parse: the input is one sequential stream, so this stage has a
+        // single thread
+        pipeline.addStage(
+            1,
+            [&](size_t id) {
+                MappingBatch* b;
+                while (freeQueue.pop(b)) {
+                    {
+                        BusyTimer timer(parseStats[id]);
+                        if (!input->nextBatch(b->reads, batchSize))
+                            return;
+                        parseStats[id].reads += b->reads.size();
+                    }
+                    if (!searchQueue.push(b))
+                        return;
+                }
+            },
+            [&]() { searchQueue.close(); });
+
+        // search: find the occurrences in the FM-index
+        pipeline.addStage(
+            searchThreads,
+            [&](size_t id) {
+                MappingBatch* b;
+                string read;
+                ReadMatches matches;
+                while (searchQueue.pop(b)) {
+                    {
+                        BusyTimer timer(searchStats[id]);
+                        b->fmOcc.resize(2 * b->reads.size());
+                        b->textOcc.resize(b->fmOcc.size());
+                        b->numOcc.resize(b->fmOcc.size());
+                        b->cached.assign(b->reads.size(), false);
+                        for (size_t i = 0; i < b->reads.size(); i++) {
+                            ReadRecord r = b->reads[i];
+                            read.assign(r.seq, r.seqLength);
+                            vector<FMOcc>& fw = b->fmOcc[2 * i];
+                            vector<FMOcc>& rc = b->fmOcc[2 * i + 1];
+                            fw.clear();
+                            rc.clear();
+                            if (cache && cache->lookup(read, maxED, matches)) {
+                                for (size_t s = 0; s < 2; s++) {
+                                    b->textOcc[2 * i + s].swap(matches.occ[s]);
+                                    b->numOcc[2 * i + s] = matches.numOcc[s];
+                                }
+                                b->cached[i] = true;
+                                continue;
+                            }
+                            if (extraStrata < 0) {
+                                ss.searchApprox(read, fw);
+                                ss.searchApprox(index.revCompl(read), rc);
+                                continue;
+                            }
+                            // the best stratum of both strands
+                            length_t best =
+                                ss.searchBestStratum(read, fw, extraStrata);
+                            length_t bestRC = ss.searchBestStratum(
+                                index.revCompl(read), rc, extraStrata,
+                                best + extraStrata);
+                            if (bestRC < best) {
+                                length_t max = bestRC + extraStrata;
+                                fw.erase(remove_if(fw.begin(), fw.end(),
+                                                   [max](const FMOcc& o) {
+                                                       return o.getDistance() >
+                                                              max;
+                                                   }),
+                                         fw.end());
+                            }
+                        }
+                        searchStats[id].reads += b->reads.size();
+                    }
+                    if (!locateQueue.push(b))
+                        return;
+                }
+            },
+            [&]() { locateQueue.close(); });
+
+        // locate: find the positions in the text and filter out redundant
+        // occurrences
+        pipeline.addStage(
+            locateThreads,
+            [&](size_t id) {
+                MappingBatch* b;
+                string read;
+                ReadMatches matches;
+                while (locateQueue.pop(b)) {
+                    {
+                        BusyTimer timer(locateStats[id]);
+                        for (size_t i = 0; i < b->fmOcc.size(); i++) {
+                            if (b->cached[i / 2])
+                                continue;
+                            b->textOcc[i] = index.filterRedundantMatches(
+                                b->fmOcc[i], maxED, b->numOcc[i]);
+                        }
+                        // store the occurrences of the searched reads
+                        for (size_t i = 0; cache && i < b->reads.size(); i++) {
+                            if (b->cached[i])
+                                continue;
+                            ReadRecord r = b->reads[i];
+                            read.assign(r.seq, r.seqLength);
+                            for (size_t s = 0; s < 2; s++) {
+                                matches.occ[s] = b->textOcc[2 * i + s];
+                                matches.numOcc[s] = b->numOcc[2 * i + s];
+                            }
+                            cache->insert(read, maxED, matches);
+                        }
+                        locateStats[id].reads += b->reads.size();
+                    }
+                    if (!outputQueue.push(b))
+                        return;
+                }
+            },
+            [&]() { outputQueue.close(); });
+
+        // output: format the SAM records of a batch into its buffer and
+        // hand the buffer to the writer, the batches are then reused by the
+        // parse stage
+        pipeline.addStage(
+            outputThreads,
+            [&](size_t id) {
+                MappingBatch* b;
+                string mate1, mate2;
+                while (outputQueue.pop(b)) {
+                    {
+                        BusyTimer timer(outputStats[id]);
+                        ThreadStats& s = outputStats[id];
+                        const ReadBatch& reads = b->reads;
+                        auto& occ = b->textOcc;
+                        b->output.clear();
+                        size_t step = reads.isPaired() ? 2 : 1;
+                        for (size_t i = 0; i < reads.size(); i += step) {
+                            if (reads.isPaired()) {
+                                PairFinder& finder = pairFinders[id];
+                                PairedMatch pair = finder.findBestPair(
+                                    occ[2 * i], occ[2 * i + 1],
+                                    occ[2 * i + 2], occ[2 * i + 3],
+                                    insertSize);
+                                if (!pair.valid && rescueED > 0) {
+                                    mate1.assign(reads[i].seq,
+                                                 reads[i].seqLength);
+                                    mate2.assign(reads[i + 1].seq,
+                                                 reads[i + 1].seqLength);
+                                    pair = finder.rescuePair(
+                                        index.getText(), index.getContigs(),
+                                        mate1, occ[2 * i], occ[2 * i + 1],
+                                        mate2, occ[2 * i + 2],
+                                        occ[2 * i + 3], rescueED, insertSize);
+                                    s.rescued += pair.valid;
+                                }
+                                s.pairs += pair.valid;
+                                if (writer)
+                                    formatters[id].formatPair(
+                                        b->output, reads[i], occ[2 * i],
+                                        occ[2 * i + 1], reads[i + 1],
+                                        occ[2 * i + 2], occ[2 * i + 3],
+                                        pair);
+                            } else if (writer) {
+                                formatters[id].formatSingle(
+                                    b->output, reads[i], occ[2 * i],
+                                    occ[2 * i + 1]);
+                            }
+                        }
+                        for (size_t i = 0; i < reads.size(); i++) {
+                            size_t n =
+                                occ[2 * i].size() + occ[2 * i + 1].size();
+                            s.reads++;
+                            s.mapped += (n > 0);
+                            s.occurrences += n;
+                            s.capped += (maxOcc > 0 &&
+                                         (b->numOcc[2 * i] > (length_t)maxOcc ||
+                                          b->numOcc[2 * i + 1] >
+                                              (length_t)maxOcc));
+                        }
+                        if (writer)
+                            writer->submit(reads.getID(), b->output);
+                    }
+                    if (!freeQueue.push(b))
+                        return;
+                }
+            },
+            nullptr);
+
+        pipeline.join();
+    }
+    if (writer)
+        writer->close();
+    chrono::duration<double> elapsed =
+        chrono::high_resolution_clock::now() - start;
+
+    ThreadStats total;
+    for (const auto& s : outputStats) {
+        total.reads += s.reads;
+        total.mapped += s.mapped;
+        total.occurrences += s.occurrences;
+        total.pairs += s.pairs;
+        total.rescued += s.rescued;
+        total.capped += s.capped;
+    }
+
+    double readsPerSecond = total.reads / elapsed.count();
+    cout << "Mapped reads: " << total.mapped << "/" << total.reads << " ("
+         << total.occurrences << " occurrences)\n";
+    if (maxOcc > 0)
+        cout << "Reads with more than " << maxOcc
+             << " occurrences (sampled): " << total.capped << "\n";
+    if (cache)
+        cout << "Duplicate reads (cache hits): " << cache->getHits() << "/"
+             << cache->getHits() + cache->getMisses() << "\n";
+    if (input->isPaired())
+        cout << "Proper pairs: " << total.pairs << "/" << total.reads / 2
+             << " (" << total.rescued << " rescued mates)\n";
+    cout << "Batch size: " << batchSize << "\n";
+    const vector<pair<string, const vector<ThreadStats>*>> stages = {
+        {"parse", &parseStats},
+        {"search", &searchStats},
+        {"locate", &locateStats},
+        {"output", &outputStats}};
+    for (const auto& stage : stages) {
+        double busy = 0;
+        for (const auto& s : *stage.second)
+            busy += s.busy;
+        cout << "  " << left << setw(8) << stage.first + ":" << right
+             << stage.second->size() << " thread(s), " << fixed
+             << setprecision(2) << busy << "s busy\n";
+    }
+    cout << "Total duration: " << fixed << elapsed.count() << "s\n";
+    cout << "Throughput: " << setprecision(0) << readsPerSecond
+         << " reads/s, " << readsPerSecond / searchThreads
+         << " reads/s/search thread" << endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,524 @@
+#ifndef PAIRING_H
+#define PAIRING_H
+
+/**
+ * Pairing of the occurrences of the two mates of a paired-end read. A proper
+ * pair consists of an occurrence of one mate on the forward strand and an
+ * occurrence of the reverse complement of the other mate downstream of it in
+ * the same contig. The insert size of such a pair is the distance from the
+ * begin of the forward occurrence to the end of the reverse occurrence.
+ *
+ * Instead of comparing every occurrence of one mate with every occurrence of
+ * the other mate, the occurrences are merged in the order of their position:
+ * the best partner of a forward occurrence is the reverse occurrence that
+ * ends closest to the begin of the forward occurrence plus the mean insert
+ * size. The reverse occurrences are split per distance and per contig, and
+ * every list has a pointer to the first occurrence that ends at or after the
+ * target. The targets increase with the forward occurrences, so the pointers
+ * only move forward and pairing two mates takes linear time.
+ *
+ * If only one mate has occurrences, e.g. because the other mate has more
+ * errors than the search allowed, the other mate can be rescued: it is
+ * aligned against the window of the text that the insert-size distribution
+ * implies, which is much cheaper than searching the whole index with a
+ * higher edit distance.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bandmatrix.h"
+#include "fmindex.h"
+
+/**
+ * The insert-size distribution of a paired-end library
+ */
+struct InsertSizeDistribution {
+    length_t mean;   // the mean insert size
+    length_t stdDev; // the standard deviation, 0 for no limit
+    double maxDevs;  // the maximal number of standard deviations from mean
+
+    /**
+     * Constructor
+     * @param mean the mean insert size
+     * @param stdDev the standard deviation of the insert size, 0 to accept
+     * all insert sizes
+     * @param maxDevs pairs whose insert size differs more than maxDevs
+     * standard deviations from the mean are no proper pairs
+     */
+    InsertSizeDistribution(length_t mean, length_t stdDev = 0,
+                           double maxDevs = 4)
+        : mean(mean), stdDev(stdDev), maxDevs(maxDevs) {
+    }
+
+    /**
+     * Get the absolute difference between an insert size and the mean
+     */
+    int64_t deviation(int64_t insert) const {
+        return (insert < (int64_t)mean) ? mean - insert : insert - mean;
+    }
+
+    /**
+     * Check whether an insert size is within the window of proper pairs
+     */
+    bool accepts(int64_t insert) const {
+        return stdDev == 0 || deviation(insert) <= maxDevs * stdDev;
+    }
+
+    /**
+     * Check whether the window of proper pairs is bounded (stdDev > 0)
+     */
+    bool isBounded() const {
+        return stdDev > 0;
+    }
+
+    /**
+     * Get the smallest insert size of a proper pair (bounded window only)
+     */
+    int64_t minInsert() const {
+        return std::max<int64_t>(1, std::ceil(mean - maxDevs * stdDev));
+    }
+
+    /**
+     * Get the largest insert size of a proper pair (bounded window only)
+     */
+    int64_t maxInsert() const {
+        return std::floor(mean + maxDevs * stdDev);
+    }
+};
+
+/**
+ * The best pair of occurrences of two mates
+ */
+struct PairedMatch {
+    TextOcc first;     // the occurrence of the first mate
+    TextOcc second;    // the occurrence of the second mate
+    bool secondRev;    // true if the second mate is the reverse one
+    int64_t insert;    // the insert size of the pair
+    bool valid;        // false if the mates do not form a proper pair
+
+    PairedMatch() : secondRev(false), insert(0), valid(false) {
+    }
+
+    /**
+     * Get the total distance of the mates
+     */
+    length_t getDistance() const {
+        return first.getDistance() + second.getDistance();
+    }
+};
+
+/**
+ * Finds the best proper pair of the occurrences of two mates. A finder has
+ * reusable buffers, so every thread should use its own finder.
+ */
+class PairFinder {
+  private:
+    // a run of occurrences in one contig that have the same distance,
+    // sorted on their end position
+    struct Run {
+        length_t distance; // the distance of the occurrences
+        size_t begin, end; // the occurrences in order
+        size_t next;       // the first occurrence that ends at the target
+    };
+
+    std::vector<const TextOcc*> order; // the reverse occurrences per run
+    std::vector<Run> runs;             // the runs of the current contig
+
+    std::string pattern;          // the mate to rescue in text order
+    std::string scanned;          // the pattern in the order of the scan
+    std::vector<length_t> column; // the column of the rescue alignment
+
+    static bool byEnd(const TextOcc* a, const TextOcc* b) {
+        return a->end() < b->end();
+    }
+
+    /**
+     * Split the reverse occurrences of one contig into runs per distance
+     * @param rev the reverse occurrences
+     * @param begin the first occurrence of the contig in rev
+     * @param end the end of the occurrences of the contig in rev
+     */
+    void buildRuns(const std::vector<TextOcc>& rev, size_t begin,
+                   size_t end) {
+        order.clear();
+        runs.clear();
+        for (size_t i = begin; i < end; i++)
+            order.push_back(&rev[i]);
+        // the lists are sorted on their begin position, which keeps the
+        // occurrences of each distance in the order of their begin
+        std::stable_sort(order.begin(), order.end(),
+                         [](const TextOcc* a, const TextOcc* b) {
+                             return a->getDistance() < b->getDistance();
+                         });
+        for (size_t i = 0; i < order.size();) {
+            size_t j = i + 1;
+            while (j < order.size() &&
+                   order[j]->getDistance() == order[i]->getDistance())
+                j++;
+            // occurrences with the same distance have about the same width,
+            // so they are almost sorted on their end position
+            if (!std::is_sorted(order.begin() + i, order.begin() + j, byEnd))
+                std::sort(order.begin() + i, order.begin() + j, byEnd);
+            Run run = {order[i]->getDistance(), i, j, i};
+            runs.push_back(run);
+            i = j;
+        }
+    }
+
+    /**
+     * Consider a pair, it replaces the best pair if it has a lower total
+     * distance, or the same distance and an insert size closer to the mean
+     */
+    static void consider(const TextOcc& fw, const TextOcc& rev, bool fwFirst,
+                         const InsertSizeDistribution& insertSize,
+                         PairedMatch& best) {
+        int64_t insert = (int64_t)rev.end() - (int64_t)fw.begin();
+        if (insert <= 0 || !insertSize.accepts(insert))
+            return;
+        length_t distance = fw.getDistance() + rev.getDistance();
+        if (best.valid) {
+            if (distance > best.getDistance())
+                return;
+            if (distance == best.getDistance() &&
+                insertSize.deviation(insert) >=
+                    insertSize.deviation(best.insert))
+                return;
+        }
+        best.first = fwFirst ? fw : rev;
+        best.second = fwFirst ? rev : fw;
+        best.secondRev = fwFirst;
+        best.insert = insert;
+        best.valid = true;
+    }
+
+    /**
+     * Pair the forward occurrences of one mate with the reverse occurrences
+     * of the other mate
+     * @param fw the forward occurrences, sorted on their begin position
+     * @param rev the reverse occurrences, sorted on their begin position
+     * @param fwFirst true if the forward occurrences are of the first mate
+     * @param insertSize the insert-size distribution
+     * @param best the best pair so far [input/output]
+     */
+    void pairStrands(const std::vector<TextOcc>& fw,
+                     const std::vector<TextOcc>& rev, bool fwFirst,
+                     const InsertSizeDistribution& insertSize,
+                     PairedMatch& best) {
+        size_t i = 0, j = 0;
+        while (i < fw.size() && j < rev.size()) {
+            // merge the occurrences of the same contig
+            length_t contig = fw[i].getContig();
+            if (rev[j].getContig() < contig) {
+                j++;
+                continue;
+            }
+            if (rev[j].getContig() > contig) {
+                i++;
+                continue;
+            }
+            size_t endJ = j;
+            while (endJ < rev.size() && rev[endJ].getContig() == contig)
+                endJ++;
+            buildRuns(rev, j, endJ);
+
+            for (; i < fw.size() && fw[i].getContig() == contig; i++) {
+                int64_t target = (int64_t)fw[i].begin() + insertSize.mean;
+                for (Run& run : runs) {
+                    // skip runs that cannot improve the best pair
+                    if (best.valid &&
+                        fw[i].getDistance() + run.distance > best.getDistance())
+                        continue;
+                    while (run.next < run.end &&
+                           (int64_t)order[run.next]->end() < target)
+                        run.next++;
+                    // the closest end before and at or after the target
+                    if (run.next > run.begin)
+                        consider(fw[i], *order[run.next - 1], fwFirst,
+                                 insertSize, best);
+                    if (run.next < run.end)
+                        consider(fw[i], *order[run.next], fwFirst,
+                                 insertSize, best);
+                }
+            }
+            j = endJ;
+        }
+    }
+
+    static char complement(char c) {
+        switch (c) {
+        case 'A':
+            return 'T';
+        case 'C':
+            return 'G';
+        case 'G':
+            return 'C';
+        case 'T':
+            return 'A';
+        default:
+            return 'N';
+        }
+    }
+
+    /**
+     * Scan a window of the text with a semi-global alignment of the pattern,
+     * in which the pattern is aligned completely and the text can start and
+     * end anywhere in the window. Scanning forward, the scanned position is
+     * the end of an alignment, scanning backward it is the begin.
+     * @param text the text
+     * @param begin the begin of the window
+     * @param end the end of the window (non-inclusive)
+     * @param dir the direction of the scan
+     * @param lo the first position where an alignment may end (begin)
+     * @param hi the last position where an alignment may end (begin)
+     * @param target the preferred position of the end (begin)
+     * @param maxED the maximal edit distance
+     * @param best the end (begin) of the best alignment [output]
+     * @returns the edit distance of the best alignment, maxED + 1 if there
+     * is none
+     */
+    length_t scanWindow(const std::string& text, int64_t begin, int64_t end,
+                        Direction dir, int64_t lo, int64_t hi, int64_t target,
+                        length_t maxED, int64_t& best) {
+        length_t m = pattern.size();
+        // the pattern in the order of the scan
+        scanned.assign(pattern);
+        if (dir == BACKWARD)
+            std::reverse(scanned.begin(), scanned.end());
+
+        // Ukkonen's cut-off: only the rows up to the last row with a value
+        // of at most maxED (lact) are updated, the values below it are
+        // clamped to maxED + 1
+        length_t cap = maxED + 1;
+        column.resize(m + 1);
+        for (length_t i = 0; i <= m; i++)
+            column[i] = std::min(i, cap);
+        length_t lact = std::min(maxED, m);
+
+        length_t bestED = cap;
+        for (int64_t n = 0; n < end - begin; n++) {
+            int64_t pos = (dir == FORWARD) ? begin + n : end - 1 - n;
+            char c = text[pos];
+            // column[0] stays 0: the alignment can start at every position
+            length_t diag = 0, top = std::min(lact + 1, m);
+            for (length_t i = 1; i <= top; i++) {
+                length_t v = std::min(diag + (scanned[i - 1] != c),
+                                      std::min(column[i], column[i - 1]) + 1);
+                diag = column[i];
+                column[i] = std::min(v, cap);
+            }
+            lact = top;
+            while (column[lact] > maxED)
+                lact--;
+
+            int64_t boundary = (dir == FORWARD) ? pos + 1 : pos;
+            if (lact < m || boundary < lo || boundary > hi ||
+                column[m] > bestED)
+                continue;
+            if (column[m] < bestED ||
+                std::abs(boundary - target) < std::abs(best - target)) {
+                bestED = column[m];
+                best = boundary;
+            }
+        }
+        return bestED;
+    }
+
+    /**
+     * Find the other end of an alignment with a known end (begin) and edit
+     * distance with a banded alignment in the opposite direction
+     * @param text the text
+     * @param fixed the end (begin) of the alignment
+     * @param limit the first (last) character of the text that may be used
+     * @param dir the direction of the scan that found fixed
+     * @param ed the edit distance of the alignment
+     * @returns the begin (end) of the alignment
+     */
+    int64_t findOtherEnd(const std::string& text, int64_t fixed,
+                         int64_t limit, Direction dir, length_t ed) {
+        length_t m = pattern.size();
+        if (ed == 0)
+            return (dir == FORWARD) ? fixed - m : fixed + m;
+        Substring p(pattern, (dir == FORWARD) ? BACKWARD : FORWARD);
+        BandedMatrix matrix(m, ed, 0);
+
+        // the rows are the characters of the text away from fixed
+        int64_t available =
+            (dir == FORWARD) ? fixed - limit : limit - fixed + 1;
+        length_t rows = std::min<int64_t>(m + ed, available);
+        length_t bestRow = m, bestED = ed + 1;
+        for (length_t i = 1; i <= rows; i++) {
+            char c = (dir == FORWARD) ? text[fixed - i] : text[fixed + i - 1];
+            matrix.updateMatrixRow(p, i, c);
+            if (i + ed < m || !matrix.inFinalColumn(i))
+                continue;
+            length_t v = matrix.getValueInFinalColumn(i);
+            // prefer the width closest to the length of the pattern
+            if (v < bestED || (v == bestED && (i > m ? i - m : m - i) <
+                                                  (bestRow > m ? bestRow - m
+                                                               : m - bestRow)))
+                bestED = v, bestRow = i;
+        }
+        return (dir == FORWARD) ? fixed - bestRow : fixed + bestRow;
+    }
+
+  public:
+    /**
+     * Find the best proper pair of two mates: the pair with the lowest total
+     * distance and, among those, the insert size closest to the mean. The
+     * occurrences can be approximate, e.g. the result of
+     * FMIndex::filterRedundantMatches, and must be sorted on their begin
+     * position with their contig set.
+     * @param fw1 the occurrences of the first mate
+     * @param rev1 the occurrences of the reverse complement of the first mate
+     * @param fw2 the occurrences of the second mate
+     * @param rev2 the occurrences of the reverse complement of the second
+     * mate
+     * @param insertSize the insert-size distribution of the library
+     * @returns the best pair, invalid if the mates do not form a proper pair
+     */
+    PairedMatch findBestPair(const std::vector<TextOcc>& fw1,
+                             const std::vector<TextOcc>& rev1,
+                             const std::vector<TextOcc>& fw2,
+                             const std::vector<TextOcc>& rev2,
+                             const InsertSizeDistribution& insertSize) {
+        PairedMatch best;
+        pairStrands(fw1, rev2, true, insertSize, best);
+        pairStrands(fw2, rev1, false, insertSize, best);
+        return best;
+    }
+
+    /**
+     * Rescue a mate by aligning it against the text in the window where the
+     * insert-size distribution expects it, given an occurrence of the other
+     * mate (the anchor). The mate lies downstream on the reverse strand of a
+     * forward anchor and upstream on the forward strand of a reverse anchor.
+     * @param text the text of the index
+     * @param contigs the contigs of the text
+     * @param anchor the occurrence of the other mate
+     * @param anchorRev true if anchor is an occurrence of the reverse
+     * complement of the other mate
+     * @param mate the sequence of the mate
+     * @param maxED the maximal edit distance of the rescued mate
+     * @param insertSize the insert-size distribution, it must be bounded
+     * @param rescued the best occurrence in the window: of the reverse
+     * complement of the mate if the anchor is forward, of the mate itself
+     * otherwise [output]
+     * @returns false if the mate does not occur in the window
+     */
+    bool rescueMate(const std::string& text, const ContigTable& contigs,
+                    const TextOcc& anchor, bool anchorRev,
+                    const std::string& mate, length_t maxED,
+                    const InsertSizeDistribution& insertSize,
+                    TextOcc& rescued) {
+        if (!insertSize.isBounded() || mate.empty())
+            return false;
+        int64_t m = mate.size(), k = maxED;
+        int64_t contigBegin = contigs.getStart(anchor.getContig());
+        int64_t contigEnd = contigBegin + contigs.getLength(anchor.getContig());
+        int64_t lo = insertSize.minInsert(), hi = insertSize.maxInsert();
+
+        int64_t begin, end, best = 0;
+        length_t ed;
+        if (!anchorRev) {
+            // the end of the reverse complement lies in [begin + lo,
+            // begin + hi] of the anchor
+            pattern.resize(m);
+            for (int64_t i = 0; i < m; i++)
+                pattern[i] = complement(mate[m - 1 - i]);
+            int64_t a = anchor.begin();
+            begin = std::max(contigBegin, a + lo - m - k);
+            end = std::min(contigEnd, a + hi);
+            ed = scanWindow(text, begin, end, FORWARD, a + lo, a + hi,
+                            a + insertSize.mean, maxED, best);
+            if (ed > maxED)
+                return false;
+            int64_t b = findOtherEnd(text, best, begin, FORWARD, ed);
+            rescued = TextOcc(Range(b, best), ed, anchor.getContig());
+        } else {
+            // the begin of the mate lies in [end - hi, end - lo] of the
+            // anchor
+            pattern = mate;
+            int64_t a = anchor.end();
+            begin = std::max(contigBegin, a - hi);
+            end = std::min(contigEnd, a - lo + m + k);
+            ed = scanWindow(text, begin, end, BACKWARD, a - hi, a - lo,
+                            a - (int64_t)insertSize.mean, maxED, best);
+            if (ed > maxED)
+                return false;
+            int64_t e = findOtherEnd(text, best, end - 1, BACKWARD, ed);
+            rescued = TextOcc(Range(best, e), ed, anchor.getContig());
+        }
+        return true;
+    }
+
+    /**
+     * Rescue the mate without occurrences of a pair whose other mate has a
+     * unique best occurrence (see rescueMate). The rescued occurrence is
+     * added to the occurrences of the mate.
+     * @param text the text of the index
+     * @param contigs the contigs of the text
+     * @param mate1 the sequence of the first mate
+     * @param fw1 the occurrences of the first mate [input/output]
+     * @param rev1 the occurrences of the reverse complement of the first
+     * mate [input/output]
+     * @param mate2 the sequence of the second mate
+     * @param fw2 the occurrences of the second mate [input/output]
+     * @param rev2 the occurrences of the reverse complement of the second
+     * mate [input/output]
+     * @param maxED the maximal edit distance of the rescued mate
+     * @param insertSize the insert-size distribution, it must be bounded
+     * @returns the rescued pair, invalid if no mate was rescued
+     */
+    PairedMatch rescuePair(const std::string& text,
+                           const ContigTable& contigs,
+                           const std::string& mate1,
+                           std::vector<TextOcc>& fw1,
+                           std::vector<TextOcc>& rev1,
+                           const std::string& mate2,
+                           std::vector<TextOcc>& fw2,
+                           std::vector<TextOcc>& rev2, length_t maxED,
+                           const InsertSizeDistribution& insertSize) {
+        bool mapped1 = !fw1.empty() || !rev1.empty();
+        bool mapped2 = !fw2.empty() || !rev2.empty();
+        if (mapped1 == mapped2)
+            return PairedMatch();
+
+        // the unique best occurrence of the mapped mate is the anchor
+        const TextOcc* anchor = nullptr;
+        bool anchorRev = false, unique = false;
+        for (int strand = 0; strand < 2; strand++) {
+            const std::vector<TextOcc>& fw = mapped1 ? fw1 : fw2;
+            const std::vector<TextOcc>& rev = mapped1 ? rev1 : rev2;
+            for (const auto& o : (strand == 0) ? fw : rev) {
+                if (anchor == nullptr ||
+                    o.getDistance() < anchor->getDistance()) {
+                    anchor = &o;
+                    anchorRev = (strand == 1);
+                    unique = true;
+                } else if (o.getDistance() == anchor->getDistance()) {
+                    unique = false;
+                }
+            }
+        }
+        if (!unique)
+            return PairedMatch();
+
+        TextOcc occ;
+        if (!rescueMate(text, contigs, *anchor, anchorRev,
+                        mapped1 ? mate2 : mate1, maxED, insertSize, occ))
+            return PairedMatch();
+        // the mate had no occurrences, so its lists stay sorted
+        if (mapped1)
+            (anchorRev ? fw2 : rev2).push_back(occ);
+        else
+            (anchorRev ? fw1 : rev1).push_back(occ);
+        return findBestPair(fw1, rev1, fw2, rev2, insertSize);
+    }
+};
+
+#endif
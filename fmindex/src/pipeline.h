@@ -0,0 +1,265 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/**
+ * Building blocks for a pipeline of stages that run concurrently. The stages
+ * are connected by bounded lock-free queues: a stage that is faster than the
+ * next one blocks when the queue in between is full, and a stage without
+ * input waits until the previous stage pushes an item or closes the queue.
+ * Every stage runs on its own threads, so the number of threads can be
+ * chosen per stage.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Waits with increasing delays: busy waiting first, then yielding the
+ * processor and finally sleeping, such that a stage that waits for a long
+ * time (e.g. on a slow disk) does not occupy a core.
+ */
+class Backoff {
+  private:
+    unsigned int step;
+
+  public:
+    Backoff() : step(0) {
+    }
+
+    void wait() {
+        if (step < 64) {
+            // busy waiting
+        } else if (step < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        step++;
+    }
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue without locks, as described by
+ * D. Vyukov ("Bounded MPMC queue", 1024cores.net). Every cell of the ring
+ * buffer has a sequence number that tells whether it is free for the
+ * producer or full for the consumer at a given position, so producers and
+ * consumers only contend on their own position counter.
+ */
+template <typename T> class BoundedQueue {
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells; // the ring buffer
+    size_t mask;                   // the capacity - 1 (a power of 2)
+
+    alignas(64) std::atomic<size_t> enqueuePos; // the next position to push
+    alignas(64) std::atomic<size_t> dequeuePos; // the next position to pop
+    alignas(64) std::atomic<bool> closed;       // no more items are pushed
+
+  public:
+    /**
+     * Constructor
+     * @param capacity the minimal capacity, rounded up to a power of 2
+     */
+    BoundedQueue(size_t capacity)
+        : enqueuePos(0), dequeuePos(0), closed(false) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * Push an item if the queue is not full
+     * @param value the item, it is moved from if it is pushed
+     * @returns false if the queue is full
+     */
+    bool tryPush(T& value) {
+        Cell* cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pop an item if the queue is not empty
+     * @param value the item [output]
+     * @returns false if the queue is empty
+     */
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Push an item, waits while the queue is full. Once the queue is closed,
+     * nothing is pushed anymore, such that the stages of a failed pipeline
+     * stop instead of passing the remaining items around.
+     * @param value the item
+     * @returns false if the queue was closed, the item is then dropped
+     */
+    bool push(T value) {
+        Backoff backoff;
+        while (!closed.load(std::memory_order_acquire)) {
+            if (tryPush(value))
+                return true;
+            backoff.wait();
+        }
+        return false;
+    }
+
+    /**
+     * Pop an item, waits while the queue is empty and not closed
+     * @param value the item [output]
+     * @returns false if the queue is closed and empty
+     */
+    bool pop(T& value) {
+        Backoff backoff;
+        while (!tryPop(value)) {
+            // the items pushed before close() are visible after this load
+            if (closed.load(std::memory_order_acquire))
+                return tryPop(value);
+            backoff.wait();
+        }
+        return true;
+    }
+
+    /**
+     * Close the queue, call when all producers are finished. The items in
+     * the queue can still be popped.
+     */
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+};
+
+/**
+ * The threads of the stages of a pipeline. If a stage throws an exception,
+ * all queues of the pipeline are closed such that the other stages finish,
+ * and the exception is rethrown by join().
+ */
+class Pipeline {
+  private:
+    std::vector<std::thread> threads;
+    std::vector<std::function<void()>> closers; // close each queue
+    std::mutex mutex;                           // protects error
+    std::exception_ptr error;                   // the first exception
+
+    void fail(std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = e;
+        }
+        for (const auto& close : closers)
+            close();
+    }
+
+  public:
+    Pipeline() {
+    }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    ~Pipeline() {
+        for (auto& t : threads)
+            if (t.joinable())
+                t.join();
+    }
+
+    /**
+     * Register a queue that connects stages, it is closed when a stage fails.
+     * Register all queues before the first stage is added.
+     */
+    template <typename T> void addQueue(BoundedQueue<T>& queue) {
+        closers.push_back([&queue]() { queue.close(); });
+    }
+
+    /**
+     * Start a stage
+     * @param numThreads the number of threads of the stage
+     * @param work the function that each thread runs, with the index of the
+     * thread in the stage as argument
+     * @param finish called once when all threads of the stage have returned,
+     * e.g. to close the output queue of the stage
+     */
+    void addStage(size_t numThreads, std::function<void(size_t)> work,
+                  std::function<void()> finish) {
+        std::shared_ptr<std::atomic<size_t>> running =
+            std::make_shared<std::atomic<size_t>>(numThreads);
+        for (size_t i = 0; i < numThreads; i++) {
+            threads.emplace_back([this, work, finish, running, i]() {
+                try {
+                    work(i);
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+                if (--*running == 0 && finish)
+                    finish();
+            });
+        }
+    }
+
+    /**
+     * Wait until all stages are finished
+     * @throws the first exception that was thrown by a stage
+     */
+    void join() {
+        for (auto& t : threads)
+            if (t.joinable())
+                t.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef READCACHE_H
+#define READCACHE_H
+
+/**
+ * Cache of the occurrences of reads, such that duplicate reads are not
+ * searched and located again. Sequencing libraries often contain many copies
+ * of the same fragment, and a copy may come from either strand.
+ *
+ * The key of a read is its 2-bit encoding (4 characters per byte), its length
+ * and the maximal edit distance k. A read and its reverse complement share
+ * one entry: the key encodes the canonical strand, i.e. the lexicographically
+ * smallest of the read and its reverse complement. The occurrences of the
+ * reverse complement of a read are the occurrences that were stored for the
+ * other strand of that read, so a reverse-complement duplicate is served by
+ * swapping the two strands of the entry.
+ *
+ * The cache is split into shards that each have their own lock, such that
+ * mapping threads rarely wait for each other. Every shard evicts its least
+ * recently used entries when its share of the capacity is exceeded. The
+ * capacity counts occurrences rather than entries, because the occurrences
+ * of repetitive reads dominate the memory usage.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fmindex.h"
+
+/**
+ * The located occurrences of a read (strand 0) and of its reverse complement
+ * (strand 1)
+ */
+struct ReadMatches {
+    std::vector<TextOcc> occ[2]; // the occurrences of both strands
+    length_t numOcc[2] = {0, 0}; // the number of occurrences (SA rows if
+                                 // capped) of both strands
+
+    /**
+     * Exchange the strands
+     */
+    void swapStrands() {
+        occ[0].swap(occ[1]);
+        std::swap(numOcc[0], numOcc[1]);
+    }
+
+    /**
+     * Get the memory cost of the matches, in occurrences
+     */
+    size_t cost() const {
+        return 1 + occ[0].size() + occ[1].size();
+    }
+};
+
+class ReadCache {
+  private:
+    struct Entry {
+        std::string key;
+        ReadMatches matches; // the matches of the canonical strand
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> entries; // most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t cost = 0; // the sum of the costs of the entries
+    };
+
+    size_t numShards;     // the number of shards
+    size_t shardCapacity; // the capacity of a shard, in occurrences
+    std::unique_ptr<Shard[]> shards;
+
+    std::atomic<uint64_t> hits;   // the number of hits
+    std::atomic<uint64_t> misses; // the number of misses
+
+    /**
+     * Get the 2-bit code of a character
+     * @returns false if c is not one of A, C, G or T
+     */
+    static bool code(char c, uint8_t& v) {
+        switch (c) {
+        case 'A':
+            v = 0;
+            return true;
+        case 'C':
+            v = 1;
+            return true;
+        case 'G':
+            v = 2;
+            return true;
+        case 'T':
+            v = 3;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    Shard& shardOf(const std::string& key) {
+        return shards[std::hash<std::string>()(key) % numShards];
+    }
+
+  public:
+    /**
+     * Constructor
+     * @param capacity the maximal number of occurrences in the cache, every
+     * entry counts as one extra occurrence
+     * @param numShards the number of independently locked shards, a small
+     * cache gets fewer shards such that every shard holds at least 16
+     * occurrences
+     */
+    ReadCache(size_t capacity, size_t numShards = 64)
+        : numShards(std::max<size_t>(1, std::min(numShards, capacity / 16))),
+          shardCapacity(capacity / this->numShards),
+          shards(new Shard[this->numShards]), hits(0), misses(0) {
+    }
+
+    ReadCache(const ReadCache&) = delete;
+    ReadCache& operator=(const ReadCache&) = delete;
+
+    /**
+     * Get the key of a read
+     * @param read the read
+     * @param k the maximal edit distance of the search
+     * @param key the key of the canonical strand [output]
+     * @param revCompl true if the canonical strand is the reverse complement
+     * of the read [output]
+     * @returns false if the read has other characters than A, C, G or T,
+     * such reads are not cached
+     */
+    static bool makeKey(const std::string& read, length_t k,
+                        std::string& key, bool& revCompl) {
+        size_t n = read.size();
+        std::vector<uint8_t> codes(n);
+        for (size_t i = 0; i < n; i++)
+            if (!code(read[i], codes[i]))
+                return false;
+
+        // the complement of code c is 3 - c
+        revCompl = false;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t rc = 3 - codes[n - 1 - i];
+            if (codes[i] != rc) {
+                revCompl = rc < codes[i];
+                break;
+            }
+        }
+
+        key.assign((n + 3) / 4, 0);
+        for (size_t i = 0; i < n; i++) {
+            uint8_t c = revCompl ? 3 - codes[n - 1 - i] : codes[i];
+            key[i / 4] |= (char)(c << (2 * (i % 4)));
+        }
+        // the length distinguishes reads that end in A's
+        key.append((const char*)&n, sizeof(n));
+        key.append((const char*)&k, sizeof(k));
+        return true;
+    }
+
+    /**
+     * Look up the matches of a read
+     * @param read the read
+     * @param k the maximal edit distance of the search
+     * @param matches the matches of the read and its reverse complement, if
+     * they are in the cache [output]
+     * @returns true if the matches were found
+     */
+    bool lookup(const std::string& read, length_t k, ReadMatches& matches) {
+        std::string key;
+        bool revCompl;
+        if (makeKey(read, k, key, revCompl)) {
+            Shard& shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end()) {
+                // move the entry to the front
+                shard.entries.splice(shard.entries.begin(), shard.entries,
+                                     it->second);
+                matches = it->second->matches;
+                if (revCompl)
+                    matches.swapStrands();
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * Store the matches of a read. Least recently used entries are evicted
+     * if the cache is full.
+     * @param read the read
+     * @param k the maximal edit distance of the search
+     * @param matches the matches of the read and its reverse complement
+     */
+    void insert(const std::string& read, length_t k,
+                const ReadMatches& matches) {
+        std::string key;
+        bool revCompl;
+        if (matches.cost() > shardCapacity ||
+            !makeKey(read, k, key, revCompl))
+            return;
+
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.index.count(key) > 0)
+            return; // inserted by another thread
+        shard.entries.emplace_front();
+        Entry& entry = shard.entries.front();
+        entry.key = key;
+        entry.matches = matches;
+        if (revCompl)
+            entry.matches.swapStrands();
+        shard.index[key] = shard.entries.begin();
+        shard.cost += matches.cost();
+
+        while (shard.cost > shardCapacity) {
+            const Entry& last = shard.entries.back();
+            shard.cost -= last.matches.cost();
+            shard.index.erase(last.key);
+            shard.entries.pop_back();
+        }
+    }
+
+    /**
+     * Get the number of lookups that found the matches
+     */
+    uint64_t getHits() const {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the number of lookups that did not find the matches
+     */
+    uint64_t getMisses() const {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the number of entries in the cache
+     */
+    size_t size() {
+        size_t n = 0;
+        for (size_t i = 0; i < numShards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            n += shards[i].entries.size();
+        }
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "rindex.h"
+
+#include "sais.h"
+
+using namespace std;
+
+// ============================================================================
+// Construction
+// ============================================================================
+
+RIndex::RIndex(const string& base, bool verbose) {
+    string text;
+    printInfo("Reading: " + base + ".txt", verbose);
+    if (!readText(base + ".txt", text))
+        throw runtime_error("Problem reading: " + base + ".txt");
+    if (text.back() == '\n')
+        text.pop_back();
+    printDone(verbose);
+
+    printInfo("Constructing suffix arrays", verbose);
+    vector<length_t> sa, revSA;
+    sais::constructSAs(text, sa, revSA);
+    printDone(verbose);
+
+    create(text, sa, revSA, verbose);
+}
+
+RIndex::RIndex(const string& base, const vector<length_t>& sa,
+               const vector<length_t>& revSA, bool verbose) {
+    string text;
+    printInfo("Reading: " + base + ".txt", verbose);
+    if (!readText(base + ".txt", text))
+        throw runtime_error("Problem reading: " + base + ".txt");
+    if (text.back() == '\n')
+        text.pop_back();
+    printDone(verbose);
+
+    create(text, sa, revSA, verbose);
+}
+
+void RIndex::create(const string& text, const vector<length_t>& sa,
+                    const vector<length_t>& revSA, bool verbose) {
+    textLength = text.size();
+    sigma = Alphabet<ALPHABET>(text);
+
+    printInfo("Creating run-length BWTs", verbose);
+    string b(textLength, '$');
+    for (length_t i = 0; i < textLength; i++)
+        b[i] = (sa[i] > 0) ? text[sa[i] - 1] : '$';
+    bwt = RunLengthBWT<ALPHABET>(sigma, b);
+
+    // the reversed text is text[0...n-1[ reversed followed by '$'
+    for (length_t i = 0; i < textLength; i++)
+        b[i] = (revSA[i] > 0) ? text[textLength - 1 - revSA[i]] : '$';
+    revBWT = RunLengthBWT<ALPHABET>(sigma, b);
+    printDone(verbose);
+
+    length_t total = 0;
+    for (length_t c = 0; c < ALPHABET; c++) {
+        counts[c] = total;
+        total += bwt.occ(c, textLength);
+    }
+
+    printInfo("Creating suffix array samples", verbose);
+    length_t r = bwt.numRuns();
+    runEndSamples.resize(r);
+    vector<pair<length_t, length_t>> phiSamples;
+    phiSamples.reserve(r);
+    for (length_t j = 0; j < r; j++) {
+        runEndSamples[j] = sa[bwt.runEnd(j)];
+        length_t p = bwt.runStart(j);
+        if (p > 0)
+            phiSamples.emplace_back(sa[p], sa[p - 1]);
+    }
+
+    sort(phiSamples.begin(), phiSamples.end());
+    for (const auto& s : phiSamples) {
+        phiKeys.push_back(s.first);
+        phiValues.push_back(s.second);
+    }
+    printDone(verbose);
+
+    if (verbose)
+        cout << "r-index construction successful (" << r << " runs)" << endl;
+}
+
+uint64_t RIndex::memoryUsage() const {
+    return bwt.memoryUsage() + revBWT.memoryUsage() +
+           (runEndSamples.size() + phiKeys.size() + phiValues.size()) *
+               sizeof(length_t);
+}
+
+// ============================================================================
+// Functionality
+// ============================================================================
+
+length_t RIndex::phi(length_t pos) const {
+    // phi(pos) = phi(key) + pos - key, for the largest key <= pos. Position 0
+    // is always a key, as the '$' forms a run on its own.
+    size_t j =
+        upper_bound(phiKeys.begin(), phiKeys.end(), pos) - phiKeys.begin() - 1;
+    return phiValues[j] + (pos - phiKeys[j]);
+}
+
+void RIndex::locate(const Range& range, length_t toehold,
+                    vector<length_t>& positions) const {
+    if (range.empty())
+        return;
+    positions.push_back(toehold);
+    for (length_t i = range.getEnd() - 1; i > range.getBegin(); i--) {
+        toehold = phi(toehold);
+        positions.push_back(toehold);
+    }
+}
+
+bool RIndex::addCharLeft(length_t charIdx, const Range& range,
+                         length_t toehold, Range& newRange,
+                         length_t& newToehold) const {
+    // the last row of the new range is the LF mapping of the last row of
+    // range that contains c, which is either the last row of range or the
+    // last row of a run of c (range and newRange may alias)
+    length_t j = bwt.findRun(range.getEnd() - 1);
+    if (!addCharLeft(charIdx, range, newRange))
+        return false;
+
+    if (bwt.runHead(j) == (int)charIdx) {
+        newToehold = toehold - 1;
+    } else {
+        newToehold = runEndSamples[bwt.prevRunOf(charIdx, j)] - 1;
+    }
+    return true;
+}
+
+bool RIndex::addCharLeft(length_t charIdx, const Range& originalRange,
+                         Range& newRange) const {
+    newRange =
+        Range(counts[charIdx] + bwt.occ(charIdx, originalRange.getBegin()),
+              counts[charIdx] + bwt.occ(charIdx, originalRange.getEnd()));
+    return !newRange.empty();
+}
+
+bool RIndex::addCharLeft(length_t charIdx, const RangePair& originalRanges,
+                         RangePair& newRanges) const {
+    const Range& f = originalRanges.getForwardRange();
+    const Range& b = originalRanges.getBackwardRange();
+
+    length_t bBegin = counts[charIdx] + bwt.occ(charIdx, b.getBegin());
+    length_t bEnd = counts[charIdx] + bwt.occ(charIdx, b.getEnd());
+    length_t fBegin = f.getBegin() + bwt.cumulocc(charIdx, b.getEnd()) -
+                      bwt.cumulocc(charIdx, b.getBegin());
+
+    newRanges = RangePair(bBegin, bEnd, fBegin, fBegin + (bEnd - bBegin));
+    return !newRanges.empty();
+}
+
+bool RIndex::addCharRight(length_t charIdx, const RangePair& originalRanges,
+                          RangePair& newRanges) const {
+    const Range& f = originalRanges.getForwardRange();
+    const Range& b = originalRanges.getBackwardRange();
+
+    length_t fBegin = counts[charIdx] + revBWT.occ(charIdx, f.getBegin());
+    length_t fEnd = counts[charIdx] + revBWT.occ(charIdx, f.getEnd());
+    length_t bBegin = b.getBegin() + revBWT.cumulocc(charIdx, f.getEnd()) -
+                      revBWT.cumulocc(charIdx, f.getBegin());
+
+    newRanges = RangePair(bBegin, bBegin + (fEnd - fBegin), fBegin, fEnd);
+    return !newRanges.empty();
+}
+
+vector<length_t> RIndex::matchExact(const string& str) const {
+    vector<length_t> positions;
+
+    // the last row of the full range is the end of the last run
+    Range range(0, textLength);
+    length_t toehold = runEndSamples.back();
+    for (size_t i = str.size(); i-- > 0;) {
+        if (!sigma.inAlphabet(str[i]) ||
+            !addCharLeft(sigma.c2i(str[i]), range, toehold, range, toehold))
+            return positions;
+    }
+
+    locate(range, toehold, positions);
+    return positions;
+}
+
+RangePair RIndex::matchExactBidirectionally(const Substring& str) const {
+    RangePair ranges(0, textLength, 0, textLength);
+    for (length_t i = 0; i < str.size(); i++) {
+        if (!sigma.inAlphabet(str[i]))
+            return RangePair();
+        length_t charIdx = sigma.c2i(str[i]);
+        bool notEmpty = (str.getDirection() == FORWARD)
+                            ? addCharRight(charIdx, ranges, ranges)
+                            : addCharLeft(charIdx, ranges, ranges);
+        if (!notEmpty)
+            return RangePair();
+    }
+    return ranges;
+}
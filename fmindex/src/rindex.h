@@ -0,0 +1,198 @@
+#ifndef RINDEX_H
+#define RINDEX_H
+
+/**
+ * Run-length compressed FM-index for highly repetitive texts (r-index) as
+ * described in T. Gagie, G. Navarro and N. Prezza, "Fully Functional Suffix
+ * Trees and Optimal Text Searching in BWT-Runs Bounded Space", JACM 2020.
+ *
+ * The BWT of the text and of the reversed text are run-length compressed.
+ * Instead of a sparse suffix array, only O(r) suffix array samples are
+ * stored: the entry at the last row of each run (to maintain a toehold
+ * during backward search) and, for the first row p of each run, the pair
+ * (SA[p], SA[p - 1]) (to evaluate phi(SA[i]) = SA[i - 1]). Neither the text
+ * nor the plain BWT is kept, so the memory usage is proportional to the
+ * number of runs r.
+ */
+
+#include <string>
+#include <vector>
+
+#include "bidirectionalfmindex.h"
+#include "rlbwt.h"
+
+class RIndex {
+  private:
+    length_t textLength;                   // the length of the text
+    std::array<length_t, ALPHABET> counts; // the counts array
+    Alphabet<ALPHABET> sigma;              // the alphabet
+
+    RunLengthBWT<ALPHABET> bwt;    // the BWT of the text
+    RunLengthBWT<ALPHABET> revBWT; // the BWT of the reversed text
+
+    std::vector<length_t> runEndSamples; // SA at the last row of each run
+    std::vector<length_t> phiKeys;   // sorted SA[p] for the run starts p > 0
+    std::vector<length_t> phiValues; // SA[p - 1] for each key
+
+    /**
+     * Helper function for constructor, creates the run-length BWTs and the
+     * suffix array samples
+     * @param text the text, ending with '$'
+     * @param sa the suffix array of the text
+     * @param revSA the suffix array of the reversed text
+     */
+    void create(const std::string& text, const std::vector<length_t>& sa,
+                const std::vector<length_t>& revSA, bool verbose);
+
+    /**
+     * Finds the range of cP using the range of P over the SA, and the SA
+     * entry of the last row of the new range
+     * @param charIdx the position in alphabet of c
+     * @param range the range over the SA of pattern P
+     * @param toehold the SA entry of the last row of range
+     * @param newRange the range over the SA of cP [output]
+     * @param newToehold the SA entry of the last row of newRange [output]
+     * @return true if the newRange is not empty and false otherwise
+     */
+    bool addCharLeft(length_t charIdx, const Range& range, length_t toehold,
+                     Range& newRange, length_t& newToehold) const;
+
+  public:
+    /**
+     * Constructor, reads the text <base>.txt and constructs the suffix
+     * arrays of the text and the reversed text. The suffix arrays and the
+     * text are released after construction.
+     * @param base the base name of the index
+     */
+    RIndex(const std::string& base, bool verbose = true);
+
+    /**
+     * Constructor, creates the index from already constructed suffix arrays
+     * @param base the base name of the index, <base>.txt is read
+     * @param sa the suffix array of the text
+     * @param revSA the suffix array of the reversed text
+     */
+    RIndex(const std::string& base, const std::vector<length_t>& sa,
+           const std::vector<length_t>& revSA, bool verbose = true);
+
+    // ============================================================================
+    // ACCESSING DATA STRUCTURE
+    // ============================================================================
+
+    length_t getTextLength() const {
+        return textLength;
+    }
+
+    const Alphabet<ALPHABET>& getAlphabet() const {
+        return sigma;
+    }
+
+    const std::array<length_t, ALPHABET>& getCounts() const {
+        return counts;
+    }
+
+    /**
+     * Get the number of runs in the BWT of the text
+     */
+    length_t getNumberOfRuns() const {
+        return bwt.numRuns();
+    }
+
+    /**
+     * Get the number of bytes used by the index
+     */
+    uint64_t memoryUsage() const;
+
+    // ============================================================================
+    // FUNCTIONALITY
+    // ============================================================================
+
+    /**
+     * Occ function, number of occurrences of the character before the index
+     * @param charIdx the index of the character in the alphabet
+     * @param index the index for the occ query
+     */
+    length_t occ(const length_t& charIdx, const length_t& index) const {
+        return bwt.occ(charIdx, index);
+    }
+
+    /**
+     * Finds the LF mapping of the character at index k in the bwt
+     * @param k the index to find the LF mapping off
+     * @returns the row that is the LF mapping of k.
+     */
+    length_t findLF(length_t k) const {
+        int c = bwt[k];
+        return counts[c] + bwt.occ(c, k);
+    }
+
+    /**
+     * Evaluates phi(SA[i]) = SA[i - 1] for i > 0
+     * @param pos the entry in the SA of a row i > 0
+     * @returns the entry in the SA of row i - 1
+     */
+    length_t phi(length_t pos) const;
+
+    /**
+     * Finds the entries in the SA of all rows of a range by repeatedly
+     * applying phi to the entry of the last row of the range
+     * @param range the range over the SA
+     * @param toehold the SA entry of the last row of the range
+     * @param positions the SA entries of the rows of the range, from the last
+     * row to the first row [output]
+     */
+    void locate(const Range& range, length_t toehold,
+                std::vector<length_t>& positions) const;
+
+    /**
+     * Finds the range of cP using the range of P over the SA
+     * @param charIdx the position in alphabet of c
+     * @param originalRange the range over the SA of pattern P
+     * @param newRange the range over the SA of cP   [output]
+     * @return true if the newRange is not empty and false otherwise
+     */
+    bool addCharLeft(length_t charIdx, const Range& originalRange,
+                     Range& newRange) const;
+
+    /**
+     * Extends the pattern with one character to the left (find ranges of cP
+     * using ranges of P)
+     * @param charIdx the position in alphabet of the character
+     * @param originalRanges the ranges of pattern P
+     * @param newRanges ranges cP  [output]
+     * @return true if the newRanges are not empty and false otherwise
+     */
+    bool addCharLeft(length_t charIdx, const RangePair& originalRanges,
+                     RangePair& newRanges) const;
+
+    /**
+     * Extends the pattern with one character to the right (find ranges of Pc
+     * using ranges of P)
+     * @param charIdx the position in alphabet of the character
+     * @param originalRanges the ranges of pattern P
+     * @param newRanges the ranges of Pc  [output]
+     * @return true if the newRanges are not empty and false otherwise
+     */
+    bool addCharRight(length_t charIdx, const RangePair& originalRanges,
+                      RangePair& newRanges) const;
+
+    /**
+     * This function matches a string exactly. The SA entry of the last row
+     * of the range is maintained during the backward search, the other
+     * entries are found with phi.
+     * @param str the string to match
+     * @returns the start positions of the exact matches of str in the text
+     */
+    std::vector<length_t> matchExact(const std::string& str) const;
+
+    /**
+     * This function matches a string exactly in the direction of the string,
+     * starting from the empty string, while keeping track of the ranges in
+     * both directions
+     * @param str the string to match
+     * @returns the pair of ranges that matches string
+     */
+    RangePair matchExactBidirectionally(const Substring& str) const;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef RLBWT_H
+#define RLBWT_H
+
+/**
+ * Run-length compressed BWT. The BWT is stored as r runs of equal characters.
+ * For each run, the start position, the character and the number of
+ * occurrences of every character before the run are stored, such that the
+ * memory usage is proportional to r instead of to the length of the BWT. An
+ * occ query is a binary search over the run starts.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "alphabet.h"
+
+template <size_t S>  // S is the size of the alphabet (including '$')
+class RunLengthBWT { // e.g. S = 5 for DNA (A,C,G,T + $)
+
+  private:
+    length_t N;                       // the length of the BWT
+    std::vector<length_t> runStarts;  // start of each run (+ N as sentinel)
+    std::vector<unsigned char> heads; // character index of each run
+    std::vector<length_t> before;     // occ(c, runStarts[j]) at j * S + c
+    std::array<std::vector<length_t>, S> runsOf; // the runs of each character
+
+  public:
+    /**
+     * Default constructor
+     */
+    RunLengthBWT() : N(0) {
+    }
+
+    /**
+     * Constructor
+     * @param sigma Alphabet
+     * @param BWT Burrows-Wheeler transformation
+     */
+    RunLengthBWT(const Alphabet<S>& sigma, const std::string& BWT)
+        : N(BWT.size()) {
+        std::array<length_t, S> counts = {};
+        for (length_t i = 0; i < N; i++) {
+            unsigned char c = sigma.c2i(BWT[i]);
+            if (i == 0 || c != heads.back()) {
+                runsOf[c].push_back(runStarts.size());
+                runStarts.push_back(i);
+                heads.push_back(c);
+                before.insert(before.end(), counts.begin(), counts.end());
+            }
+            counts[c]++;
+        }
+
+        // the sentinel run holds the total counts
+        runStarts.push_back(N);
+        heads.push_back(S);
+        before.insert(before.end(), counts.begin(), counts.end());
+    }
+
+    /**
+     * Get the run that contains a position
+     * @param i position in [0, N], position N is in the sentinel run
+     * @return the index of the run
+     */
+    length_t findRun(length_t i) const {
+        assert(i <= N);
+        return std::upper_bound(runStarts.begin(), runStarts.end(), i) -
+               runStarts.begin() - 1;
+    }
+
+    /**
+     * Get occurrence count of character c in the range BWT[0...i[
+     * @param cIdx Character index
+     * @param i index
+     * @return occ(c, i)
+     */
+    length_t occ(int cIdx, length_t i) const {
+        length_t j = findRun(i);
+        length_t r = before[j * S + cIdx];
+        return (heads[j] == cIdx) ? r + i - runStarts[j] : r;
+    }
+
+    /**
+     * Get cumulative occurrence count of characters smaller than c in the
+     * range BWT[0...i[
+     * @param cIdx Character index
+     * @param i index
+     * @return cumulocc(c, i)
+     */
+    length_t cumulocc(int cIdx, length_t i) const {
+        length_t j = findRun(i);
+        length_t r = 0;
+        for (int c = 0; c < cIdx; c++)
+            r += before[j * S + c];
+        return (heads[j] < cIdx) ? r + i - runStarts[j] : r;
+    }
+
+    /**
+     * Get the character index at a position
+     * @param i position
+     */
+    int operator[](length_t i) const {
+        assert(i < N);
+        return heads[findRun(i)];
+    }
+
+    /**
+     * Get the number of runs
+     */
+    length_t numRuns() const {
+        return heads.size() - 1;
+    }
+
+    /**
+     * Get the start of a run
+     * @param j the index of the run
+     */
+    length_t runStart(length_t j) const {
+        return runStarts[j];
+    }
+
+    /**
+     * Get the last position of a run
+     * @param j the index of the run
+     */
+    length_t runEnd(length_t j) const {
+        return runStarts[j + 1] - 1;
+    }
+
+    /**
+     * Get the character index of a run
+     * @param j the index of the run
+     */
+    int runHead(length_t j) const {
+        return heads[j];
+    }
+
+    /**
+     * Get the last run before run j that consists of character c
+     * @param cIdx Character index
+     * @param j the index of the run
+     * @return the index of the run, or numRuns() if there is no such run
+     */
+    length_t prevRunOf(int cIdx, length_t j) const {
+        const auto& runs = runsOf[cIdx];
+        auto it = std::lower_bound(runs.begin(), runs.end(), j);
+        return (it == runs.begin()) ? numRuns() : *(it - 1);
+    }
+
+    /**
+     * Get the number of bytes used by the run-length BWT
+     */
+    uint64_t memoryUsage() const {
+        uint64_t m = runStarts.size() * sizeof(length_t) + heads.size() +
+                     before.size() * sizeof(length_t);
+        for (const auto& runs : runsOf)
+            m += runs.size() * sizeof(length_t);
+        return m;
+    }
+};
+
+#endif
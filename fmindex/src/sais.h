@@ -0,0 +1,198 @@
+#ifndef SAIS_H
+#define SAIS_H
+
+/**
+ * Linear-time suffix array construction using induced sorting as described in
+ * G. Nong, S. Zhang and W. H. Chan, "Two Efficient Algorithms for Linear Time
+ * Suffix Array Construction", IEEE Transactions on Computers, 2011
+ *
+ * The input string must end with a unique sentinel character that is
+ * lexicographically smaller than all other characters (e.g. '$').
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "indexwidth.h"
+
+namespace sais {
+
+const length_t EMPTY = std::numeric_limits<length_t>::max();
+
+/**
+ * Compute the start (or end) of each character bucket in the suffix array
+ * @param s the input string
+ * @param n the length of s
+ * @param K the size of the alphabet of s
+ * @param bkt the bucket boundaries [output]
+ * @param end true for the bucket ends, false for the bucket starts
+ */
+template <typename T>
+void getBuckets(const T* s, length_t n, length_t K, std::vector<length_t>& bkt,
+                bool end) {
+    std::fill(bkt.begin(), bkt.end(), 0);
+    for (length_t i = 0; i < n; i++)
+        bkt[s[i]]++;
+
+    length_t sum = 0;
+    for (length_t c = 0; c < K; c++) {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+/**
+ * Induce the order of the L-type and S-type suffixes from the (partially)
+ * sorted LMS suffixes in sa
+ * @param s the input string
+ * @param sa the suffix array under construction
+ * @param n the length of s
+ * @param K the size of the alphabet of s
+ * @param t the suffix types (true for S-type)
+ * @param bkt buffer for the bucket boundaries
+ */
+template <typename T>
+void induceSA(const T* s, length_t* sa, length_t n, length_t K,
+              const std::vector<bool>& t, std::vector<length_t>& bkt) {
+    // L-type suffixes from left to right
+    getBuckets(s, n, K, bkt, false);
+    for (length_t i = 0; i < n; i++) {
+        length_t j = sa[i];
+        if (j != EMPTY && j > 0 && !t[j - 1])
+            sa[bkt[s[j - 1]]++] = j - 1;
+    }
+
+    // S-type suffixes from right to left
+    getBuckets(s, n, K, bkt, true);
+    for (length_t i = n; i-- > 0;) {
+        length_t j = sa[i];
+        if (j != EMPTY && j > 0 && t[j - 1])
+            sa[--bkt[s[j - 1]]] = j - 1;
+    }
+}
+
+/**
+ * Construct the suffix array of s
+ * @param s the input string, s[n-1] must be a unique smallest character
+ * @param sa the suffix array [output], must have room for n elements
+ * @param n the length of s
+ * @param K the size of the alphabet of s
+ */
+template <typename T>
+void constructSA(const T* s, length_t* sa, length_t n, length_t K) {
+    if (n == 1) {
+        sa[0] = 0;
+        return;
+    }
+
+    // classify the suffixes as S-type (true) or L-type (false)
+    std::vector<bool> t(n);
+    t[n - 1] = true;
+    for (length_t i = n - 1; i-- > 0;)
+        t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+
+    auto isLMS = [&t](length_t i) { return i > 0 && t[i] && !t[i - 1]; };
+
+    // stage 1: sort the LMS substrings
+    std::vector<length_t> bkt(K);
+    getBuckets(s, n, K, bkt, true);
+    std::fill(sa, sa + n, EMPTY);
+    for (length_t i = 1; i < n; i++)
+        if (isLMS(i))
+            sa[--bkt[s[i]]] = i;
+    induceSA(s, sa, n, K, t, bkt);
+
+    // compact the sorted LMS substrings into the first n1 items of sa
+    length_t n1 = 0;
+    for (length_t i = 0; i < n; i++)
+        if (isLMS(sa[i]))
+            sa[n1++] = sa[i];
+
+    // name the LMS substrings
+    std::fill(sa + n1, sa + n, EMPTY);
+    length_t name = 0, prev = EMPTY;
+    for (length_t i = 0; i < n1; i++) {
+        length_t pos = sa[i];
+        bool diff = false;
+        for (length_t d = 0; d < n; d++) {
+            if (prev == EMPTY || s[pos + d] != s[prev + d] ||
+                t[pos + d] != t[prev + d]) {
+                diff = true;
+                break;
+            } else if (d > 0 && (isLMS(pos + d) || isLMS(prev + d))) {
+                break;
+            }
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (length_t i = n, j = n; i-- > n1;)
+        if (sa[i] != EMPTY)
+            sa[--j] = sa[i];
+
+    // stage 2: sort the reduced string (recursively if names are not unique)
+    length_t* s1 = sa + n - n1;
+    if (name < n1) {
+        constructSA(s1, sa, n1, name);
+    } else {
+        for (length_t i = 0; i < n1; i++)
+            sa[s1[i]] = i;
+    }
+
+    // stage 3: induce the suffix array from the sorted LMS suffixes
+    for (length_t i = 1, j = 0; i < n; i++)
+        if (isLMS(i))
+            s1[j++] = i;
+    for (length_t i = 0; i < n1; i++)
+        sa[i] = s1[sa[i]];
+    std::fill(sa + n1, sa + n, EMPTY);
+
+    getBuckets(s, n, K, bkt, true);
+    for (length_t i = n1; i-- > 0;) {
+        length_t j = sa[i];
+        sa[i] = EMPTY;
+        sa[--bkt[s[j]]] = j;
+    }
+    induceSA(s, sa, n, K, t, bkt);
+}
+
+/**
+ * Construct the suffix array of a text that ends with '$'
+ * @param text the text
+ * @param sa the suffix array [output]
+ */
+inline void constructSA(const std::string& text, std::vector<length_t>& sa) {
+    sa.resize(text.size());
+    constructSA((const unsigned char*)text.data(), sa.data(), text.size(),
+                256);
+}
+
+/**
+ * Construct the suffix arrays of a text and of its reverse. The reversed text
+ * is text[0...n-1[ reversed, followed by '$'. Both suffix arrays are
+ * constructed concurrently.
+ * @param text the text, ending with '$'
+ * @param sa the suffix array of the text [output]
+ * @param revSA the suffix array of the reversed text [output]
+ */
+inline void constructSAs(const std::string& text, std::vector<length_t>& sa,
+                         std::vector<length_t>& revSA) {
+    std::string revText(text.rbegin() + 1, text.rend());
+    revText.push_back('$');
+
+    std::thread revThread(
+        [&revText, &revSA]() { constructSA(revText, revSA); });
+    constructSA(text, sa);
+    revThread.join();
+}
+
+} // namespace sais
+
+#endif
@@ -0,0 +1,448 @@
+#ifndef SAMWRITER_H
+#define SAMWRITER_H
+
+/**
+ * Output of the occurrences of reads in the SAM format. A SamFormatter
+ * formats the records of a batch of reads into a buffer of the thread that
+ * formats it, a SamWriter writes the buffers to a file on a separate thread.
+ * The writer keeps buffers that arrive out of order in a reorder buffer, so
+ * the batches are written in the order of the input no matter which thread
+ * finishes first.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bandmatrix.h"
+#include "fastxreader.h"
+#include "fmindex.h"
+#include "pairing.h"
+
+/**
+ * Formats SAM records. A formatter has reusable buffers, so every thread
+ * should use its own formatter.
+ */
+class SamFormatter {
+  private:
+    const std::string& text;    // the text of the index
+    const ContigTable& contigs; // the contigs of the text
+
+    std::string seq, qual, cigar; // reusable buffers
+
+    // the primary alignment of a read
+    struct Hit {
+        const TextOcc* occ; // the occurrence, nullptr if unmapped
+        bool reverse;       // true if the reverse complement occurs
+        int mapq;           // the mapping quality
+
+        Hit() : occ(nullptr), reverse(false), mapq(0) {
+        }
+    };
+
+    static char complement(char c) {
+        switch (c) {
+        case 'A':
+            return 'T';
+        case 'C':
+            return 'G';
+        case 'G':
+            return 'C';
+        case 'T':
+            return 'A';
+        default:
+            return 'N';
+        }
+    }
+
+    /**
+     * Get the name of a read, without the /1 or /2 suffix of a mate
+     */
+    static std::string readName(const ReadRecord& r, bool paired) {
+        length_t length = r.nameLength;
+        if (paired && length > 2 && r.name[length - 2] == '/' &&
+            (r.name[length - 1] == '1' || r.name[length - 1] == '2'))
+            length -= 2;
+        return std::string(r.name, length);
+    }
+
+    /**
+     * Find the primary alignment of a read: the first occurrence with the
+     * lowest distance. The mapping quality is 60 if that occurrence is the
+     * only one with the lowest distance and 0 otherwise.
+     * @param fw the occurrences of the read
+     * @param rc the occurrences of the reverse complement of the read
+     */
+    static Hit findPrimary(const std::vector<TextOcc>& fw,
+                           const std::vector<TextOcc>& rc) {
+        Hit hit;
+        length_t numBest = 0;
+        for (int strand = 0; strand < 2; strand++) {
+            for (const auto& o : (strand == 0) ? fw : rc) {
+                if (hit.occ == nullptr ||
+                    o.getDistance() < hit.occ->getDistance()) {
+                    hit.occ = &o;
+                    hit.reverse = (strand == 1);
+                    numBest = 1;
+                } else if (o.getDistance() == hit.occ->getDistance()) {
+                    numBest++;
+                }
+            }
+        }
+        hit.mapq = (numBest == 1) ? 60 : 0;
+        return hit;
+    }
+
+    /**
+     * Make the occurrence of a mate in a proper pair its primary alignment,
+     * the mapping quality is kept
+     * @param hit the primary alignment of the mate [output]
+     * @param fw the occurrences of the mate
+     * @param rc the occurrences of the reverse complement of the mate
+     * @param occ the occurrence of the mate in the pair
+     * @param reverse true if occ is an occurrence of the reverse complement
+     */
+    static void setPairedHit(Hit& hit, const std::vector<TextOcc>& fw,
+                             const std::vector<TextOcc>& rc,
+                             const TextOcc& occ, bool reverse) {
+        const std::vector<TextOcc>& list = reverse ? rc : fw;
+        auto it = std::find(list.begin(), list.end(), occ);
+        if (it == list.end())
+            return;
+        hit.occ = &*it;
+        hit.reverse = reverse;
+    }
+
+    /**
+     * Get the 1-based position of an occurrence in its contig
+     */
+    length_t position(const TextOcc& occ) const {
+        return occ.getRange().getBegin() - contigs.getStart(occ.getContig()) +
+               1;
+    }
+
+    /**
+     * Computes the CIGAR string of an occurrence with a banded alignment of
+     * the (oriented) read against the text, the band width is the distance
+     * of the occurrence
+     * @param read the read in the orientation of the occurrence
+     * @param occ the occurrence
+     */
+    void computeCigar(const std::string& read, const TextOcc& occ) {
+        length_t refLength = occ.getRange().width();
+        length_t d = occ.getDistance();
+        if (d == 0) {
+            cigar = std::to_string(read.size()) + 'M';
+            return;
+        }
+        const char* ref = text.data() + occ.getRange().getBegin();
+        Substring pattern(read);
+        BandedMatrix matrix(read.size(), d, 0);
+        for (length_t i = 1; i <= refLength; i++)
+            matrix.updateMatrixRow(pattern, i, ref[i - 1]);
+        matrix.traceback(pattern, ref, refLength, cigar);
+    }
+
+    /**
+     * Append the records of a read: one record per occurrence, in which the
+     * other occurrences than the primary alignment are secondary alignments,
+     * or an unmapped record if the read has no occurrences
+     * @param out the buffer [output]
+     * @param r the read
+     * @param fw the occurrences of the read
+     * @param rc the occurrences of the reverse complement of the read
+     * @param hit the primary alignment of the read
+     * @param flag the flags for pairs (0 for single-end reads)
+     * @param mate the primary alignment of the mate (paired reads only)
+     */
+    void appendRead(std::string& out, const ReadRecord& r,
+                    const std::vector<TextOcc>& fw,
+                    const std::vector<TextOcc>& rc, const Hit& hit, int flag,
+                    const Hit* mate) {
+        const std::string name = readName(r, mate != nullptr);
+        bool mateMapped = (mate != nullptr && mate->occ != nullptr);
+        if (mate != nullptr && !mateMapped)
+            flag |= 0x8;
+        if (mateMapped && mate->reverse)
+            flag |= 0x20;
+
+        if (hit.occ == nullptr) {
+            // an unmapped read with a mapped mate is placed at its mate
+            out += name + '\t' + std::to_string(flag | 0x4) + '\t';
+            if (mateMapped) {
+                std::string pos = std::to_string(position(*mate->occ));
+                out += contigs.getName(mate->occ->getContig()) + '\t' + pos +
+                       "\t0\t*\t=\t" + pos + "\t0\t";
+            } else {
+                out += "*\t0\t0\t*\t*\t0\t0\t";
+            }
+            out.append(r.seq, r.seqLength);
+            out += '\t';
+            if (r.qualLength > 0)
+                out.append(r.qual, r.qualLength);
+            else
+                out += '*';
+            out += '\n';
+            return;
+        }
+
+        for (int strand = 0; strand < 2; strand++) {
+            bool reverse = (strand == 1);
+            // the sequence and qualities in the orientation of the strand
+            if (reverse) {
+                seq.resize(r.seqLength);
+                qual.assign(r.qual, r.qualLength);
+                for (length_t i = 0; i < r.seqLength; i++)
+                    seq[i] = complement(r.seq[r.seqLength - 1 - i]);
+                std::reverse(qual.begin(), qual.end());
+            } else {
+                seq.assign(r.seq, r.seqLength);
+                qual.assign(r.qual, r.qualLength);
+            }
+
+            for (const auto& o : reverse ? rc : fw) {
+                bool primary = (&o == hit.occ);
+                int f = flag | (reverse ? 0x10 : 0) | (primary ? 0 : 0x100);
+                computeCigar(seq, o);
+
+                const std::string& contig = contigs.getName(o.getContig());
+                out += name + '\t' + std::to_string(f) + '\t' + contig + '\t' +
+                       std::to_string(position(o)) + '\t' +
+                       std::to_string(hit.mapq) + '\t' + cigar + '\t';
+
+                if (mateMapped) {
+                    bool sameContig =
+                        mate->occ->getContig() == o.getContig();
+                    out += sameContig
+                               ? "="
+                               : contigs.getName(mate->occ->getContig());
+                    out += '\t' + std::to_string(position(*mate->occ)) + '\t';
+                    out += std::to_string(
+                        (primary && sameContig) ? templateLength(o, *mate->occ,
+                                                                 flag & 0x40)
+                                                : 0);
+                } else if (mate != nullptr) {
+                    // the unmapped mate is placed at this read
+                    out += "=\t" + std::to_string(position(o)) + "\t0";
+                } else {
+                    out += "*\t0\t0";
+                }
+
+                out += '\t';
+                out += primary ? seq : "*";
+                out += '\t';
+                out += (primary && !qual.empty()) ? qual : "*";
+                out += "\tNM:i:" + std::to_string(o.getDistance()) + '\n';
+            }
+        }
+    }
+
+    /**
+     * The signed template length of a read and its mate in the same contig:
+     * positive for the leftmost read, negative for the other one
+     * @param occ the occurrence of the read
+     * @param mate the occurrence of the mate
+     * @param first true if the read is the first mate (breaks ties)
+     */
+    static int64_t templateLength(const TextOcc& occ, const TextOcc& mate,
+                                  bool first) {
+        int64_t begin = std::min(occ.getRange().getBegin(),
+                                 mate.getRange().getBegin());
+        int64_t end =
+            std::max(occ.getRange().getEnd(), mate.getRange().getEnd());
+        bool leftmost =
+            occ.getRange().getBegin() < mate.getRange().getBegin() ||
+            (occ.getRange().getBegin() == mate.getRange().getBegin() && first);
+        return leftmost ? end - begin : begin - end;
+    }
+
+  public:
+    /**
+     * Constructor
+     * @param index the index to which the reads are mapped, it should
+     * outlive the formatter
+     */
+    SamFormatter(const FMIndex& index)
+        : text(index.getText()), contigs(index.getContigs()) {
+    }
+
+    /**
+     * Get the SAM header with a @SQ line for every contig
+     * @param commandLine the command line of the program for the @PG line
+     */
+    static std::string header(const ContigTable& contigs,
+                              const std::string& commandLine) {
+        std::string h = "@HD\tVN:1.6\tSO:unsorted\n";
+        for (length_t i = 0; i < contigs.size(); i++)
+            h += "@SQ\tSN:" + contigs.getName(i) +
+                 "\tLN:" + std::to_string(contigs.getLength(i)) + '\n';
+        h += "@PG\tID:fmindex-map\tPN:fmindex-map\tCL:" + commandLine + '\n';
+        return h;
+    }
+
+    /**
+     * Append the records of a single-end read
+     * @param out the buffer [output]
+     * @param r the read
+     * @param fw the occurrences of the read
+     * @param rc the occurrences of the reverse complement of the read
+     */
+    void formatSingle(std::string& out, const ReadRecord& r,
+                      const std::vector<TextOcc>& fw,
+                      const std::vector<TextOcc>& rc) {
+        appendRead(out, r, fw, rc, findPrimary(fw, rc), 0, nullptr);
+    }
+
+    /**
+     * Append the records of a pair of reads. The mates are mapped
+     * independently. If they form a proper pair, the occurrences of that
+     * pair are the primary alignments, otherwise the primary alignment of
+     * each mate is its best occurrence.
+     * @param out the buffer [output]
+     * @param r1 the first mate
+     * @param fw1 the occurrences of the first mate
+     * @param rc1 the occurrences of the reverse complement of the first mate
+     * @param r2 the second mate
+     * @param fw2 the occurrences of the second mate
+     * @param rc2 the occurrences of the reverse complement of the second mate
+     * @param pair the best proper pair of the mates (see pairing.h)
+     */
+    void formatPair(std::string& out, const ReadRecord& r1,
+                    const std::vector<TextOcc>& fw1,
+                    const std::vector<TextOcc>& rc1, const ReadRecord& r2,
+                    const std::vector<TextOcc>& fw2,
+                    const std::vector<TextOcc>& rc2,
+                    const PairedMatch& pair = PairedMatch()) {
+        Hit hit1 = findPrimary(fw1, rc1), hit2 = findPrimary(fw2, rc2);
+        int flag = 0x1;
+        if (pair.valid) {
+            setPairedHit(hit1, fw1, rc1, pair.first, !pair.secondRev);
+            setPairedHit(hit2, fw2, rc2, pair.second, pair.secondRev);
+            flag |= 0x2;
+        }
+        appendRead(out, r1, fw1, rc1, hit1, flag | 0x40, &hit2);
+        appendRead(out, r2, fw2, rc2, hit2, flag | 0x80, &hit1);
+    }
+};
+
+/**
+ * Writes buffers to a file on a separate thread, in the order of their
+ * batch ids (0, 1, 2, ...). Buffers are swapped instead of copied, and the
+ * written buffers are handed back to the producers to reuse their memory.
+ */
+class SamWriter {
+  private:
+    std::ofstream ofs;
+    std::string filename;
+    std::thread writer;
+
+    std::mutex mutex;
+    std::condition_variable ready;       // signalled when a buffer arrives
+    std::map<size_t, std::string> reorder; // the buffers that are not written
+    std::vector<std::string> spare;      // written buffers for reuse
+    size_t nextID;                       // the id of the next buffer
+    bool closing;                        // no more buffers arrive
+    bool failed;                         // a write failed
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this]() {
+                return closing || reorder.count(nextID) > 0;
+            });
+            auto it = reorder.find(nextID);
+            if (it == reorder.end())
+                return; // closing and all buffers are written
+
+            std::string buffer = std::move(it->second);
+            reorder.erase(it);
+            nextID++;
+
+            lock.unlock();
+            ofs.write(buffer.data(), buffer.size());
+            bool ok = (bool)ofs;
+            buffer.clear();
+            lock.lock();
+
+            failed |= !ok;
+            spare.push_back(std::move(buffer));
+        }
+    }
+
+  public:
+    /**
+     * Constructor, opens the file, writes the header and starts the writer
+     * @param filename the name of the SAM file
+     * @param header the header of the file
+     */
+    SamWriter(const std::string& filename, const std::string& header)
+        : ofs(filename, std::ios::binary), filename(filename), nextID(0),
+          closing(false), failed(false) {
+        if (!ofs)
+            throw std::runtime_error("Problem writing: " + filename);
+        ofs << header;
+        writer = std::thread(&SamWriter::run, this);
+    }
+
+    ~SamWriter() {
+        if (writer.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closing = true;
+            }
+            ready.notify_one();
+            writer.join();
+        }
+    }
+
+    SamWriter(const SamWriter&) = delete;
+    SamWriter& operator=(const SamWriter&) = delete;
+
+    /**
+     * Hand over a buffer to be written. Every batch id must be submitted
+     * exactly once (possibly with an empty buffer).
+     * @param id the id of the batch of the buffer
+     * @param buffer the buffer, it is swapped with an empty buffer that may
+     * have capacity [input/output]
+     */
+    void submit(size_t id, std::string& buffer) {
+        std::string empty;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!spare.empty()) {
+                empty = std::move(spare.back());
+                spare.pop_back();
+            }
+            reorder[id].swap(buffer);
+        }
+        buffer.swap(empty);
+        ready.notify_one();
+    }
+
+    /**
+     * Write the remaining buffers and close the file
+     * @throws runtime_error if a write failed or a batch id is missing
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_one();
+        writer.join();
+        ofs.close();
+        if (failed || !ofs)
+            throw std::runtime_error("Problem writing: " + filename);
+        if (!reorder.empty())
+            throw std::runtime_error("Missing output of batch " +
+                                     std::to_string(nextID));
+    }
+};
+
+#endif
@@ -8,11 +8,26 @@
 
 class SearchScheme {
   private:
-    BiFMIndex& index; // reference to the index of the text that is searched
+    const BiFMIndex& index; // the index of the text that is searched, it is
+                            // not modified such that it can be shared by
+                            // multiple threads
     std::string name; // name of the search scheme
 
     length_t maxED;
     std::vector<Search> searches;
+    // the searches of the schemes for 1, ..., maxED errors, empty if the
+    // scheme for a lower number of errors is not available
+    std::vector<std::vector<Search>> strata;
+
+    /**
+     * Get the search context of the calling thread. Its workspace is reused
+     * for every pattern that the thread searches, so the searches do not
+     * allocate memory in the steady state.
+     */
+    static SearchContext& threadContext() {
+        static thread_local SearchContext ctx;
+        return ctx;
+    }
 
     static Search makeSearchFromLine(const std::string& line) {
 
@@ -51,8 +66,9 @@ class SearchScheme {
         return Search::makeSearch(vectors[0], vectors[1], vectors[2]);
     }
 
-    void doSearch(std::vector<FMOcc>& occ, const Search& s,
-                  const std::vector<RangePair> exactMatchRanges,
+    void doSearch(SearchContext& ctx, std::vector<FMOcc>& occ,
+                  const Search& s,
+                  const std::vector<RangePair>& exactMatchRanges,
                   std::vector<Substring>& parts) const {
 
         // get the first part of the search (already matched)
@@ -75,15 +91,13 @@ class SearchScheme {
                 // extend the exact match
                 // A) get the part to match exactly
                 const auto& part = parts[s.getPart(idxInSearch)];
-                // B) set direction in index
-                index.setDirection(part.getDirection());
-                // C) try to match part exactly
+                // B) try to match part exactly, in the direction of the part
                 ranges = index.matchExactBidirectionally(part, ranges);
                 if (ranges.empty()) {
                     // search failed
                     return;
                 }
-                // D) update exact length and idx in search
+                // C) update exact length and idx in search
                 exactLength += part.size();
                 idxInSearch++;
             }
@@ -91,12 +105,118 @@ class SearchScheme {
             // Create a start occurrence corresponding to the exact match
             BiFMOcc startOcc = BiFMOcc(ranges, 0, exactLength);
             // Start the approximate matching phase
-            index.recApproxMatch(s, startOcc, occ, parts, idxInSearch);
+            index.recApproxMatch(ctx, s, startOcc, occ, parts, idxInSearch);
+        }
+    }
+
+    /**
+     * Read the searches of the scheme for a number of errors
+     * @param folder the directory of the search scheme
+     * @param k the number of errors
+     * @param searches the searches [output]
+     * @throws runtime_error if the searches cannot be read
+     */
+    static void readSearches(const std::string& folder, length_t k,
+                             std::vector<Search>& searches) {
+        std::string line;
+        std::string searchFile = folder + std::to_string(k) + "/searches.txt";
+
+        std::ifstream stream_searches(searchFile);
+        if (!stream_searches) {
+            throw std::runtime_error("Prolbem reading: " + searchFile);
+        }
+
+        // read the searches line by line
+        while (getline(stream_searches, line)) {
+            try {
+                searches.push_back(makeSearchFromLine(line));
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error(
+                    "Something went wrong with processing line: " + line +
+                    "\nin file: " + searchFile + e.what());
+            }
+        }
+
+        stream_searches.close();
+    }
+
+    /**
+     * Partition a pattern uniformly into parts
+     * @param p the pattern
+     * @param numParts the number of parts
+     * @param parts the parts, in the forward direction [output]
+     */
+    static void partition(const std::string& p, unsigned int numParts,
+                          std::vector<Substring>& parts) {
+        parts.clear();
+        float fraction = ((float)p.size()) / numParts;
+        for (unsigned int i = 0; i < numParts; i++) {
+            parts.emplace_back(p, i * fraction, (i + 1) * fraction);
+        }
+        // set the end of the final part correct to be end of p
+        parts.back().setEnd(p.size());
+    }
+
+    /**
+     * Get the ranges of the exact match of a part, the ranges of every part
+     * are only matched once for all strata
+     * @param part the part, in the forward direction
+     * @param cache the parts that were matched before [input/output]
+     */
+    RangePair exactPartRanges(const Substring& part,
+                              std::vector<PartRanges>& cache) const {
+        for (const auto& c : cache) {
+            if (c.begin == part.begin() && c.end == part.end())
+                return c.ranges;
+        }
+        PartRanges c = {part.begin(), part.end(),
+                        index.matchExactBidirectionally(part)};
+        cache.push_back(c);
+        return c.ranges;
+    }
+
+    /**
+     * Search the occurrences of a pattern with at most k errors with the
+     * scheme for k errors
+     * @param p the pattern
+     * @param k the number of errors, 1 to maxED
+     * @param occ the occurrences are appended [output]
+     * @param cache the exact matches of the parts [input/output]
+     */
+    void searchStratum(const std::string& p, length_t k,
+                       std::vector<FMOcc>& occ,
+                       std::vector<PartRanges>& cache) const {
+        const std::vector<Search>& scheme =
+            (k == maxED) ? searches : strata[k];
+        if (scheme.empty()) {
+            throw std::runtime_error("The search scheme " + name +
+                                     " has no searches for " +
+                                     std::to_string(k) + " errors");
+        }
+
+        unsigned int numParts = scheme[0].getNumParts();
+        if (numParts * k >= p.size()) {
+            // splitting up is not viable -> search the entire pattern
+            index.naiveApproxSearch(p, k, occ);
+            return;
+        }
+
+        SearchContext& ctx = threadContext();
+        std::vector<Substring>& parts = ctx.getParts();
+        partition(p, numParts, parts);
+        std::vector<RangePair>& exactMatchRanges = ctx.getExactMatchRanges();
+        exactMatchRanges.clear();
+        for (const auto& part : parts) {
+            exactMatchRanges.emplace_back(exactPartRanges(part, cache));
+        }
+
+        for (const auto& s : scheme) {
+            doSearch(ctx, occ, s, exactMatchRanges, parts);
         }
     }
 
   public:
-    SearchScheme(BiFMIndex& index, const std::string& folder,
+    SearchScheme(const BiFMIndex& index, const std::string& folder,
                  const length_t maxED)
         : index(index), maxED(maxED) {
         // read the search scheme
@@ -115,41 +235,42 @@ class SearchScheme {
             ifs.close();
         }
 
-        std::string searchFile =
-            folder + std::to_string(maxED) + "/searches.txt";
+        readSearches(folder, maxED, searches);
 
-        std::ifstream stream_searches(searchFile);
-        if (!stream_searches) {
-            throw std::runtime_error("Prolbem reading: " + searchFile);
-        }
-
-        // read the searches line by line
-        while (getline(stream_searches, line)) {
-            try {
-                searches.push_back(makeSearchFromLine(line));
-            } catch (const std::runtime_error& e) {
-                throw std::runtime_error(
-                    "Something went wrong with processing line: " + line +
-                    "\nin file: " + searchFile + e.what());
+        // the schemes for fewer errors are used by the best-stratum search
+        strata.resize(maxED);
+        for (length_t k = 1; k < maxED; k++) {
+            std::ifstream ifs(folder + std::to_string(k) + "/searches.txt");
+            if (ifs) {
+                readSearches(folder, k, strata[k]);
             }
         }
-
-        stream_searches.close();
     }
 
-    std::vector<TextOcc> matchApprox(const std::string& p) const {
+    /**
+     * Searches a pattern approximately with the search scheme, without
+     * locating the occurrences in the text. The occurrences are located
+     * with BiFMIndex::filterRedundantMatches, such that searching and
+     * locating can be done by different threads. The state of the search is
+     * kept in a SearchContext of the calling thread, so multiple threads can
+     * call this function concurrently on one scheme and one shared index.
+     * @param p the pattern to match
+     * @param occ the occurrences in the FM-index are appended [output]
+     */
+    void searchApprox(const std::string& p, std::vector<FMOcc>& occ) const {
         if (maxED == 0) {
-            const auto& pos = index.matchExact(p);
-            std::vector<TextOcc> r;
-            r.reserve(pos.size());
-            for (const auto& po : pos) {
-                r.emplace_back(Range(po, po + p.size()), 0);
-            }
-            return r;
+            RangePair ranges =
+                index.matchExactBidirectionally(Substring(p, FORWARD));
+            if (!ranges.empty())
+                occ.emplace_back(ranges.getBackwardRange(), 0, p.size());
+            return;
         }
 
+        // the state and the workspace of the searches for this pattern
+        SearchContext& ctx = threadContext();
+
         // create the parts of the pattern
-        std::vector<Substring> parts;
+        std::vector<Substring>& parts = ctx.getParts();
         unsigned int numParts = searches[0].getNumParts();
 
         if (numParts * maxED >= p.size()) {
@@ -158,37 +279,162 @@ class SearchScheme {
                          "entered pattern is too short "
                       << p.size() << std::endl;
 
-            return index.naiveApproxMatch(p, maxED);
+            index.naiveApproxSearch(p, maxED, occ);
+            return;
         }
 
         // partition the read uniformly
-        float fraction = ((float)p.size()) / numParts;
-        for (unsigned int i = 0; i < numParts; i++) {
-            parts.emplace_back(p, i * fraction, (i + 1) * fraction);
-        }
-        // set the end of the final part correct to be end of p
-        parts.back().setEnd(p.size());
+        partition(p, numParts, parts);
 
         // calculate the ranges corresponding to the exact match for each part
-        std::vector<RangePair> exactMatchRanges;
+        std::vector<RangePair>& exactMatchRanges = ctx.getExactMatchRanges();
+        exactMatchRanges.clear();
 
         // the direction of the initial matching can be forward or backward, but
         // the direction in the parts is by default forward so do this in the
         // forward direction
-        index.setDirection(FORWARD);
-
         for (const auto& part : parts) {
             exactMatchRanges.emplace_back(
                 index.matchExactBidirectionally(part));
         }
 
-        std::vector<FMOcc> occ; // the vector with all FM occurrences
         // do each search
         for (const auto& s : searches) {
-            doSearch(occ, s, exactMatchRanges, parts);
+            doSearch(ctx, occ, s, exactMatchRanges, parts);
         }
+    }
+
+    /**
+     * Matches a pattern approximately with the search scheme. Multiple
+     * threads can call this function concurrently (see searchApprox).
+     * @param p the pattern to match
+     * @returns the non-redundant occurrences in the text
+     */
+    std::vector<TextOcc> matchApprox(const std::string& p) const {
+        length_t numOcc;
+        return matchApprox(p, numOcc);
+    }
+
+    /**
+     * Matches a pattern approximately like matchApprox(p) and counts the
+     * occurrences. If there are more than the occurrence cap of the index
+     * (see FMIndex::setOccurrenceCap), only a sample is located.
+     * @param p the pattern to match
+     * @param numOcc the number of occurrences [output]
+     * @returns the non-redundant (sampled) occurrences in the text
+     */
+    std::vector<TextOcc> matchApprox(const std::string& p,
+                                     length_t& numOcc) const {
+        if (maxED == 0) {
+            const auto& pos = index.matchExact(p, numOcc);
+            std::vector<TextOcc> r;
+            r.reserve(pos.size());
+            for (const auto& po : pos) {
+                r.emplace_back(Range(po, po + p.size()), 0,
+                               index.getContigs().findContig(po));
+            }
+            return r;
+        }
+
+        std::vector<FMOcc> occ; // the vector with all FM occurrences
+        searchApprox(p, occ);
+        return index.filterRedundantMatches(occ, maxED, numOcc);
+    }
+
+    /**
+     * Searches only the best stratum of a pattern: the occurrences with the
+     * lowest edit distance. The schemes for 0, 1, 2, ... errors are run in
+     * turn until one of them finds occurrences, the exact matches of the
+     * parts of the pattern are shared between the strata. Once a pattern is
+     * too short for the scheme of a stratum, the remaining strata are
+     * searched with FMIndex::naiveBestSearch. Like searchApprox,
+     * the occurrences are not located and multiple threads can call this
+     * function concurrently.
+     * @param p the pattern to match
+     * @param occ the occurrences in the FM-index are appended [output]
+     * @param extraStrata the number of strata after the best one that are
+     * searched as well, e.g. 1 to find the second-best occurrences
+     * @param maxDistance the highest stratum to search, at most maxED
+     * @returns the edit distance of the best stratum, maxDistance + 1 if the
+     * pattern does not occur with at most maxDistance errors
+     * @throws runtime_error if the scheme for a stratum is not available
+     */
+    length_t searchBestStratum(const std::string& p, std::vector<FMOcc>& occ,
+                               length_t extraStrata,
+                               length_t maxDistance) const {
+        maxDistance = std::min(maxDistance, maxED);
+        SearchContext& ctx = threadContext();
+        std::vector<PartRanges>& cache = ctx.getPartRanges();
+        cache.clear();
+        length_t best = maxDistance + 1;
+        size_t initial = occ.size();
+
+        // stratum 0: extend the exact match of the first part of the
+        // partition of the next stratum, the parts of the context are only
+        // overwritten by the strata after it
+        std::vector<Substring>& parts = ctx.getParts();
+        parts.clear();
+        if (maxDistance == 0 || p.size() < 2) {
+            parts.emplace_back(p, 0, p.size());
+        } else {
+            const std::vector<Search>& next =
+                (maxED == 1) ? searches : strata[1];
+            partition(p, next.empty() ? 1 : next[0].getNumParts(), parts);
+        }
+        RangePair ranges = exactPartRanges(parts[0], cache);
+        for (size_t i = 1; i < parts.size() && !ranges.empty(); i++) {
+            if (exactPartRanges(parts[i], cache).empty())
+                ranges = RangePair();
+            else
+                ranges = index.matchExactBidirectionally(parts[i], ranges);
+        }
+        if (!ranges.empty()) {
+            occ.emplace_back(ranges.getBackwardRange(), 0, p.size());
+            best = 0;
+        }
+
+        for (length_t k = 1; k <= maxDistance && k <= best + extraStrata;
+             k++) {
+            const std::vector<Search>& scheme =
+                (k == maxED) ? searches : strata[k];
+            if (best > maxDistance && !scheme.empty() &&
+                scheme[0].getNumParts() * k >= p.size()) {
+                // too short for the schemes: search the remaining strata
+                // at once instead of a naive search per stratum
+                return index.naiveBestSearch(p, maxDistance, occ,
+                                             extraStrata);
+            }
+            searchStratum(p, k, occ, cache);
+            if (best > maxDistance && occ.size() > initial)
+                best = k;
+        }
+        return best;
+    }
+
+    /**
+     * Searches only the best stratum of a pattern, see searchBestStratum,
+     * with at most maxED errors
+     */
+    length_t searchBestStratum(const std::string& p, std::vector<FMOcc>& occ,
+                               length_t extraStrata = 0) const {
+        return searchBestStratum(p, occ, extraStrata, maxED);
+    }
 
-        return index.filterRedundantMatches(occ, maxED);
+    /**
+     * Matches the best stratum of a pattern approximately, see
+     * searchBestStratum
+     * @param p the pattern to match
+     * @param extraStrata the number of strata after the best one
+     * @returns the non-redundant occurrences in the text
+     */
+    std::vector<TextOcc> matchBestStratum(const std::string& p,
+                                          length_t extraStrata = 0) const {
+        std::vector<FMOcc> occ;
+        length_t best = searchBestStratum(p, occ, extraStrata);
+        if (occ.empty())
+            return std::vector<TextOcc>();
+        return index.filterRedundantMatches(
+            occ, std::min(best + extraStrata, maxED));
     }
 };
 
@@ -0,0 +1,163 @@
+#ifndef SEARCHSTACK_H
+#define SEARCHSTACK_H
+
+/**
+ * The stack of nodes of a search tree in the FM-index, in a struct-of-arrays
+ * layout: the begins and ends of the ranges, the rows and the characters of
+ * the nodes are separate packed arrays. The arrays are consecutive regions of
+ * one arena that only grows, so pushing and popping nodes does not allocate
+ * memory once the arena is large enough, and a search that pops the nodes
+ * from the top streams through contiguous memory.
+ *
+ * A stack can be shared by nested searches: a search only pops the nodes
+ * above the size of the stack at its start, and a nested search leaves the
+ * stack as it found it.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "fmindex.h"
+
+class SearchStack {
+  private:
+    std::vector<length_t> arena; // the arrays, capacity elements each
+    size_t numArrays;            // the number of arrays of length_t
+    size_t count;                // the number of nodes on the stack
+    size_t capacity;             // the maximal number of nodes in the arena
+
+    /**
+     * Double the capacity of the arena
+     */
+    void grow() {
+        size_t newCapacity = std::max<size_t>(256, 2 * capacity);
+        std::vector<length_t> newArena(
+            numArrays * newCapacity +
+            (newCapacity + sizeof(length_t) - 1) / sizeof(length_t));
+        for (size_t a = 0; a < numArrays; a++)
+            std::copy(arena.begin() + a * capacity,
+                      arena.begin() + a * capacity + count,
+                      newArena.begin() + a * newCapacity);
+        if (count > 0)
+            memcpy(newArena.data() + numArrays * newCapacity, characters(),
+                   count);
+        arena.swap(newArena);
+        capacity = newCapacity;
+    }
+
+  protected:
+    /**
+     * Get an array of length_t values of the nodes
+     */
+    length_t* values(size_t a) {
+        return arena.data() + a * capacity;
+    }
+    const length_t* values(size_t a) const {
+        return arena.data() + a * capacity;
+    }
+
+    /**
+     * Get the array of characters of the nodes
+     */
+    char* characters() {
+        return (char*)(arena.data() + numArrays * capacity);
+    }
+    const char* characters() const {
+        return (const char*)(arena.data() + numArrays * capacity);
+    }
+
+    /**
+     * Push a node with a range and a row, the other values are set by the
+     * caller
+     * @returns the index of the node
+     */
+    size_t push(char c, const Range& range, length_t row) {
+        if (count == capacity)
+            grow();
+        values(0)[count] = range.getBegin();
+        values(1)[count] = range.getEnd();
+        values(2)[count] = row;
+        characters()[count] = c;
+        return count++;
+    }
+
+    /**
+     * Constructor
+     * @param numArrays the number of arrays of length_t values, at least 3
+     */
+    explicit SearchStack(size_t numArrays)
+        : numArrays(numArrays), count(0), capacity(0) {
+    }
+
+  public:
+    /**
+     * Constructor, an empty stack for nodes with a range
+     */
+    SearchStack() : SearchStack(3) {
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * Remove all nodes, the arena is kept
+     */
+    void clear() {
+        count = 0;
+    }
+
+    /**
+     * Push a node
+     * @param c the character of the node
+     * @param range the range over the suffix array
+     * @param row the row of the node in the alignment matrix = its depth
+     */
+    void emplace_back(char c, const Range& range, length_t row) {
+        push(c, range, row);
+    }
+
+    /**
+     * Remove the top node
+     */
+    void pop_back() {
+        count--;
+    }
+
+    /**
+     * Exchange nodes i and j
+     */
+    void swap(size_t i, size_t j) {
+        for (size_t a = 0; a < numArrays; a++)
+            std::swap(values(a)[i], values(a)[j]);
+        std::swap(characters()[i], characters()[j]);
+    }
+
+    /**
+     * Get the range of node i
+     */
+    Range getRange(size_t i) const {
+        return Range(values(0)[i], values(1)[i]);
+    }
+
+    /**
+     * Get the row of node i
+     */
+    length_t getRow(size_t i) const {
+        return values(2)[i];
+    }
+
+    /**
+     * Get the character of node i
+     */
+    char getCharacter(size_t i) const {
+        return characters()[i];
+    }
+};
+
+#endif
@@ -2,21 +2,47 @@
 #define SUFFIXARRAY_H
 
 #include "bitvec.h"
+#include "indexwidth.h"
 #include <fstream>
 #include <iostream> // used for printing
 #include <stdint.h>
 #include <string>
 #include <vector>
 
-typedef uint32_t length_t;
+/**
+ * The sampling strategy of the sparse suffix array. SAMPLE_SA_INDEX stores
+ * SA[i] for every i that is a multiple of the sparseness factor s.
+ * SAMPLE_TEXT_POSITION stores SA[i] for every SA[i] that is a multiple of s,
+ * marks the sampled rows in a bitvector and bit-packs the values, such that
+ * every locate needs at most s - 1 LF steps.
+ */
+enum SASampling { SAMPLE_SA_INDEX, SAMPLE_TEXT_POSITION };
 
 class SparseSuffixArray {
   private:
     length_t sparsenessFactor; // the sparseness factor
-    Bitvec
-        bitvector; // Only necessary if every ith suffix is stored (comment out
-                   // or delete if every ith entry in suffix array is stored)
+    SASampling sampling;       // the sampling strategy
+    Bitvec bitvector; // the sampled rows (SAMPLE_TEXT_POSITION only)
     std::vector<length_t> sparseSA; // the sparse suffix array
+    const length_t* samples; // points to sparseSA or into a mapped file
+    length_t numSamples;     // the number of stored samples
+
+    // bit-packed samples SA[i] / sparsenessFactor (SAMPLE_TEXT_POSITION only)
+    std::vector<uint64_t> packed; // the packed samples
+    const uint64_t* packedData;   // points to packed or into a mapped file
+    uint64_t width;               // the number of bits per sample
+
+    /**
+     * Get the idx'th bit-packed sample
+     * @param idx the index of the sample
+     */
+    uint64_t getPacked(uint64_t idx) const {
+        uint64_t bit = idx * width, w = bit / 64, b = bit % 64;
+        uint64_t v = packedData[w] >> b;
+        if (b + width > 64)
+            v |= packedData[w + 1] << (64 - b);
+        return v & ((1ull << width) - 1);
+    }
 
   public:
     /**
@@ -27,6 +53,8 @@ class SparseSuffixArray {
      */
     bool hasStored(const length_t i) const {
         // 1 line of code
+        if (sampling == SAMPLE_TEXT_POSITION)
+            return bitvector[i];
         return ((i % sparsenessFactor) == 0);
     }
 
@@ -40,7 +68,9 @@ class SparseSuffixArray {
     length_t operator[](const length_t i) const {
         assert(hasStored(i));
         // 1 line of code
-        return sparseSA[i/sparsenessFactor];
+        if (sampling == SAMPLE_TEXT_POSITION)
+            return getPacked(bitvector.rank(i)) * sparsenessFactor;
+        return samples[i/sparsenessFactor];
     }
 
     /**
@@ -48,16 +78,114 @@ class SparseSuffixArray {
      * @param sa the original suffix array
      */
     void createSparseSA(const std::vector<length_t>& sa) {
-        sparseSA.resize(sa.size());
+        if (sampling == SAMPLE_TEXT_POSITION) {
+            createTextSampledSA(sa);
+            return;
+        }
+        sparseSA.resize((sa.size() + sparsenessFactor - 1) / sparsenessFactor);
          for (length_t i = 0; i < sa.size(); i++) {
              // 2 - 3 lines of code
              if((i % sparsenessFactor) == 0){
                sparseSA[i/sparsenessFactor] = sa[i];
              }
          }
+        samples = sparseSA.data();
+        numSamples = sparseSA.size();
+    }
+
+    /**
+     * Creates the text-position-sampled suffix array from the original suffix
+     * array (SAMPLE_TEXT_POSITION)
+     * @param sa the original suffix array
+     */
+    void createTextSampledSA(const std::vector<length_t>& sa) {
+        bitvector = Bitvec(sa.size() + 1);
+        numSamples = 0;
+        for (length_t i = 0; i < sa.size(); i++) {
+            if (sa[i] % sparsenessFactor == 0) {
+                bitvector[i] = true;
+                numSamples++;
+            }
+        }
+        bitvector.index();
+
+        // the samples are stored as SA[i] / sparsenessFactor
+        width = 1;
+        while ((((sa.size() - 1) / sparsenessFactor) >> width) != 0)
+            width++;
+        packed.assign((numSamples * width + 63) / 64 + 1, 0ull);
+        for (length_t i = 0, idx = 0; i < sa.size(); i++) {
+            if (sa[i] % sparsenessFactor != 0)
+                continue;
+            uint64_t v = sa[i] / sparsenessFactor, bit = idx++ * width;
+            packed[bit / 64] |= v << (bit % 64);
+            if (bit % 64 + width > 64)
+                packed[bit / 64 + 1] |= v >> (64 - bit % 64);
+        }
+        packedData = packed.data();
+    }
+
+    /**
+     * Get the sparseness factor of this suffix array
+     */
+    length_t getSparseness() const {
+        return sparsenessFactor;
+    }
+
+    /**
+     * Get the sampling strategy of this suffix array
+     */
+    SASampling getSampling() const {
+        return sampling;
+    }
+
+    /**
+     * Write the sparse suffix array to an open filestream
+     * @param ofs Open output filestream
+     */
+    void write(std::ofstream& ofs) const {
+        if (sampling == SAMPLE_TEXT_POSITION) {
+            uint64_t header[3] = {sparsenessFactor, numSamples, width};
+            ofs.write((char*)header, sizeof(header));
+            bitvector.write(ofs);
+            ofs.write((char*)packedData,
+                      ((numSamples * width + 63) / 64 + 1) * sizeof(uint64_t));
+            return;
+        }
+        uint64_t header[2] = {sparsenessFactor, numSamples};
+        ofs.write((char*)header, sizeof(header));
+        ofs.write((char*)samples, numSamples * sizeof(length_t));
+    }
+
+    /**
+     * Let the sparse suffix array point to a memory region that was written
+     * by write(). No data is copied, the memory region must outlive this
+     * object. The sparseness factor and sampling strategy are those of the
+     * serialized array.
+     * @param ptr Pointer to the serialized sparse suffix array
+     * @param sampling The sampling strategy it was written with
+     */
+    void map(const char* ptr, SASampling sampling) {
+        const uint64_t* header = (const uint64_t*)ptr;
+        this->sampling = sampling;
+        sparsenessFactor = header[0];
+        numSamples = header[1];
+        sparseSA.clear();
+        if (sampling == SAMPLE_TEXT_POSITION) {
+            width = header[2];
+            ptr += 3 * sizeof(uint64_t);
+            bitvector.map(ptr);
+            packed.clear();
+            packedData = (const uint64_t*)ptr;
+            return;
+        }
+        samples = (const length_t*)(ptr + 2 * sizeof(uint64_t));
     }
 
-    SparseSuffixArray(length_t sparseness) : sparsenessFactor(sparseness) {
+    SparseSuffixArray(length_t sparseness,
+                      SASampling sampling = SAMPLE_SA_INDEX)
+        : sparsenessFactor(sparseness), sampling(sampling), samples(nullptr),
+          numSamples(0), packedData(nullptr), width(0) {
     }
 };
 
@@ -1,5 +1,10 @@
+#include "fastxreader.h"
 #include "fmindex.h"
+#include "pairing.h"
+#include "sais.h"
 #include "gtest/gtest.h"
+#include <random>
+#include <sstream>
 
 using namespace std;
 
@@ -102,6 +107,110 @@ TEST(BitvecTest, LargeSize) {
         EXPECT_EQ(bv.rank(i), (i + 2) / 3);
 }
 
+TEST(BitvecTest, RankPairTest) {
+    // random bits, pairs of positions in the same word, in the same block of
+    // 8 words and in different blocks
+    size_t bvSize = 71234;
+    Bitvec bv(bvSize);
+    mt19937 rng(1);
+    for (size_t i = 0; i < bvSize; i++)
+        bv[i] = rng() % 3 == 0;
+    bv.index();
+
+    for (size_t i = 0; i < 3000; i++) {
+        uint64_t b = rng() % bvSize, e;
+        if (i % 3 == 0)
+            e = b + rng() % (64 - b % 64);
+        else if (i % 3 == 1)
+            e = b + rng() % (512 - b % 512);
+        else
+            e = b + rng() % (bvSize - b);
+        e = min<uint64_t>(e, bvSize - 1);
+        uint64_t rb, re;
+        bv.rankPair(b, e, rb, re);
+        EXPECT_EQ(rb, bv.rank(b));
+        EXPECT_EQ(re, bv.rank(e));
+    }
+}
+
+TEST(InterleavedOccTableTest, OccTest) {
+    // spans several blocks of 192 characters, '$' in the second block
+    string BWT;
+    for (size_t i = 0; i < 1000; i++)
+        BWT += (i == 300) ? '$' : "ACGT"[(i * i + i / 7) % 4];
+    Alphabet<5> sigma(BWT);
+    InterleavedOccTable table(sigma, BWT);
+
+    vector<size_t> expVal(sigma.size(), 0);
+    for (size_t i = 0; i <= BWT.size(); i++) {
+        for (size_t cIdx = 1; cIdx < sigma.size(); cIdx++)
+            EXPECT_EQ(table.occ(cIdx - 1, i), expVal[cIdx]);
+        if (i < BWT.size())
+            expVal[sigma.c2i(BWT[i])]++;
+    }
+}
+
+TEST(InterleavedOccTableTest, OccAllPairTest) {
+    // random characters, pairs of positions in the same block of 192
+    // characters and in different blocks
+    mt19937 rng(2);
+    string BWT;
+    for (size_t i = 0; i < 5000; i++)
+        BWT += (i == 2222) ? '$' : "ACGT"[rng() % 4];
+    Alphabet<5> sigma(BWT);
+    InterleavedOccTable table(sigma, BWT);
+
+    for (size_t i = 0; i < 3000; i++) {
+        uint64_t b = rng() % (BWT.size() + 1), e;
+        if (i % 2 == 0)
+            e = b + rng() % (192 - b % 192);
+        else
+            e = b + rng() % (BWT.size() + 1 - b);
+        e = min<uint64_t>(e, BWT.size());
+        uint64_t occB[4], occE[4];
+        table.occAllPair(b, e, occB, occE);
+        for (int c = 0; c < 4; c++) {
+            EXPECT_EQ(occB[c], table.occ(c, b));
+            EXPECT_EQ(occE[c], table.occ(c, e));
+        }
+    }
+}
+
+TEST(SuffixArrayTest, SAISTest) {
+    vector<string> texts = {"$", "A$", "AAAAAAAAAA$", "ACGTACGTACGT$",
+                            "GATTACAGATTACACATTAG$", "TTTTGTTTTGTTTTGAAAAC$"};
+
+    for (const auto& t : texts) {
+        vector<length_t> expected(t.size());
+        for (length_t i = 0; i < t.size(); i++)
+            expected[i] = i;
+        sort(expected.begin(), expected.end(), [&t](length_t a, length_t b) {
+            return t.compare(a, string::npos, t, b, string::npos) < 0;
+        });
+
+        vector<length_t> sa;
+        sais::constructSA(t, sa);
+        EXPECT_EQ(sa, expected);
+    }
+}
+
+TEST(SuffixArrayTest, TextSampledSATest) {
+    string t = "GATTACAGATTACACATTAGGATTACAGATTACACATTAGACGTACGTACGT$";
+    vector<length_t> sa;
+    sais::constructSA(t, sa);
+
+    for (length_t s : {1, 3, 4, 7}) {
+        SparseSuffixArray ssa(s, SAMPLE_TEXT_POSITION);
+        ssa.createSparseSA(sa);
+        for (length_t i = 0; i < sa.size(); i++) {
+            EXPECT_EQ(ssa.hasStored(i), sa[i] % s == 0);
+            if (ssa.hasStored(i)) {
+                EXPECT_EQ(ssa[i], sa[i]);
+            }
+        }
+    }
+}
+
 TEST_F(FunctionalityTest, occTest) {
 
     length_t dollarPos = 626743;
@@ -132,6 +241,36 @@ TEST_F(FunctionalityTest, occTest) {
     EXPECT_EQ(fmindex.occ(4, fmindex.getText().size()), 1163340);
 }
 
+TEST(OccAllTest, LayoutTest) {
+    // the fused occ function matches occ for both occurrence table layouts
+    mt19937 rng(3);
+    string t;
+    for (size_t i = 0; i < 3000; i++)
+        t += "ACGT"[rng() % 4];
+    t += "$";
+    {
+        ofstream ofs("occall.txt");
+        ofs << t;
+    }
+
+    for (OccTableLayout layout : {BITVECTORS, INTERLEAVED}) {
+        FMIndex index("occall", 4, false, layout);
+        for (size_t i = 0; i < 2000; i++) {
+            length_t b = rng() % (t.size() + 1);
+            length_t e = (i % 2 == 0) ? b + rng() % 64 : rng() % t.size();
+            e = min<length_t>(e, t.size());
+            array<length_t, ALPHABET> occB, occE;
+            index.occAll(Range(b, e), occB, occE);
+            for (length_t c = 0; c < ALPHABET; c++) {
+                EXPECT_EQ(occB[c], index.occ(c, b));
+                // empty ranges have e = b
+                EXPECT_EQ(occE[c], index.occ(c, max(b, e)));
+            }
+        }
+    }
+    remove("occall.txt");
+}
+
 TEST_F(FunctionalityTest, findLFTest) {
 
     vector<length_t> values = {1,       2435828, 3706935, 2435847, 1164846,
@@ -145,6 +284,30 @@ TEST_F(FunctionalityTest, findLFTest) {
     }
 }
 
+TEST(ContigTableTest, FindContigTest) {
+    // contigs of various lengths, including an empty one
+    vector<length_t> lengths = {5, 1, 0, 17, 3, 64, 2};
+    ContigTable contigs;
+    for (length_t i = 0; i < lengths.size(); i++)
+        contigs.add("contig" + to_string(i), lengths[i]);
+    contigs.index();
+
+    EXPECT_EQ(contigs.size(), lengths.size());
+    EXPECT_EQ(contigs.getTotalLength(), 92);
+
+    length_t pos = 0;
+    for (length_t i = 0; i < lengths.size(); i++) {
+        EXPECT_EQ(contigs.getStart(i), pos);
+        for (length_t j = 0; j < lengths[i]; j++, pos++)
+            EXPECT_EQ(contigs.findContig(pos), i);
+    }
+
+    EXPECT_TRUE(contigs.inSingleContig(0, 5));
+    EXPECT_FALSE(contigs.inSingleContig(4, 6));
+    EXPECT_TRUE(contigs.inSingleContig(6, 23));
+    EXPECT_FALSE(contigs.inSingleContig(90, 93));
+}
+
 TEST_F(FunctionalityTest, findSATest) {
 
     vector<length_t> values = {4870265, 3487107, 305082,  25114,   3611763,
@@ -160,6 +323,22 @@ TEST_F(FunctionalityTest, findSATest) {
     EXPECT_EQ(fmindex.findSA(626743), 0);
 }
 
+TEST_F(FunctionalityTest, locateRangesTest) {
+    // overlapping, empty and single-row ranges
+    vector<Range> ranges = {Range(0, 100),          Range(50, 150),
+                            Range(626740, 626750), Range(1000, 1000),
+                            Range(3355845, 3355846)};
+
+    vector<length_t> expected;
+    for (const auto& r : ranges)
+        for (length_t i = r.getBegin(); i < r.getEnd(); i++)
+            expected.push_back(fmindex.findSA(i));
+
+    vector<length_t> positions;
+    fmindex.locateRanges(ranges, positions);
+    EXPECT_EQ(positions, expected);
+}
+
 TEST_F(FunctionalityTest, AddCharLeftTest) {
 
     Range startRange(0, text.size());
@@ -219,28 +398,188 @@ TEST_F(IntegrationTest, matchExactTest) {
     EXPECT_EQ(r.size(), 0);
 }
 
-vector<pair<string, string>> getPairedReads(const string& base) {
-    ifstream ifs(base + ".reads.fasta");
-    if (!ifs)
-        throw runtime_error("Problem reading: " + base + ".reads.fasta");
+TEST_F(IntegrationTest, OccurrenceCapTest) {
+    FMIndex index(base, 32, false);
+    index.setOccurrenceCap(1000, 4);
+    EXPECT_EQ(index.getOccurrenceCap(), 1000);
+
+    // more occurrences than the cap: only a sample is located
+    length_t numOcc;
+    auto pos = index.matchExact("AAAAA", numOcc);
+    EXPECT_EQ(numOcc, 13047);
+    EXPECT_LE(pos.size(), 4);
+    EXPECT_FALSE(pos.empty());
+    for (const auto& p : pos) {
+        EXPECT_EQ(text.substr(p, 5), "AAAAA");
+    }
+
+    // fewer occurrences than the cap: all are located
+    pos = index.matchExact("TCTAG", numOcc);
+    EXPECT_EQ(numOcc, 134);
+    EXPECT_EQ(pos.size(), 134);
+
+    // approximate matches: only the rows with the lowest distance are
+    // counted and the sample has the lowest distance
+    auto occ = index.naiveApproxMatch("AAAAA", 1, numOcc);
+    EXPECT_EQ(numOcc, 13047);
+    EXPECT_LE(occ.size(), 4);
+    for (const auto& o : occ) {
+        EXPECT_EQ(o.getDistance(), 0);
+        EXPECT_EQ(text.substr(o.begin(), 5), "AAAAA");
+    }
+
+    // approximate matches of a repeat with fewer loci than the cap: the
+    // redundant alignments of a locus do not count, all loci are located
+    mt19937 rng(5);
+    string t;
+    for (size_t i = 0; i < 20000; i++)
+        t += "ACGT"[rng() % 4];
+    string repeat = t.substr(500, 100);
+    vector<length_t> loci = {500};
+    for (length_t i = 1; i < 18; i++) {
+        loci.push_back(1000 * i + 500);
+        t.replace(loci.back(), repeat.size(), repeat);
+    }
+    t += "$";
+    {
+        ofstream ofs("occcap.txt");
+        ofs << t;
+    }
+    FMIndex small("occcap", 4, false);
+    small.setOccurrenceCap(50);
+    for (length_t k = 1; k <= 3; k++) {
+        occ = small.naiveApproxMatch(repeat, k, numOcc);
+        EXPECT_EQ(numOcc, loci.size());
+        vector<length_t> found;
+        for (const auto& o : occ) {
+            if (o.getDistance() == 0)
+                found.push_back(o.begin());
+        }
+        EXPECT_EQ(found, loci);
+    }
+    remove("occcap.txt");
+}
+
+TEST_F(IntegrationTest, matchExactKmerTableTest) {
+    FMIndex index(base, 32, false);
+    index.createKmerTable(8, 1 << 20);
+    EXPECT_EQ(index.getKmerTable().getK(), 8);
+
+    // shorter than, equal to and longer than k
+    vector<string> patterns = {"ACAGC", "TCTAGGAT", "GATTACAGA",
+                               "ACCGGATCGTGTGAAGAGGGGAACGTTC"};
+    for (length_t i = 0; i + 12 <= 4000; i += 400)
+        patterns.push_back(text.substr(i, 12));
+
+    for (const auto& p : patterns) {
+        auto expected = fmindex.matchExact(p);
+        auto pos = index.matchExact(p);
+        sort(expected.begin(), expected.end());
+        sort(pos.begin(), pos.end());
+        EXPECT_EQ(pos, expected);
+    }
+}
+
+TEST_F(IntegrationTest, multiContigTest) {
+    // three contigs, "ACGTTGCA" occurs only across the first boundary
+    istringstream fasta(">chr1 first\nGGGGACGT\nAC\n>chr2\nTGCAGGGGACGTTGCA\n"
+                        ">chr3\nnnACGTTGCA\n");
+    string mtext;
+    ContigTable contigs;
+    ContigTable::parseFasta(fasta, mtext, contigs);
+    ASSERT_EQ(contigs.size(), 3);
+    EXPECT_EQ(contigs.getName(0), "chr1");
+    EXPECT_EQ(contigs.getLength(0), 10);
+    EXPECT_EQ(mtext.size(), 37);
+    EXPECT_EQ(mtext.substr(0, 10), "GGGGACGTAC");
+
+    {
+        ofstream ofs("multicontig.txt");
+        ofs << mtext;
+    }
+    ASSERT_TRUE(contigs.write("multicontig.contigs"));
+
+    FMIndex index("multicontig", 4, false);
+    EXPECT_EQ(index.getContigs().size(), 3);
 
-    string line;
-    bool first = true;
+    // ACTGCA spans chr1 and chr2
+    EXPECT_TRUE(index.matchExact("ACTGCA").empty());
+
+    auto pos = index.matchExact("ACGTTGCA");
+    sort(pos.begin(), pos.end());
+    EXPECT_EQ(pos, vector<length_t>({18, 28}));
+    EXPECT_EQ(index.getContigs().findContig(18), 1);
+    EXPECT_EQ(index.getContigs().findContig(28), 2);
+    EXPECT_EQ(28 - index.getContigs().getStart(2), 2);
+
+    auto occ = index.naiveApproxMatch("ACGTTGCA", 1);
+    for (const auto& o : occ)
+        EXPECT_EQ(o.getContig(), index.getContigs().findContig(o.begin()));
+
+    remove("multicontig.txt");
+    remove("multicontig.contigs");
+}
+
+vector<pair<string, string>> getPairedReads(const string& base) {
+    // the mates of a pair are interleaved in <base>.reads.fasta
+    ReadInput input(base + ".reads.fasta", true);
+    ReadBatch batch;
     vector<pair<string, string>> pairedReads;
 
-    while (getline(ifs, line)) {
-        if (line[0] == '>')
-            continue;
-        if (first)
-            pairedReads.emplace_back(line, "");
-        else
-            pairedReads.back().second = line;
-        first = !first;
+    while (input.nextBatch(batch, 1024)) {
+        for (size_t i = 0; i < batch.size(); i += 2)
+            pairedReads.emplace_back(batch[i].getSequence(),
+                                     batch[i + 1].getSequence());
     }
 
     return pairedReads;
 }
 
+TEST(FastxReaderTest, FastaFastqTest) {
+    // a tiny buffer forces records to span refills of the buffer
+    stringstream ss(">read1 first read\nACGT\nAC\r\n\n>read2\nGGG\n"
+                    "@read3 extra\nTTAC\n+\nIIII\n@read4\nA\n+read4\n#");
+    ReadInput input(ss, false, 3);
+    ReadBatch batch;
+
+    ASSERT_TRUE(input.nextBatch(batch, 3));
+    EXPECT_EQ(batch.getID(), 0);
+    ASSERT_EQ(batch.size(), 3);
+    EXPECT_EQ(batch[0].getName(), "read1");
+    EXPECT_EQ(batch[0].getSequence(), "ACGTAC");
+    EXPECT_EQ(batch[0].qualLength, 0);
+    EXPECT_EQ(batch[1].getName(), "read2");
+    EXPECT_EQ(batch[1].getSequence(), "GGG");
+    EXPECT_EQ(batch[2].getName(), "read3");
+    EXPECT_EQ(batch[2].getSequence(), "TTAC");
+    EXPECT_EQ(batch[2].getQualities(), "IIII");
+
+    ASSERT_TRUE(input.nextBatch(batch, 3));
+    EXPECT_EQ(batch.getID(), 1);
+    ASSERT_EQ(batch.size(), 1);
+    EXPECT_EQ(batch[0].getSequence(), "A");
+    EXPECT_EQ(batch[0].getQualities(), "#");
+
+    EXPECT_FALSE(input.nextBatch(batch, 3));
+}
+
+TEST(FastxReaderTest, InterleavedTest) {
+    stringstream ss(">p1/1\nAAAA\n>p1/2\nCCCC\n>p2/1\nGGGG\n>p2/2\nTTTT\n"
+                    ">p3/1\nACAC\n");
+    ReadInput input(ss, true);
+    ReadBatch batch;
+
+    ASSERT_TRUE(input.nextBatch(batch, 2));
+    EXPECT_TRUE(batch.isPaired());
+    ASSERT_EQ(batch.size(), 4);
+    EXPECT_EQ(batch[1].getName(), "p1/2");
+    EXPECT_EQ(batch[2].getSequence(), "GGGG");
+    EXPECT_EQ(batch[3].getSequence(), "TTTT");
+
+    // the last pair has no second mate
+    EXPECT_THROW(input.nextBatch(batch, 2), runtime_error);
+}
+
 TEST_F(IntegrationTest, bestPairedTest) {
     vector<tuple<length_t, length_t, bool>> expected = {
         make_tuple(2884786, 2885379, 1), make_tuple(1020415, 1021187, 1),
@@ -260,4 +599,100 @@ TEST_F(IntegrationTest, bestPairedTest) {
 
         EXPECT_EQ(fmindex.bestPairedMatch(pairedReads[i], 800), expected[i]);
     }
-}
\ No newline at end of file
+}
+
+TEST(PairFinderTest, ApproximateTest) {
+    // occurrences of 10 characters in contig 0 ([0, 1000)) and contig 1
+    auto occ = [](length_t begin, length_t distance) {
+        return TextOcc(Range(begin, begin + 10), distance, begin >= 1000);
+    };
+    vector<TextOcc> fw1 = {occ(100, 1), occ(500, 1), occ(1100, 0)};
+    vector<TextOcc> rc1 = {occ(640, 0)};
+    vector<TextOcc> fw2 = {occ(300, 1), occ(900, 0)};
+    vector<TextOcc> rc2 = {occ(290, 1), occ(800, 0), occ(1395, 2)};
+    PairFinder finder;
+
+    // the lowest total distance wins: (1100, 1395) has the best insert size
+    // but a total distance of 2
+    PairedMatch best = finder.findBestPair(fw1, rc1, fw2, rc2,
+                                           InsertSizeDistribution(300));
+    ASSERT_TRUE(best.valid);
+    EXPECT_EQ(best.first.begin(), 500);
+    EXPECT_EQ(best.second.begin(), 800);
+    EXPECT_TRUE(best.secondRev);
+    EXPECT_EQ(best.insert, 310);
+
+    // with an insert size of 350 +- 30 only the second mate on the forward
+    // strand pairs
+    best = finder.findBestPair(fw1, rc1, fw2, rc2,
+                               InsertSizeDistribution(350, 10, 3));
+    ASSERT_TRUE(best.valid);
+    EXPECT_EQ(best.first.begin(), 640);
+    EXPECT_EQ(best.second.begin(), 300);
+    EXPECT_FALSE(best.secondRev);
+    EXPECT_EQ(best.insert, 350);
+
+    // the mates never pair across contigs
+    best = finder.findBestPair({occ(985, 0)}, {}, {}, {occ(1000, 0)},
+                               InsertSizeDistribution(25));
+    EXPECT_FALSE(best.valid);
+}
+
+TEST(PairFinderTest, RescueTest) {
+    // a pseudo-random text with a single contig
+    string text;
+    uint32_t x = 42;
+    for (int i = 0; i < 2000; i++) {
+        x = x * 1103515245 + 12345;
+        text += "ACGT"[(x >> 16) % 4];
+    }
+    ContigTable contigs;
+    contigs.add("chr", text.size());
+    contigs.index();
+    auto revCompl = [](string s) {
+        reverse(s.begin(), s.end());
+        for (char& c : s)
+            c = (c == 'A') ? 'T' : (c == 'C') ? 'G' : (c == 'G') ? 'C' : 'A';
+        return s;
+    };
+    InsertSizeDistribution insertSize(300, 20, 3);
+    PairFinder finder;
+
+    // the first mate occurs at [1000, 1050), the second mate is the reverse
+    // complement of [1250, 1300) with a substitution and a deletion
+    string mate1 = text.substr(1000, 50);
+    string region = text.substr(1250, 50);
+    region[10] = (region[10] == 'A') ? 'C' : 'A';
+    region.erase(30, 1);
+    string mate2 = revCompl(region);
+
+    vector<TextOcc> fw1 = {TextOcc(Range(1000, 1050), 0, 0)}, rev1, fw2, rev2;
+    PairedMatch pair = finder.rescuePair(text, contigs, mate1, fw1, rev1,
+                                         mate2, fw2, rev2, 2, insertSize);
+    ASSERT_TRUE(pair.valid);
+    EXPECT_TRUE(pair.secondRev);
+    EXPECT_EQ(pair.second.begin(), 1250);
+    EXPECT_EQ(pair.second.end(), 1300);
+    EXPECT_EQ(pair.second.getDistance(), 2);
+    EXPECT_EQ(pair.insert, 300);
+    EXPECT_EQ(rev2.size(), 1);
+
+    // with one error allowed the mate is not found
+    rev2.clear();
+    pair = finder.rescuePair(text, contigs, mate1, fw1, rev1, mate2, fw2,
+                             rev2, 1, insertSize);
+    EXPECT_FALSE(pair.valid);
+    EXPECT_TRUE(rev2.empty());
+
+    // the first mate is rescued upstream of a reverse anchor
+    mate1[20] = (mate1[20] == 'G') ? 'T' : 'G';
+    fw1.clear();
+    rev2 = {TextOcc(Range(1250, 1300), 0, 0)};
+    pair = finder.rescuePair(text, contigs, mate1, fw1, rev1,
+                             revCompl(text.substr(1250, 50)), fw2, rev2, 2,
+                             insertSize);
+    ASSERT_TRUE(pair.valid);
+    EXPECT_EQ(pair.first.begin(), 1000);
+    EXPECT_EQ(pair.first.end(), 1050);
+    EXPECT_EQ(pair.first.getDistance(), 1);
+}
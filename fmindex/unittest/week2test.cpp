@@ -1,6 +1,9 @@
 #include "bandmatrix.h"
 #include "fmindex.h"
+#include "pipeline.h"
+#include "samwriter.h"
 #include "gtest/gtest.h"
+#include <sstream>
 
 using namespace std;
 
@@ -96,6 +99,200 @@ TEST(BandedMatrixTest, UpdateMatrixRowTest) {
     EXPECT_EQ(m.updateMatrixRow(pattern, 25, 'A') > k, true);
 }
 
+TEST(BandedMatrixTest, TracebackTest) {
+    string s = "ACGTACGTACGT", cigar;
+    Substring pattern(s);
+
+    // the G at index 6 of the pattern is not in the reference
+    string ref = "ACGTACTACGT";
+    BandedMatrix m(s.size(), 1, 0);
+    for (length_t i = 1; i <= ref.size(); i++)
+        m.updateMatrixRow(pattern, i, ref[i - 1]);
+    EXPECT_EQ(m(ref.size(), s.size()), 1);
+    m.traceback(pattern, ref.data(), ref.size(), cigar);
+    EXPECT_EQ(cigar, "6M1I5M");
+
+    // the reference has an extra T after index 5 and a mismatch at the end
+    ref = "ACGTACTGTACGA";
+    BandedMatrix m2(s.size(), 2, 0);
+    for (length_t i = 1; i <= ref.size(); i++)
+        m2.updateMatrixRow(pattern, i, ref[i - 1]);
+    EXPECT_EQ(m2(ref.size(), s.size()), 2);
+    m2.traceback(pattern, ref.data(), ref.size(), cigar);
+    EXPECT_EQ(cigar, "6M1D6M");
+}
+
+TEST(BandedMatrixTest, BitParallelTest) {
+    // the same rows as UpdateMatrixRowTest
+    length_t k = 4;
+    string s = "ACGTACGTAAGGCAGAT";
+    Substring pattern(s, BACKWARD);
+    BitParallelMatrix m(pattern, k, 0);
+
+    EXPECT_EQ(m.updateMatrixRow(pattern, 1, 'A'), 1);
+    EXPECT_EQ(m.updateMatrixRow(pattern, 1, 'T'), 0);
+    EXPECT_EQ(m.updateMatrixRow(pattern, 2, 'A'), 0);
+    EXPECT_EQ(m.updateMatrixRow(pattern, 3, 'G'), 0);
+    EXPECT_EQ(m.updateMatrixRow(pattern, 4, 'C'), 1);
+    EXPECT_EQ(m.updateMatrixRow(pattern, 25, 'A') > k, true);
+
+    // random rows in depth-first order, the values that are at most the
+    // width plus the start value are the same as in a BandedMatrix
+    srand(11);
+    const string chars = "ACGT";
+    for (length_t test = 0; test < 200; test++) {
+        length_t W = rand() % 6, start = rand() % 3, n = 1 + rand() % 70;
+        string p;
+        for (length_t i = 0; i < n; i++)
+            p += chars[rand() % 4];
+        Substring sub(p, (test % 2 == 0) ? FORWARD : BACKWARD);
+        BandedMatrix banded(n, W, start);
+        BitParallelMatrix bitParallel(sub, W, start);
+        length_t max = W + start + 1;
+
+        length_t row = 1;
+        for (length_t step = 0; step < 3 * n; step++) {
+            // mostly the pattern itself
+            char c = (rand() % 4 == 0) ? chars[rand() % 4] : sub[(row - 1) % n];
+            EXPECT_EQ(min(banded.updateMatrixRow(sub, row, c), max),
+                      min(bitParallel.updateMatrixRow(sub, row, c), max));
+            if (row < banded.getNumberOfRows() && banded.inFinalColumn(row)) {
+                ASSERT_TRUE(bitParallel.inFinalColumn(row));
+                EXPECT_EQ(min(banded.getValueInFinalColumn(row), max),
+                          min(bitParallel.getValueInFinalColumn(row), max));
+            }
+            // go back up the tree or one row down
+            if (rand() % 5 == 0 || row + 1 >= banded.getNumberOfRows())
+                row = 1 + rand() % row;
+            else
+                row++;
+        }
+    }
+}
+
+TEST(SamWriterTest, ReorderTest) {
+    string filename = "samwriter_test.sam";
+    {
+        SamWriter writer(filename, "@HD\tVN:1.6\n");
+        vector<string> buffers = {"b0\n", "b1\n", "", "b3\n"};
+        // batches that finish out of order are written in order
+        for (size_t id : {3, 1, 2, 0}) {
+            writer.submit(id, buffers[id]);
+            EXPECT_TRUE(buffers[id].empty());
+        }
+        writer.close();
+    }
+
+    ifstream ifs(filename);
+    stringstream ss;
+    ss << ifs.rdbuf();
+    EXPECT_EQ(ss.str(), "@HD\tVN:1.6\nb0\nb1\nb3\n");
+    remove(filename.c_str());
+}
+
+TEST(PipelineTest, BoundedQueueTest) {
+    // several producers and consumers share a small queue, every item is
+    // popped once and the items of a producer are popped in order
+    const size_t numThreads = 4, numItems = 20000;
+    BoundedQueue<size_t> queue(8);
+    vector<vector<size_t>> popped(numThreads);
+    vector<thread> producers, consumers;
+    for (size_t t = 0; t < numThreads; t++) {
+        producers.emplace_back([&queue, t, numItems]() {
+            for (size_t i = 0; i < numItems; i++)
+                EXPECT_TRUE(queue.push(t * numItems + i));
+        });
+        consumers.emplace_back([&queue, &popped, t]() {
+            size_t v;
+            while (queue.pop(v))
+                popped[t].push_back(v);
+        });
+    }
+    for (auto& p : producers)
+        p.join();
+    queue.close();
+    for (auto& c : consumers)
+        c.join();
+
+    vector<size_t> all;
+    for (const auto& p : popped) {
+        vector<size_t> last(numThreads, 0);
+        for (size_t v : p) {
+            size_t producer = v / numItems;
+            EXPECT_LE(last[producer], v % numItems + 1);
+            last[producer] = v % numItems + 1;
+        }
+        all.insert(all.end(), p.begin(), p.end());
+    }
+    sort(all.begin(), all.end());
+    ASSERT_EQ(all.size(), numThreads * numItems);
+    for (size_t i = 0; i < all.size(); i++)
+        EXPECT_EQ(all[i], i);
+}
+
+TEST(PipelineTest, CloseTest) {
+    // the items pushed before close() are still popped, nothing is pushed
+    // after it
+    BoundedQueue<int> queue(5);
+    for (int i = 0; i < 8; i++)
+        EXPECT_TRUE(queue.push(i));
+    int v;
+    EXPECT_TRUE(queue.pop(v));
+    EXPECT_EQ(v, 0);
+    queue.close();
+    EXPECT_FALSE(queue.push(8));
+    for (int i = 1; i < 8; i++) {
+        EXPECT_TRUE(queue.pop(v));
+        EXPECT_EQ(v, i);
+    }
+    EXPECT_FALSE(queue.pop(v));
+}
+
+TEST(PipelineTest, ExceptionTest) {
+    // an exception in the middle stage closes every queue, such that the
+    // endless first stage and the last stage finish, and is rethrown by join
+    BoundedQueue<int> first(4), second(4);
+    atomic<int> consumed(0);
+    Pipeline pipeline;
+    pipeline.addQueue(first);
+    pipeline.addQueue(second);
+    pipeline.addStage(
+        2,
+        [&](size_t) {
+            for (int i = 0; first.push(i); i++)
+                ;
+        },
+        [&]() { first.close(); });
+    pipeline.addStage(
+        3,
+        [&](size_t) {
+            int v;
+            while (first.pop(v)) {
+                if (v == 1000)
+                    throw runtime_error("stage failed");
+                if (!second.push(v))
+                    return;
+            }
+        },
+        [&]() { second.close(); });
+    pipeline.addStage(
+        1,
+        [&](size_t) {
+            int v;
+            while (second.pop(v))
+                consumed++;
+        },
+        nullptr);
+
+    try {
+        pipeline.join();
+        FAIL() << "join did not rethrow the exception";
+    } catch (const runtime_error& e) {
+        EXPECT_STREQ(e.what(), "stage failed");
+    }
+    EXPECT_GT(consumed, 0);
+}
+
 TEST_F(FunctionalityTest, ExtendTest) {
 
     Range s(0, text.size());
@@ -1,7 +1,11 @@
 
 #include "bidirectionalfmindex.h"
+#include "readcache.h"
+#include "rindex.h"
 #include "searchscheme.h"
 #include "gtest/gtest.h"
+#include <random>
+#include <thread>
 
 using namespace std;
 
@@ -37,6 +41,36 @@ TEST(CumulativeBitvec, PrevOccTest) {
     }
 }
 
+TEST(CumulativeBitvec, CumulOccAllTest) {
+    // random characters, pairs of positions in the same word, in the same
+    // block of 8 words and in different blocks
+    mt19937 rng(4);
+    string BWT;
+    for (size_t i = 0; i < 5000; i++)
+        BWT += (i == 1234) ? '$' : "ACGT"[rng() % 4];
+    Alphabet<5> sigma(BWT);
+    CumulativeBitvectors<5> test(sigma, BWT);
+
+    for (size_t i = 0; i < 3000; i++) {
+        size_t b = rng() % BWT.size(), e;
+        if (i % 3 == 0)
+            e = b + rng() % (64 - b % 64);
+        else if (i % 3 == 1)
+            e = b + rng() % (512 - b % 512);
+        else
+            e = b + rng() % (BWT.size() - b);
+        e = min(e, BWT.size() - 1);
+        array<size_t, 6> cumB, cumE;
+        test.cumuloccAll(b, e, cumB, cumE);
+        for (int c = 0; c < 5; c++) {
+            EXPECT_EQ(cumB[c], test.cumulocc(c, b));
+            EXPECT_EQ(cumE[c], test.cumulocc(c, e));
+        }
+        EXPECT_EQ(cumB[5], b);
+        EXPECT_EQ(cumE[5], e);
+    }
+}
+
 class Week3Test : public ::testing::Test {
   protected:
     static string base;
@@ -157,8 +191,8 @@ TEST_F(FunctionalityTest, ExtendTest) {
 
     vector<BiFMPosExt> stack;
 
-    bifmindex.setDirection(FORWARD);
-    bifmindex.extendFMPos(s, 0, stack);
+    SearchContext ctx(FORWARD);
+    bifmindex.extendFMPos(ctx, s, 0, stack);
     EXPECT_EQ(stack.size(), 4);
 
     vector<RangePair> correctRanges1 = {
@@ -174,9 +208,10 @@ TEST_F(FunctionalityTest, ExtendTest) {
         EXPECT_EQ(p.getDepth(), 1);
     }
 
-    bifmindex.setDirection(BACKWARD);
+    ctx.setDirection(BACKWARD);
     bifmindex.extendFMPos(
-        RangePair(Range(1819937, 1822541), Range(694190, 696794)), 5, stack);
+        ctx, RangePair(Range(1819937, 1822541), Range(694190, 696794)), 5,
+        stack);
     EXPECT_EQ(stack.size(), 8);
 
     vector<RangePair> correctRanges2 = {
@@ -192,9 +227,10 @@ TEST_F(FunctionalityTest, ExtendTest) {
         EXPECT_EQ(p.getDepth(), 6);
     }
 
-    bifmindex.setDirection(FORWARD);
+    ctx.setDirection(FORWARD);
     bifmindex.extendFMPos(
-        RangePair(Range(2523519, 2523522), Range(694387, 694390)), 9, stack);
+        ctx, RangePair(Range(2523519, 2523522), Range(694387, 694390)), 9,
+        stack);
     EXPECT_EQ(stack.size(), 10);
 
     vector<RangePair> correctRanges3 = {
@@ -209,6 +245,52 @@ TEST_F(FunctionalityTest, ExtendTest) {
     }
 }
 
+TEST_F(FunctionalityTest, SearchStackTest) {
+
+    // the search stack holds the same nodes as a vector of nodes
+    vector<BiFMPosExt> expected;
+    BiSearchStack stack;
+    SearchContext ctx(FORWARD);
+    RangePair s(0, text.size(), 0, text.size());
+    bifmindex.extendFMPos(ctx, s, 0, expected);
+    bifmindex.extendFMPos(ctx, s, 0, stack);
+    ctx.setDirection(BACKWARD);
+    RangePair r(Range(1819937, 1822541), Range(694190, 696794));
+    bifmindex.extendFMPos(ctx, r, 5, expected);
+    bifmindex.extendFMPos(ctx, r, 5, stack);
+
+    ASSERT_EQ(stack.size(), expected.size());
+    for (size_t i = 0; i < stack.size(); i++) {
+        EXPECT_EQ(stack.getRanges(i), expected[i].getRanges());
+        EXPECT_EQ(stack.getCharacter(i), expected[i].getCharacter());
+        EXPECT_EQ(stack.getRow(i), expected[i].getRow());
+    }
+
+    // the nodes below the top are kept when the arena grows
+    for (length_t i = 0; i < 5000; i++)
+        stack.emplace_back('A', RangePair(i, i + 2, 3 * i, 3 * i + 2), i);
+    EXPECT_EQ(stack.size(), expected.size() + 5000);
+    for (length_t i = 5000; i-- > 0;) {
+        size_t top = stack.size() - 1;
+        EXPECT_EQ(stack.getRanges(top), RangePair(i, i + 2, 3 * i, 3 * i + 2));
+        EXPECT_EQ(stack.getRow(top), i);
+        stack.pop_back();
+    }
+    for (size_t i = 0; i < stack.size(); i++)
+        EXPECT_EQ(stack.getRanges(i), expected[i].getRanges());
+
+    // swapping exchanges all values of two nodes
+    stack.swap(0, 5);
+    EXPECT_EQ(stack.getRanges(0), expected[5].getRanges());
+    EXPECT_EQ(stack.getCharacter(0), expected[5].getCharacter());
+    EXPECT_EQ(stack.getRow(0), expected[5].getRow());
+    EXPECT_EQ(stack.getRanges(5), expected[0].getRanges());
+    EXPECT_EQ(stack.getRow(5), expected[0].getRow());
+
+    stack.clear();
+    EXPECT_TRUE(stack.empty());
+}
+
 TEST_F(FunctionalityTest, matchBidirectionallyTest) {
 
     vector<string> strings = {
@@ -288,7 +370,6 @@ TEST_F(FunctionalityTest, matchBidirectionallyTest) {
     for (length_t i = 0; i < substrings.size(); i++) {
         auto& sub = substrings[i];
         Direction dir = (i % 2) ? FORWARD : BACKWARD;
-        bifmindex.setDirection(dir);
         sub.setDirection(dir);
 
         EXPECT_EQ(bifmindex.matchExactBidirectionally(sub), expectedOutput[i]);
@@ -373,7 +454,6 @@ TEST_F(FunctionalityTest, matchBidirectionallyTest) {
     for (length_t i = 0; i < substrings2.size(); i++) {
         auto& sub = substrings2[i];
         Direction dir = ((i + 1) % 2) ? FORWARD : BACKWARD;
-        bifmindex.setDirection(dir);
         sub.setDirection(dir);
 
         EXPECT_EQ(bifmindex.matchExactBidirectionally(sub, expectedOutput[i]),
@@ -381,6 +461,31 @@ TEST_F(FunctionalityTest, matchBidirectionallyTest) {
     }
 }
 
+TEST_F(FunctionalityTest, RIndexTest) {
+    RIndex rindex(base, false);
+    EXPECT_EQ(rindex.getTextLength(), text.size());
+
+    vector<string> patterns = {"ACAGC", "TCTAGGAT", "GATTACAGA", "AAAAA",
+                               "ACCGGATCGTGTGAAGAGGGGAACGTTC"};
+    for (length_t i = 0; i + 12 <= 4000; i += 400)
+        patterns.push_back(text.substr(i, 12));
+
+    for (const auto& p : patterns) {
+        auto expected = bifmindex.matchExact(p);
+        auto pos = rindex.matchExact(p);
+        sort(expected.begin(), expected.end());
+        sort(pos.begin(), pos.end());
+        EXPECT_EQ(pos, expected);
+
+        for (Direction dir : {FORWARD, BACKWARD}) {
+            Substring sub(p);
+            sub.setDirection(dir);
+            EXPECT_EQ(rindex.matchExactBidirectionally(sub),
+                      bifmindex.matchExactBidirectionally(sub));
+        }
+    }
+}
+
 TEST_F(IntegrationTest, SearchSchemeApproxTest) {
 
     vector<string> tests = {
@@ -404,3 +509,368 @@ TEST_F(IntegrationTest, SearchSchemeApproxTest) {
                   ss.matchApprox(test));
     }
 }
+
+TEST_F(IntegrationTest, SearchContextReuseTest) {
+    // the workspace of the thread grows and shrinks with the patterns, the
+    // results are the same as with a fresh workspace in a new thread. The
+    // reads of 18 characters are too short for the scheme and take the
+    // naive search.
+    vector<string> reads;
+    for (length_t i = 0; i < 12; i++) {
+        length_t size = (i % 3 == 0) ? 150 : 30 + 10 * (i % 3);
+        if (i % 4 == 3)
+            size = 18;
+        string r = text.substr(100000 + i * 5000, size);
+        r[size / 2] = (r[size / 2] == 'A') ? 'C' : 'A';
+        reads.push_back(r);
+    }
+
+    vector<vector<TextOcc>> reused, fresh(reads.size());
+    vector<vector<TextOcc>> reusedBest, freshBest(reads.size());
+    for (const auto& r : reads) {
+        reused.push_back(ss.matchApprox(r));
+        reusedBest.push_back(ss.matchBestStratum(r));
+    }
+    for (size_t i = 0; i < reads.size(); i++) {
+        thread worker([&reads, &fresh, &freshBest, i]() {
+            fresh[i] = ss.matchApprox(reads[i]);
+            freshBest[i] = ss.matchBestStratum(reads[i]);
+        });
+        worker.join();
+    }
+    EXPECT_EQ(reused, fresh);
+    EXPECT_EQ(reusedBest, freshBest);
+    for (size_t i = 0; i < reads.size(); i++)
+        EXPECT_EQ(reused[i], bifmindex.naiveApproxMatch(reads[i], maxED));
+}
+
+TEST_F(IntegrationTest, VerificationTest) {
+    // the searches that continue in the text find the same occurrences as
+    // the searches in the index only
+    vector<string> reads;
+    for (length_t i = 0; i < 20; i++) {
+        string r = text.substr(200000 + i * 7919, 60 + i);
+        r[i + 5] = (r[i + 5] == 'G') ? 'T' : 'G';
+        if (i % 2 == 0)
+            r.erase(30, 1);
+        reads.push_back(r);
+    }
+    // the verification is off unless it is switched on
+    length_t width = bifmindex.getVerificationWidth();
+    EXPECT_EQ(width, 0);
+
+    bool located = false;
+    for (const auto& r : reads) {
+        bifmindex.setVerificationWidth(0);
+        auto approx = ss.matchApprox(r);
+        auto naive = bifmindex.naiveApproxMatch(r.substr(0, 12), 1);
+        auto exact = bifmindex.matchExact(r.substr(40, 12));
+        bifmindex.setVerificationWidth(4);
+        EXPECT_EQ(ss.matchApprox(r), approx);
+        EXPECT_EQ(bifmindex.naiveApproxMatch(r.substr(0, 12), 1), naive);
+        EXPECT_EQ(bifmindex.matchExact(r.substr(40, 12)), exact);
+
+        vector<FMOcc> occ;
+        ss.searchApprox(r, occ);
+        for (const auto& o : occ)
+            located |= o.isLocated();
+    }
+    EXPECT_TRUE(located);
+    bifmindex.setVerificationWidth(width);
+}
+
+TEST_F(IntegrationTest, SearchSchemeThreadsTest) {
+    // one shared index and search scheme, every thread maps all reads
+    vector<string> reads;
+    for (length_t i = 0; i < 100; i++) {
+        string r = text.substr(i * 40000, 100);
+        r[i] = (r[i] == 'A') ? 'C' : 'A';
+        reads.push_back(r);
+    }
+
+    vector<vector<TextOcc>> expected;
+    for (const auto& r : reads)
+        expected.push_back(ss.matchApprox(r));
+
+    const length_t numThreads = 4;
+    vector<vector<vector<TextOcc>>> results(numThreads);
+    vector<thread> workers;
+    for (length_t t = 0; t < numThreads; t++) {
+        workers.emplace_back([&reads, &results, t]() {
+            for (const auto& r : reads)
+                results[t].push_back(ss.matchApprox(r));
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+
+    for (const auto& result : results)
+        EXPECT_EQ(result, expected);
+}
+
+TEST_F(IntegrationTest, BestStratumTest) {
+    for (length_t i = 0; i + 100 <= 40000; i += 4000) {
+        // a read with i / 10000 substitutions
+        string read = text.substr(i, 100);
+        for (length_t j = 0; j < i / 10000; j++)
+            read[20 + 30 * j] = (read[20 + 30 * j] == 'A') ? 'C' : 'A';
+
+        // the best stratum holds the occurrences with the lowest distance
+        auto all = ss.matchApprox(read);
+        ASSERT_FALSE(all.empty());
+        length_t best = all.front().getDistance();
+        for (const auto& o : all)
+            best = min(best, o.getDistance());
+        vector<length_t> expected;
+        for (const auto& o : all)
+            if (o.getDistance() == best)
+                expected.push_back(o.begin());
+
+        vector<FMOcc> fmocc;
+        EXPECT_EQ(ss.searchBestStratum(read, fmocc), best);
+        vector<length_t> pos;
+        for (const auto& o : ss.matchBestStratum(read)) {
+            EXPECT_EQ(o.getDistance(), best);
+            pos.push_back(o.begin());
+        }
+        EXPECT_EQ(pos, expected);
+
+        // the next stratum adds the occurrences with one more error
+        for (const auto& o : ss.matchBestStratum(read, 1))
+            EXPECT_LE(o.getDistance(), best + 1);
+    }
+
+    // the pattern does not occur with at most 1 error
+    vector<FMOcc> fmocc;
+    EXPECT_EQ(ss.searchBestStratum(string(50, 'A') + string(50, 'C'), fmocc,
+                                   0, 1),
+              2);
+}
+
+TEST_F(IntegrationTest, NaiveBestSearchTest) {
+    for (length_t i = 0; i < 10; i++) {
+        // a short pattern with i / 3 substitutions
+        string p = text.substr(300000 + i * 6007, 16 + i);
+        for (length_t j = 0; j < i / 3; j++)
+            p[3 + 5 * j] = (p[3 + 5 * j] == 'A') ? 'C' : 'A';
+
+        // the pruned search finds the occurrences of the full search with
+        // at most the best distance plus the extra strata
+        auto all = bifmindex.naiveApproxMatch(p, maxED);
+        ASSERT_FALSE(all.empty());
+        length_t best = all.front().getDistance();
+        for (const auto& o : all)
+            best = min(best, o.getDistance());
+        for (length_t extra = 0; extra < 2; extra++) {
+            vector<TextOcc> expected;
+            for (const auto& o : all)
+                if (o.getDistance() <= best + extra)
+                    expected.push_back(o);
+
+            vector<FMOcc> fmocc;
+            EXPECT_EQ(bifmindex.naiveBestSearch(p, maxED, fmocc, extra),
+                      best);
+            EXPECT_EQ(bifmindex.filterRedundantMatches(fmocc, maxED),
+                      expected);
+        }
+
+        // the same best stratum as the search schemes, which fall back to
+        // naiveBestSearch for the strata that are too high for the pattern
+        vector<FMOcc> fmocc;
+        EXPECT_EQ(ss.searchBestStratum(p, fmocc), best);
+    }
+
+    // no occurrences with at most 1 error: the N's never match
+    vector<FMOcc> fmocc;
+    EXPECT_EQ(bifmindex.naiveBestSearch("NNNNACGTACGT", 1, fmocc), 2);
+    EXPECT_TRUE(fmocc.empty());
+}
+
+TEST_F(IntegrationTest, ReadCacheTest) {
+    ReadCache cache(1000000);
+    vector<string> reads;
+    for (length_t i = 0; i < 20; i++)
+        reads.push_back(text.substr(i * 1000, 100));
+
+    ReadMatches matches;
+    for (const auto& r : reads) {
+        EXPECT_FALSE(cache.lookup(r, 2, matches));
+        matches.occ[0] = ss.matchApprox(r);
+        matches.occ[1] = ss.matchApprox(bifmindex.revCompl(r));
+        matches.numOcc[0] = matches.occ[0].size();
+        matches.numOcc[1] = matches.occ[1].size();
+        cache.insert(r, 2, matches);
+    }
+    EXPECT_EQ(cache.size(), 20);
+
+    // duplicates and reverse-complement duplicates share the entry
+    for (const auto& r : reads) {
+        string rc = bifmindex.revCompl(r);
+        ASSERT_TRUE(cache.lookup(r, 2, matches));
+        EXPECT_EQ(matches.occ[0], ss.matchApprox(r));
+        EXPECT_EQ(matches.occ[1], ss.matchApprox(rc));
+        ASSERT_TRUE(cache.lookup(rc, 2, matches));
+        EXPECT_EQ(matches.occ[0], ss.matchApprox(rc));
+        EXPECT_EQ(matches.occ[1], ss.matchApprox(r));
+        EXPECT_EQ(matches.numOcc[1], matches.occ[1].size());
+        // the maximal edit distance is part of the key
+        EXPECT_FALSE(cache.lookup(r, 1, matches));
+    }
+    EXPECT_EQ(cache.getHits(), 40);
+    EXPECT_EQ(cache.getMisses(), 40);
+
+    // reads with other characters are not cached
+    string n = reads[0];
+    n[50] = 'N';
+    cache.insert(n, 2, matches);
+    EXPECT_FALSE(cache.lookup(n, 2, matches));
+    // the length is part of the key
+    EXPECT_FALSE(cache.lookup("ACGTA", 2, matches));
+    cache.insert("ACGT", 2, ReadMatches());
+    EXPECT_TRUE(cache.lookup("ACGT", 2, matches));
+    EXPECT_FALSE(cache.lookup("ACGTA", 2, matches));
+}
+
+TEST(ReadCacheTest, EvictionTest) {
+    // one shard of 10 occurrences, every entry costs 3
+    ReadCache cache(10, 1);
+    ReadMatches matches;
+    matches.occ[0].push_back(TextOcc(Range(0, 4), 0));
+    matches.occ[1].push_back(TextOcc(Range(8, 12), 1));
+    const vector<string> reads = {"AAAC", "AAAG", "AAAT", "AACA"};
+    for (length_t i = 0; i < 3; i++)
+        cache.insert(reads[i], 1, matches);
+    EXPECT_TRUE(cache.lookup(reads[0], 1, matches));
+    // the least recently used entry is evicted
+    cache.insert(reads[3], 1, matches);
+    EXPECT_EQ(cache.size(), 3);
+    EXPECT_TRUE(cache.lookup(reads[0], 1, matches));
+    EXPECT_FALSE(cache.lookup(reads[1], 1, matches));
+    EXPECT_TRUE(cache.lookup(reads[3], 1, matches));
+
+    // matches that do not fit are not stored
+    matches.occ[0].resize(10);
+    cache.insert("CCCC", 1, matches);
+    EXPECT_FALSE(cache.lookup("CCCC", 1, matches));
+
+    // concurrent lookups and inserts
+    vector<thread> workers;
+    for (length_t t = 0; t < 4; t++) {
+        workers.emplace_back([&cache, t]() {
+            ReadMatches m;
+            m.occ[0].push_back(TextOcc(Range(t, t + 4), 0));
+            for (length_t i = 0; i < 1000; i++) {
+                string r = string(1 + i % 16, 'A') + "C";
+                if (!cache.lookup(r, 1, m))
+                    cache.insert(r, 1, m);
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    EXPECT_LE(cache.size(), 5);
+    EXPECT_EQ(cache.getHits() + cache.getMisses(), 4000 + 5);
+}
+
+TEST(ReadCacheTest, SmallCacheTest) {
+    // a cache smaller than 16 occurrences per default shard still hits
+    ReadCache cache(40);
+    ReadMatches matches;
+    matches.occ[0].push_back(TextOcc(Range(0, 4), 0));
+    matches.occ[1].push_back(TextOcc(Range(8, 12), 1));
+    const vector<string> reads = {"AAAC", "AAAG", "AAAT", "AACA"};
+    for (const auto& r : reads)
+        cache.insert(r, 1, matches);
+    size_t hits = 0;
+    for (const auto& r : reads)
+        hits += cache.lookup(r, 1, matches);
+    EXPECT_GT(hits, 0);
+}
+
+TEST(IndexFileTest, RoundTripTest) {
+    // a random text with repeats, such that the approximate searches find
+    // occurrences in several places
+    mt19937 rng(7);
+    string text;
+    for (length_t i = 0; i < 20000; i++)
+        text.push_back("ACGT"[rng() % 4]);
+    text += text.substr(3000, 2000) + text.substr(9000, 1000) + "$";
+    const string base = "roundtrip";
+    {
+        ofstream ofs(base + ".txt");
+        ofs << text;
+    }
+
+    vector<string> reads;
+    for (length_t i = 0; i < 20; i++) {
+        string r = text.substr(2500 + i * 997, 40 + i);
+        r[i + 3] = (r[i + 3] == 'C') ? 'A' : 'C';
+        reads.push_back(r);
+    }
+
+    for (OccTableLayout layout : {BITVECTORS, INTERLEAVED}) {
+        for (SASampling sampling : {SAMPLE_SA_INDEX, SAMPLE_TEXT_POSITION}) {
+            remove((base + ".fmi").c_str());
+            remove((base + ".rev.fmi").c_str());
+            BiFMIndex built(base, 4, false, layout, sampling);
+            built.createKmerTable(6, 1 << 20);
+            built.write(base);
+            SearchScheme ssBuilt(built, "../../search_schemes/kuch_k+1/", 2);
+
+            // the index files are mapped instead of built again, with the
+            // layout, sparseness and sampling of the files
+            BiFMIndex mapped(base, 8, false);
+            EXPECT_EQ(mapped.getOccTableLayout(), layout);
+            EXPECT_EQ(mapped.getSparseSA().getSparseness(), 4);
+            EXPECT_EQ(mapped.getSparseSA().getSampling(), sampling);
+            SearchScheme ssMapped(mapped, "../../search_schemes/kuch_k+1/", 2);
+            EXPECT_EQ(mapped.getBWT(), built.getBWT());
+            for (const auto& r : reads) {
+                EXPECT_EQ(mapped.matchExact(r.substr(0, 12)),
+                          built.matchExact(r.substr(0, 12)));
+                EXPECT_EQ(ssMapped.matchApprox(r), ssBuilt.matchApprox(r));
+            }
+        }
+    }
+
+    // index files of another text of the same length are rejected
+    text[10] = (text[10] == 'A') ? 'G' : 'A';
+    {
+        ofstream ofs(base + ".txt");
+        ofs << text;
+    }
+    EXPECT_THROW(BiFMIndex(base, 4, false), runtime_error);
+
+    for (const string ext : {".txt", ".fmi", ".rev.fmi"})
+        remove((base + ext).c_str());
+}
+
+TEST(IndexFileTest, CorruptSectionTest) {
+    const string filename = "corrupt.fmi";
+    uint64_t value = 42;
+    IndexFileWriter w(filename);
+    w.writeSection("PARAMS", &value, sizeof(value));
+    w.close();
+
+    MappedIndexFile file;
+    ASSERT_TRUE(file.open(filename));
+    EXPECT_EQ(*(const uint64_t*)file.section("PARAMS"), value);
+    file = MappedIndexFile();
+
+    // a section that ends past the end of the file is rejected
+    IndexFileHeader header;
+    IndexFileSection section;
+    fstream fs(filename, ios::in | ios::out | ios::binary);
+    fs.read((char*)&header, sizeof(header));
+    fs.seekg(header.tableOffset);
+    fs.read((char*)&section, sizeof(section));
+    for (uint64_t size : {(uint64_t)1 << 20, ~(uint64_t)0}) {
+        section.size = size;
+        fs.seekp(header.tableOffset);
+        fs.write((char*)&section, sizeof(section));
+        fs.flush();
+        EXPECT_FALSE(file.open(filename));
+    }
+    fs.close();
+    remove(filename.c_str());
+}